@@ -0,0 +1,8 @@
+CONFIG_DISABLE_ES2015_ARROW_FUNCTION
+CONFIG_DISABLE_ES2015_BUILTIN
+CONFIG_DISABLE_ES2015_FUNCTION_PARAMETER_INITIALIZER
+CONFIG_DISABLE_ES2015_FUNCTION_REST_PARAMETER
+CONFIG_DISABLE_ES2015_MAP_BUILTIN
+CONFIG_DISABLE_ES2015_PROMISE_BUILTIN
+CONFIG_DISABLE_ES2015_SYMBOL_BUILTIN
+CONFIG_DISABLE_ES2015_TEMPLATE_STRINGS
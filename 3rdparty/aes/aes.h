@@ -42,7 +42,8 @@
 
 struct AES_ctx
 {
-  uint8_t RoundKey[AES_keyExpSize];
+  uint32_t RoundKey[AES_keyExpSize / 4];
+  uint32_t InvRoundKey[AES_keyExpSize / 4];
 #if (defined(CBC) && (CBC == 1)) || (defined(CTR) && (CTR == 1))
   uint8_t Iv[AES_BLOCKLEN];
 #endif
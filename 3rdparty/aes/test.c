@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
 
 // Enable ECB, CTR and CBC mode. Note this can be done before including aes.h or at compile-time.
 // E.g. with GCC by using the -D flag: gcc -c aes.c -DCBC=0 -DCTR=1 -DECB=1
@@ -19,6 +21,7 @@ static int test_decrypt_ctr(void);
 static int test_encrypt_ecb(void);
 static int test_decrypt_ecb(void);
 static void test_encrypt_ecb_verbose(void);
+static void test_throughput(void);
 
 
 int main(void)
@@ -40,6 +43,7 @@ int main(void)
 	test_encrypt_ctr() + test_decrypt_ctr() +
 	test_decrypt_ecb() + test_encrypt_ecb();
     test_encrypt_ecb_verbose();
+    test_throughput();
 
     return exit;
 }
@@ -314,3 +318,35 @@ static int test_decrypt_ecb(void)
 }
 
 
+// MB/s over a buffer the size of a large protected bundle
+static void test_throughput(void)
+{
+    const uint32_t len = 8 * 1024 * 1024;
+    const int rounds = 8;
+    uint8_t key[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+    uint8_t iv[16]  = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+    uint8_t* buf = (uint8_t*) calloc(len, 1);
+    struct AES_ctx ctx;
+    const char* names[3] = { "CBC encrypt", "CBC decrypt", "CTR xcrypt" };
+    int mode, i;
+
+    printf("throughput:\n");
+    for (mode = 0; mode < 3; ++mode)
+    {
+        clock_t start = clock();
+        for (i = 0; i < rounds; ++i)
+        {
+            AES_init_ctx_iv(&ctx, key, iv);
+            if (mode == 0)
+                AES_CBC_encrypt_buffer(&ctx, buf, len);
+            else if (mode == 1)
+                AES_CBC_decrypt_buffer(&ctx, buf, len);
+            else
+                AES_CTR_xcrypt_buffer(&ctx, buf, len);
+        }
+        double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+        printf("%s: %.1f MB/s\n", names[mode], seconds > 0 ? rounds * (len / 1048576.0) / seconds : 0);
+    }
+    printf("\n");
+    free(buf);
+}
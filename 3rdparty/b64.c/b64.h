@@ -20,6 +20,19 @@
 #  define b64_realloc(ptr, size) realloc(ptr, size)
 #endif
 
+/**
+ * Exact length of the encoding of `n' bytes, without a terminator.
+ */
+
+#define B64_ENCODED_SIZE(n) (((n) + 2) / 3 * 4)
+
+/**
+ * Upper bound of the bytes decoded from `n' chars, exact for input
+ * without `=' padding.
+ */
+
+#define B64_DECODED_SIZE(n) ((n) / 4 * 3 + ((n) % 4 > 1 ? (n) % 4 - 1 : 0))
+
 /**
  * Base64 index table.
  */
@@ -61,6 +74,25 @@ b64_decode (const char *, size_t);
 unsigned char *
 b64_decode_ex (const char *, size_t, size_t *);
 
+/**
+ * Encode `unsigned char *' source with `size_t' size into `char *'
+ * destination of B64_ENCODED_SIZE(size) bytes; it is not terminated.
+ * Returns the number of chars written.
+ */
+
+size_t
+b64_encode_to (const unsigned char *, size_t, char *);
+
+/**
+ * Decode `char *' source with `size_t' size into `unsigned char *'
+ * destination of B64_DECODED_SIZE(size) bytes. Like b64_decode, decoding
+ * stops at `=' or the first char that is not base64.
+ * Returns the number of bytes written.
+ */
+
+size_t
+b64_decode_to (const char *, size_t, unsigned char *);
+
 #ifdef __cplusplus
 }
 #endif
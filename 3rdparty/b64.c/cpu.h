@@ -0,0 +1,33 @@
+
+/**
+ * `cpu.h' - b64
+ *
+ * Picks the vector paths at runtime, so one build runs on any x86.
+ */
+
+#ifndef B64_CPU_H
+#define B64_CPU_H 1
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__EMSCRIPTEN__)
+#  define B64_X86 1
+#  include <immintrin.h>
+#  define B64_TARGET(isa) __attribute__((target(isa)))
+
+enum {
+  B64_CPU_SSSE3 = 1,
+  B64_CPU_AVX2 = 2
+};
+
+static inline int
+b64_cpu (void) {
+  static int features = -1;
+  if (features < 0) {
+    __builtin_cpu_init();
+    features = (__builtin_cpu_supports("ssse3") ? B64_CPU_SSSE3 : 0) |
+               (__builtin_cpu_supports("avx2") ? B64_CPU_AVX2 : 0);
+  }
+  return features;
+}
+#endif
+
+#endif
@@ -7,8 +7,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
 #include "b64.h"
+#include "cpu.h"
 
 #ifdef b64_USE_CUSTOM_MALLOC
 extern void* b64_malloc(size_t);
@@ -18,109 +20,186 @@ extern void* b64_malloc(size_t);
 extern void* b64_realloc(void*, size_t);
 #endif
 
-unsigned char *
-b64_decode (const char *src, size_t len) {
-  return b64_decode_ex(src, len, NULL);
-}
+/**
+ * 6 bit value of each char, 0xff for `=' and chars that are not base64.
+ */
 
-unsigned char *
-b64_decode_ex (const char *src, size_t len, size_t *decsize) {
-  int i = 0;
-  int j = 0;
-  int l = 0;
-  size_t size = 0;
-  unsigned char *dec = NULL;
-  unsigned char buf[3];
-  unsigned char tmp[4];
-
-  // alloc
-  dec = (unsigned char *) b64_malloc(1);
-  if (NULL == dec) { return NULL; }
+static const uint8_t b64_values[256] = {
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+  0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+  0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+  0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+#ifdef B64_X86
+/**
+ * Classifies chars by their nibbles, see
+ * http://0x80.pl/notesen/2016-01-17-sse-base64-decoding.html
+ */
 
-  // parse until end of source
-  while (len--) {
-    // break if char is `=' or not base64 char
-    if ('=' == src[j]) { break; }
-    if (!(isalnum(src[j]) || '+' == src[j] || '/' == src[j])) { break; }
-
-    // read up to 4 bytes at a time into `tmp'
-    tmp[i++] = src[j++];
-
-    // if 4 bytes read then decode into `buf'
-    if (4 == i) {
-      // translate values in `tmp' from table
-      for (i = 0; i < 4; ++i) {
-        // find translation char in `b64_table'
-        for (l = 0; l < 64; ++l) {
-          if (tmp[i] == b64_table[l]) {
-            tmp[i] = l;
-            break;
-          }
-        }
-      }
-
-      // decode
-      buf[0] = (tmp[0] << 2) + ((tmp[1] & 0x30) >> 4);
-      buf[1] = ((tmp[1] & 0xf) << 4) + ((tmp[2] & 0x3c) >> 2);
-      buf[2] = ((tmp[2] & 0x3) << 6) + tmp[3];
-
-      // write decoded buffer to `dec'
-      dec = (unsigned char *) b64_realloc(dec, size + 3);
-      if (dec != NULL){
-        for (i = 0; i < 3; ++i) {
-          dec[size++] = buf[i];
-        }
-      } else {
-        return NULL;
-      }
-
-      // reset
-      i = 0;
+#define B64_DEC_LUT_LO 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, \
+                       0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+#define B64_DEC_LUT_HI 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, \
+                       0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+#define B64_DEC_LUT_ROLL 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+#define B64_DEC_PACK 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+/**
+ * 16 chars in, 12 bytes out; writes 16 bytes. Stops before the first
+ * block holding a char that is not base64 and leaves it to the scalar loop.
+ */
+
+B64_TARGET("ssse3") static size_t
+dec_ssse3 (const uint8_t *src, size_t len, uint8_t *dst) {
+  const __m128i lut_lo = _mm_setr_epi8(B64_DEC_LUT_LO);
+  const __m128i lut_hi = _mm_setr_epi8(B64_DEC_LUT_HI);
+  const __m128i lut_roll = _mm_setr_epi8(B64_DEC_LUT_ROLL);
+  const __m128i nibble = _mm_set1_epi8(0x0f);
+  size_t done = 0;
+
+  // the 4 spare bytes of the store stay inside a B64_DECODED_SIZE buffer
+  for (; len - done >= 24; done += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *) (src + done));
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), nibble);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(in, nibble));
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff) {
+      break;
     }
+
+    __m128i eq_2f = _mm_cmpeq_epi8(in, _mm_set1_epi8(0x2f));
+    __m128i values = _mm_add_epi8(in, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+    __m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i out = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+    out = _mm_shuffle_epi8(out, _mm_setr_epi8(B64_DEC_PACK));
+    _mm_storeu_si128((__m128i *) (dst + done / 4 * 3), out);
   }
+  return done;
+}
 
-  // remainder
-  if (i > 0) {
-    // fill `tmp' with `\0' at most 4 times
-    for (j = i; j < 4; ++j) {
-      tmp[j] = '\0';
+/**
+ * 32 chars in, 24 bytes out; writes 32 bytes.
+ */
+
+B64_TARGET("avx2") static size_t
+dec_avx2 (const uint8_t *src, size_t len, uint8_t *dst) {
+  const __m256i lut_lo = _mm256_setr_epi8(B64_DEC_LUT_LO, B64_DEC_LUT_LO);
+  const __m256i lut_hi = _mm256_setr_epi8(B64_DEC_LUT_HI, B64_DEC_LUT_HI);
+  const __m256i lut_roll = _mm256_setr_epi8(B64_DEC_LUT_ROLL, B64_DEC_LUT_ROLL);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  size_t done = 0;
+
+  for (; len - done >= 48; done += 32) {
+    __m256i in = _mm256_loadu_si256((const __m256i *) (src + done));
+    __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), nibble);
+    __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(in, nibble));
+    __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) {
+      break;
     }
 
-    // translate remainder
-    for (j = 0; j < 4; ++j) {
-        // find translation char in `b64_table'
-        for (l = 0; l < 64; ++l) {
-          if (tmp[j] == b64_table[l]) {
-            tmp[j] = l;
-            break;
-          }
-        }
+    __m256i eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(0x2f));
+    __m256i values = _mm256_add_epi8(in, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+    __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i out = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+    out = _mm256_shuffle_epi8(out, _mm256_setr_epi8(B64_DEC_PACK, B64_DEC_PACK));
+    out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256((__m256i *) (dst + done / 4 * 3), out);
+  }
+  return done;
+}
+#endif
+
+size_t
+b64_decode_to (const char *src, size_t len, unsigned char *dst) {
+  const uint8_t *in = (const uint8_t *) src;
+  uint8_t *out = dst;
+  size_t i = 0;
+
+#ifdef B64_X86
+  int cpu = b64_cpu();
+  if (cpu & B64_CPU_AVX2) {
+    i = dec_avx2(in, len, dst);
+  }
+  if (cpu & B64_CPU_SSSE3) {
+    i += dec_ssse3(in + i, len - i, dst + i / 4 * 3);
+  }
+  out += i / 4 * 3;
+#endif
+
+  // 8 chars to 6 bytes, one validity test for all of them
+  for (; len - i >= 8; i += 8, out += 6) {
+    const uint8_t *p = in + i;
+    uint32_t a = b64_values[p[0]], b = b64_values[p[1]], c = b64_values[p[2]], d = b64_values[p[3]];
+    uint32_t e = b64_values[p[4]], f = b64_values[p[5]], g = b64_values[p[6]], h = b64_values[p[7]];
+    if ((a | b | c | d | e | f | g | h) & 0x80) {
+      break;
     }
 
-    // decode remainder
-    buf[0] = (tmp[0] << 2) + ((tmp[1] & 0x30) >> 4);
-    buf[1] = ((tmp[1] & 0xf) << 4) + ((tmp[2] & 0x3c) >> 2);
-    buf[2] = ((tmp[2] & 0x3) << 6) + tmp[3];
-
-    // write remainer decoded buffer to `dec'
-    dec = (unsigned char *) b64_realloc(dec, size + (i - 1));
-    if (dec != NULL){
-      for (j = 0; (j < i - 1); ++j) {
-        dec[size++] = buf[j];
-      }
-    } else {
-      return NULL;
+    uint64_t v = (uint64_t) (a << 18 | b << 12 | c << 6 | d) << 24 | (e << 18 | f << 12 | g << 6 | h);
+    uint8_t bytes[6] = {
+      (uint8_t) (v >> 40), (uint8_t) (v >> 32), (uint8_t) (v >> 24),
+      (uint8_t) (v >> 16), (uint8_t) (v >> 8), (uint8_t) v
+    };
+    memcpy(out, bytes, 6);
+  }
+
+  // the rest, char by char up to `=' or the first char that is not base64
+  uint32_t acc = 0;
+  int n = 0;
+  for (; i < len; i++) {
+    uint32_t value = b64_values[in[i]];
+    if (value & 0x80) { break; }
+
+    acc = acc << 6 | value;
+    if (4 == ++n) {
+      out[0] = (uint8_t) (acc >> 16);
+      out[1] = (uint8_t) (acc >> 8);
+      out[2] = (uint8_t) acc;
+      out += 3;
+      acc = 0;
+      n = 0;
     }
   }
 
-  // Make sure we have enough space to add '\0' character at end.
-  dec = (unsigned char *) b64_realloc(dec, size + 1);
-  if (dec != NULL){
-    dec[size] = '\0';
-  } else {
-    return NULL;
+  // a partial group of n chars holds n - 1 bytes
+  if (n > 1) {
+    acc <<= 6 * (4 - n);
+    out[0] = (uint8_t) (acc >> 16);
+    if (3 == n) {
+      out[1] = (uint8_t) (acc >> 8);
+    }
+    out += n - 1;
   }
 
+  return (size_t) (out - dst);
+}
+
+unsigned char *
+b64_decode (const char *src, size_t len) {
+  return b64_decode_ex(src, len, NULL);
+}
+
+unsigned char *
+b64_decode_ex (const char *src, size_t len, size_t *decsize) {
+  unsigned char *dec = (unsigned char *) b64_malloc(B64_DECODED_SIZE(len) + 1);
+  if (NULL == dec) { return NULL; }
+
+  size_t size = b64_decode_to(src, len, dec);
+  dec[size] = '\0';
+
   // Return back the size of decoded string if demanded.
   if (decsize != NULL) {
     *decsize = size;
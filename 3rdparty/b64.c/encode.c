@@ -7,7 +7,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include "b64.h"
+#include "cpu.h"
 
 #ifdef b64_USE_CUSTOM_MALLOC
 extern void* b64_malloc(size_t);
@@ -17,75 +20,121 @@ extern void* b64_malloc(size_t);
 extern void* b64_realloc(void*, size_t);
 #endif
 
-char *
-b64_encode (const unsigned char *src, size_t len) {
-  int i = 0;
-  int j = 0;
-  char *enc = NULL;
-  size_t size = 0;
-  unsigned char buf[4];
-  unsigned char tmp[3];
-
-  // alloc
-  enc = (char *) b64_malloc(1);
-  if (NULL == enc) { return NULL; }
+#ifdef B64_X86
+/**
+ * 6 bit indices to chars: the index range picks an offset that is added
+ * to the index, see http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html
+ */
+
+B64_TARGET("ssse3") static inline __m128i
+enc_translate_ssse3 (__m128i indices) {
+  const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                      '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+  __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+  result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+  return _mm_add_epi8(_mm_shuffle_epi8(shift, result), indices);
+}
+
+/**
+ * 12 bytes in, 16 chars out; reads 16 bytes.
+ */
+
+B64_TARGET("ssse3") static size_t
+enc_ssse3 (const unsigned char *src, size_t len, char *dst) {
+  size_t done = 0;
+  for (; len - done >= 16; done += 12) {
+    __m128i in = _mm_loadu_si128((const __m128i *) (src + done));
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+    __m128i t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+    _mm_storeu_si128((__m128i *) (dst + done / 3 * 4), enc_translate_ssse3(_mm_or_si128(t0, t1)));
+  }
+  return done;
+}
+
+B64_TARGET("avx2") static inline __m256i
+enc_translate_avx2 (__m256i indices) {
+  const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                         'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                         '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+  __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+  result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+  return _mm256_add_epi8(_mm256_shuffle_epi8(shift, result), indices);
+}
+
+/**
+ * 24 bytes in, 32 chars out; each lane takes 12 bytes, reads 28 bytes.
+ */
+
+B64_TARGET("avx2") static size_t
+enc_avx2 (const unsigned char *src, size_t len, char *dst) {
+  size_t done = 0;
+  for (; len - done >= 28; done += 24) {
+    __m256i in = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (src + done))),
+        _mm_loadu_si128((const __m128i *) (src + done + 12)), 1);
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m256i t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+                                    _mm256_set1_epi32(0x04000040));
+    __m256i t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+                                    _mm256_set1_epi32(0x01000010));
+    _mm256_storeu_si256((__m256i *) (dst + done / 3 * 4), enc_translate_avx2(_mm256_or_si256(t0, t1)));
+  }
+  return done;
+}
+#endif
+
+size_t
+b64_encode_to (const unsigned char *src, size_t len, char *dst) {
+  size_t i = 0;
+  char *out = dst;
+
+#ifdef B64_X86
+  int cpu = b64_cpu();
+  if (cpu & B64_CPU_AVX2) {
+    i = enc_avx2(src, len, dst);
+  }
+  if (cpu & B64_CPU_SSSE3) {
+    i += enc_ssse3(src + i, len - i, dst + i / 3 * 4);
+  }
+  out += i / 3 * 4;
+#endif
 
-  // parse until end of source
-  while (len--) {
-    // read up to 3 bytes at a time into `tmp'
-    tmp[i++] = *(src++);
-
-    // if 3 bytes read then encode into `buf'
-    if (3 == i) {
-      buf[0] = (tmp[0] & 0xfc) >> 2;
-      buf[1] = ((tmp[0] & 0x03) << 4) + ((tmp[1] & 0xf0) >> 4);
-      buf[2] = ((tmp[1] & 0x0f) << 2) + ((tmp[2] & 0xc0) >> 6);
-      buf[3] = tmp[2] & 0x3f;
-
-      // allocate 4 new byts for `enc` and
-      // then translate each encoded buffer
-      // part by index from the base 64 index table
-      // into `enc' unsigned char array
-      enc = (char *) b64_realloc(enc, size + 4);
-      for (i = 0; i < 4; ++i) {
-        enc[size++] = b64_table[buf[i]];
-      }
-
-      // reset index
-      i = 0;
-    }
+  // 3 bytes to 4 chars, stored with one write
+  for (; len - i >= 3; i += 3, out += 4) {
+    uint32_t v = (uint32_t) src[i] << 16 | (uint32_t) src[i + 1] << 8 | src[i + 2];
+    char quad[4] = {
+      b64_table[v >> 18], b64_table[(v >> 12) & 0x3f],
+      b64_table[(v >> 6) & 0x3f], b64_table[v & 0x3f]
+    };
+    memcpy(out, quad, 4);
   }
 
-  // remainder
-  if (i > 0) {
-    // fill `tmp' with `\0' at most 3 times
-    for (j = i; j < 3; ++j) {
-      tmp[j] = '\0';
-    }
-
-    // perform same codec as above
-    buf[0] = (tmp[0] & 0xfc) >> 2;
-    buf[1] = ((tmp[0] & 0x03) << 4) + ((tmp[1] & 0xf0) >> 4);
-    buf[2] = ((tmp[1] & 0x0f) << 2) + ((tmp[2] & 0xc0) >> 6);
-    buf[3] = tmp[2] & 0x3f;
-
-    // perform same write to `enc` with new allocation
-    for (j = 0; (j < i + 1); ++j) {
-      enc = (char *) b64_realloc(enc, size + 1);
-      enc[size++] = b64_table[buf[j]];
-    }
-
-    // while there is still a remainder
-    // append `=' to `enc'
-    while ((i++ < 3)) {
-      enc = (char *) b64_realloc(enc, size + 1);
-      enc[size++] = '=';
-    }
+  // remainder, padded with `='
+  if (len - i > 0) {
+    uint32_t v = (uint32_t) src[i] << 16 | (len - i > 1 ? (uint32_t) src[i + 1] << 8 : 0);
+    out[0] = b64_table[v >> 18];
+    out[1] = b64_table[(v >> 12) & 0x3f];
+    out[2] = len - i > 1 ? b64_table[(v >> 6) & 0x3f] : '=';
+    out[3] = '=';
+    out += 4;
   }
 
-  // Make sure we have enough space to add '\0' character at end.
-  enc = (char *) b64_realloc(enc, size + 1);
-  enc[size] = '\0';
+  return (size_t) (out - dst);
+}
+
+char *
+b64_encode (const unsigned char *src, size_t len) {
+  char *enc = (char *) b64_malloc(B64_ENCODED_SIZE(len) + 1);
+  if (NULL == enc) { return NULL; }
 
+  enc[b64_encode_to(src, len, enc)] = '\0';
   return enc;
 }
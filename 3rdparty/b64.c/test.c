@@ -9,6 +9,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
 #include <ok/ok.h>
 
 #include "b64.h"
@@ -35,6 +36,92 @@ void* custom_realloc(void* ptr, size_t size){
   return realloc(ptr, size);
 }
 
+/**
+ * Byte at a time reference for the vector paths.
+ */
+
+static size_t
+reference_encode (const unsigned char *src, size_t len, char *dst) {
+  size_t i, n = 0;
+  for (i = 0; i < len; i += 3) {
+    unsigned v = src[i] << 16 | (i + 1 < len ? src[i + 1] << 8 : 0) | (i + 2 < len ? src[i + 2] : 0);
+    dst[n++] = b64_table[v >> 18];
+    dst[n++] = b64_table[(v >> 12) & 0x3f];
+    dst[n++] = i + 1 < len ? b64_table[(v >> 6) & 0x3f] : '=';
+    dst[n++] = i + 2 < len ? b64_table[v & 0x3f] : '=';
+  }
+  return n;
+}
+
+static void
+roundtrip (void) {
+  unsigned char src[1024], dec[1024];
+  char enc[B64_ENCODED_SIZE(1024)], ref[B64_ENCODED_SIZE(1024)];
+  size_t len, i, n;
+
+  srand(1);
+  for (i = 0; i < sizeof(src); ++i) {
+    src[i] = (unsigned char) rand();
+  }
+
+  // every length, so each vector block and tail split is hit
+  for (len = 0; len <= sizeof(src); ++len) {
+    n = b64_encode_to(src, len, enc);
+    assert(n == B64_ENCODED_SIZE(len));
+    assert(n == reference_encode(src, len, ref));
+    assert(0 == memcmp(enc, ref, n));
+    assert(len == b64_decode_to(enc, n, dec));
+    assert(0 == memcmp(src, dec, len));
+  }
+  ok("roundtrip of 0..1024 bytes");
+
+  // decoding stops at the first char that is not base64, wherever it is
+  n = b64_encode_to(src, 768, enc);
+  for (i = 0; i < n; i += 7) {
+    char saved = enc[i];
+    enc[i] = '*';
+    assert(i / 4 * 3 + (i % 4 > 1 ? i % 4 - 1 : 0) == b64_decode_to(enc, n, dec));
+    assert(0 == memcmp(src, dec, i / 4 * 3));
+    enc[i] = saved;
+  }
+  ok("decode stops at an invalid char");
+}
+
+static void
+throughput (void) {
+  const size_t len = 16 * 1024 * 1024;
+  unsigned char *src = (unsigned char *) malloc(len);
+  char *enc = (char *) malloc(B64_ENCODED_SIZE(len));
+  unsigned char *dec = (unsigned char *) malloc(B64_DECODED_SIZE(B64_ENCODED_SIZE(len)));
+  size_t i, n = 0;
+  int round;
+  clock_t start;
+  double seconds;
+
+  for (i = 0; i < len; ++i) {
+    src[i] = (unsigned char) (i * 2654435761u >> 24);
+  }
+
+  start = clock();
+  for (round = 0; round < 8; ++round) {
+    n = b64_encode_to(src, len, enc);
+  }
+  seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+  printf("# encode: %.1f MB/s\n", 8 * len / seconds / (1024 * 1024));
+
+  start = clock();
+  for (round = 0; round < 8; ++round) {
+    assert(len == b64_decode_to(enc, n, dec));
+  }
+  seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+  printf("# decode: %.1f MB/s\n", 8 * n / seconds / (1024 * 1024));
+
+  assert(0 == memcmp(src, dec, len));
+  free(src);
+  free(enc);
+  free(dec);
+}
+
 int
 main (void) {
 
@@ -56,8 +143,14 @@ main (void) {
     t(b64_decode,
         "dGhlIGtpbmtham91IGFuZCBtb25rZXkgZm91Z2h0IG92ZXIgdGhlIGJhbmFuYQ==",
         "the kinkajou and monkey fought over the banana");
+    t(b64_decode, "YWJj=ZGVm", "abc");
+    t(b64_decode, "YWJjZA", "abcd");
+    t(b64_decode, "YWJjZGVmZ2hpamtsbW5vcHFyc3R1dnd4eXo+Pz8/", "abcdefghijklmnopqrstuvwxyz>???");
   }
 
+  roundtrip();
+  throughput();
+
   ok_done();
   return 0;
 }
@@ -1742,6 +1742,44 @@ jerry_string_to_char_buffer (const jerry_value_t value, /**< input string value
                                            buffer_size);
 } /* jerry_string_to_char_buffer */
 
+/**
+ * Get the characters of a string without copying them.
+ *
+ * Note:
+ *      The characters are not zero terminated and stay valid while the
+ *      string value is alive.
+ *
+ * @return pointer to the cesu-8 characters of the string, and their size in *size_p
+ *         NULL - if the value is not a string or its characters are not stored as such
+ */
+const jerry_char_t *
+jerry_get_string_chars (const jerry_value_t value, /**< input string value */
+                        jerry_size_t *size_p) /**< [out] size of the characters */
+{
+  jerry_assert_api_available ();
+
+  *size_p = 0;
+
+  if (!ecma_is_value_string (value))
+  {
+    return NULL;
+  }
+
+  lit_utf8_size_t size;
+  uint8_t flags = ECMA_STRING_FLAG_EMPTY;
+  const lit_utf8_byte_t *chars_p = ecma_string_get_chars (ecma_get_string_from_value (value), &size, &flags);
+
+  if (flags & ECMA_STRING_FLAG_MUST_BE_FREED)
+  {
+    /* numeric strings are printed on demand */
+    jmem_heap_free_block ((void *) chars_p, size);
+    return NULL;
+  }
+
+  *size_p = size;
+  return (const jerry_char_t *) chars_p;
+} /* jerry_get_string_chars */
+
 /**
  * Copy the characters of an utf-8 encoded string into a specified buffer.
  *
@@ -2868,6 +2906,55 @@ jerry_get_backtrace (uint32_t max_depth) /**< depth limit of the backtrace */
   return vm_get_backtrace (max_depth);
 } /* jerry_get_backtrace */
 
+/**
+ * Get the resource name and line of the innermost frames. Cheaper than
+ * jerry_get_backtrace: no string or array is created and the resource
+ * names are not acquired. Frames of code without a resource name, like
+ * code loaded from a snapshot, have an undefined resource name.
+ *
+ * @return number of frames stored in frames_p
+ */
+uint32_t
+jerry_get_backtrace_frames (jerry_backtrace_frame_t *frames_p, /**< [out] frames */
+                            uint32_t max_depth) /**< size of frames_p */
+{
+  jerry_assert_api_available ();
+
+  uint32_t count = 0;
+
+#ifdef JERRY_ENABLE_LINE_INFO
+  vm_frame_ctx_t *context_p = JERRY_CONTEXT (vm_top_context_p);
+
+  while (context_p != NULL && count < max_depth)
+  {
+    frames_p[count].resource_name = context_p->resource_name;
+    frames_p[count].line = context_p->current_line;
+    count++;
+    context_p = context_p->prev_context_p;
+  }
+#else /* !JERRY_ENABLE_LINE_INFO */
+  JERRY_UNUSED (frames_p);
+  JERRY_UNUSED (max_depth);
+#endif /* JERRY_ENABLE_LINE_INFO */
+
+  return count;
+} /* jerry_get_backtrace_frames */
+
+/**
+ * Set a callback which is called for every error object the engine
+ * creates, in place of adding the "stack" property to it. A NULL callback
+ * restores the "stack" property.
+ */
+void
+jerry_set_error_object_created_callback (jerry_error_object_created_callback_t callback, /**< callback */
+                                         void *user_p) /**< user pointer passed to the callback */
+{
+  jerry_assert_api_available ();
+
+  JERRY_CONTEXT (error_object_created_callback_p) = (ecma_error_object_created_callback_t) callback;
+  JERRY_CONTEXT (error_object_created_callback_user_p) = user_p;
+} /* jerry_set_error_object_created_callback */
+
 /**
  * Check if the given value is an ArrayBuffer object.
  *
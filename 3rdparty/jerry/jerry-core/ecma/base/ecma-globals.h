@@ -265,6 +265,11 @@ typedef uintptr_t ecma_external_pointer_t;
  */
 typedef ecma_value_t (*ecma_vm_exec_stop_callback_t) (void *user_p);
 
+/**
+ * Callback which is called when an error object is created.
+ */
+typedef void (*ecma_error_object_created_callback_t) (ecma_value_t error_object, void *user_p);
+
 /**
  * Function type for user context deallocation
  */
@@ -140,6 +140,13 @@ ecma_new_standard_error (ecma_standard_error_t error_type) /**< native error typ
 
   ((ecma_extended_object_t *) new_error_obj_p)->u.class_prop.class_id = LIT_MAGIC_STRING_ERROR_UL;
 
+  if (JERRY_CONTEXT (error_object_created_callback_p) != NULL)
+  {
+    JERRY_CONTEXT (error_object_created_callback_p) (ecma_make_object_value (new_error_obj_p),
+                                                     JERRY_CONTEXT (error_object_created_callback_user_p));
+    return new_error_obj_p;
+  }
+
 #ifdef JERRY_ENABLE_LINE_INFO
   /* The "stack" identifier is not a magic string. */
   const char * const stack_id_p = "stack";
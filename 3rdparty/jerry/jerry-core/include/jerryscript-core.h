@@ -226,6 +226,20 @@ typedef void (*jerry_object_native_free_callback_t) (void *native_p);
  */
 typedef jerry_value_t (*jerry_vm_exec_stop_callback_t) (void *user_p);
 
+/**
+ * Callback which is called when the engine creates an error object.
+ */
+typedef void (*jerry_error_object_created_callback_t) (const jerry_value_t error_object, void *user_p);
+
+/**
+ * One frame of a backtrace.
+ */
+typedef struct
+{
+  jerry_value_t resource_name; /**< resource name of the frame, not acquired, undefined if it has none */
+  uint32_t line; /**< currently executed line */
+} jerry_backtrace_frame_t;
+
 /**
  * Function type applied for each data property of an object.
  */
@@ -425,6 +439,7 @@ jerry_size_t jerry_get_utf8_string_size (const jerry_value_t value);
 jerry_length_t jerry_get_string_length (const jerry_value_t value);
 jerry_length_t jerry_get_utf8_string_length (const jerry_value_t value);
 jerry_size_t jerry_string_to_char_buffer (const jerry_value_t value, jerry_char_t *buffer_p, jerry_size_t buffer_size);
+const jerry_char_t *jerry_get_string_chars (const jerry_value_t value, jerry_size_t *size_p);
 jerry_size_t jerry_string_to_utf8_char_buffer (const jerry_value_t value,
                                                jerry_char_t *buffer_p,
                                                jerry_size_t buffer_size);
@@ -563,6 +578,8 @@ jerry_context_t *jerry_create_context (uint32_t heap_size, jerry_context_alloc_t
  */
 void jerry_set_vm_exec_stop_callback (jerry_vm_exec_stop_callback_t stop_cb, void *user_p, uint32_t frequency);
 jerry_value_t jerry_get_backtrace (uint32_t max_depth);
+uint32_t jerry_get_backtrace_frames (jerry_backtrace_frame_t *frames_p, uint32_t max_depth);
+void jerry_set_error_object_created_callback (jerry_error_object_created_callback_t callback, void *user_p);
 
 /**
  * Array buffer components.
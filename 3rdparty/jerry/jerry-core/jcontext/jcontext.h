@@ -161,6 +161,10 @@ struct jerry_context_t
   ecma_value_t resource_name; /**< resource name (usually a file name) */
 #endif /* JERRY_ENABLE_LINE_INFO */
 
+  ecma_error_object_created_callback_t error_object_created_callback_p; /**< replaces the "stack" property
+                                                                        *   of new error objects if set */
+  void *error_object_created_callback_user_p; /**< user pointer for error_object_created_callback_p */
+
 #ifdef JMEM_STATS
   jmem_heap_stats_t jmem_heap_stats; /**< heap's memory usage statistics */
 #endif /* JMEM_STATS */
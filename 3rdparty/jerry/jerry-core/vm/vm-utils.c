@@ -74,21 +74,22 @@ vm_get_backtrace (uint32_t max_depth) /**< maximum backtrace depth, 0 = unlimite
 
   while (context_p != NULL)
   {
+    ecma_string_t *str_p;
+
     if (context_p->resource_name == ECMA_VALUE_UNDEFINED)
     {
-      context_p = context_p->prev_context_p;
-      continue;
+      /* Code loaded from a snapshot has line info but no resource name. */
+      const lit_utf8_byte_t anonymous_str[] = "<anonymous>:";
+      str_p = ecma_new_ecma_string_from_utf8 (anonymous_str, sizeof (anonymous_str) - 1);
     }
-
-    ecma_string_t *str_p = ecma_get_string_from_value (context_p->resource_name);
-
-    if (ecma_string_is_empty (str_p))
+    else if (ecma_string_is_empty (ecma_get_string_from_value (context_p->resource_name)))
     {
       const lit_utf8_byte_t unknown_str[] = "<unknown>:";
       str_p = ecma_new_ecma_string_from_utf8 (unknown_str, sizeof (unknown_str) - 1);
     }
     else
     {
+      str_p = ecma_get_string_from_value (context_p->resource_name);
       ecma_ref_ecma_string (str_p);
       str_p = ecma_append_magic_string_to_string (str_p, LIT_MAGIC_STRING_COLON_CHAR);
     }
@@ -2583,8 +2583,13 @@ vm_loop (vm_frame_ctx_t *frame_ctx_p) /**< frame context */
             bool is_less = (ecma_integer_value_t) left_value < (ecma_integer_value_t) right_value;
 
             /* This is a lookahead to the next opcode to improve performance.
-             * If it is CBC_BRANCH_IF_TRUE_BACKWARD, execute it. */
-            if (*byte_code_p <= CBC_BRANCH_IF_TRUE_BACKWARD_3 && *byte_code_p >= CBC_BRANCH_IF_TRUE_BACKWARD)
+             * If it is CBC_BRANCH_IF_TRUE_BACKWARD, execute it. It is skipped while
+             * a stop callback is set, since only the regular backward branch checks it. */
+            if (*byte_code_p <= CBC_BRANCH_IF_TRUE_BACKWARD_3 && *byte_code_p >= CBC_BRANCH_IF_TRUE_BACKWARD
+#ifdef JERRY_VM_EXEC_STOP
+                && JERRY_CONTEXT (vm_exec_stop_cb) == NULL
+#endif /* JERRY_VM_EXEC_STOP */
+                )
             {
               byte_code_start_p = byte_code_p++;
               branch_offset_length = CBC_BRANCH_OFFSET_LENGTH (*byte_code_start_p);
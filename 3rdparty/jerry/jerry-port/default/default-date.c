@@ -18,6 +18,7 @@
 #endif /* HAVE_TM_GMTOFF */
 #ifdef __GNUC__
 #include <sys/time.h>
+#include <time.h>
 #endif /* __GNUC__ */
 
 #include "jerryscript-port.h"
@@ -72,3 +73,25 @@ double jerry_port_get_current_time (void)
 
   return 0.0;
 } /* jerry_port_get_current_time */
+
+/**
+ * Default implementation of jerry_port_default_get_monotonic_time. Uses
+ * 'clock_gettime' with CLOCK_MONOTONIC if available, so the result never
+ * jumps with the wall clock, falls back to jerry_port_get_current_time.
+ *
+ * @return milliseconds since an arbitrary fixed point, with microsecond
+ *         or better resolution
+ */
+double jerry_port_default_get_monotonic_time (void)
+{
+#if defined (__GNUC__) && defined (CLOCK_MONOTONIC)
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+  {
+    return ((double) ts.tv_sec) * 1000.0 + ((double) ts.tv_nsec) / 1000000.0;
+  }
+#endif /* __GNUC__ && CLOCK_MONOTONIC */
+
+  return jerry_port_get_current_time ();
+} /* jerry_port_default_get_monotonic_time */
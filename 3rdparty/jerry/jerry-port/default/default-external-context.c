@@ -17,10 +17,22 @@
 #include "jerryscript-port-default.h"
 
 /**
- * Pointer to the current context.
- * Note that it is a global variable, and is not a thread safe implementation.
+ * Thread local storage specifier, so that every thread can run its own context.
  */
-static jerry_context_t *current_context_p = NULL;
+#ifndef JERRY_THREAD_LOCAL
+#if defined (__GNUC__) || defined (__clang__)
+#define JERRY_THREAD_LOCAL __thread
+#elif defined (_MSC_VER)
+#define JERRY_THREAD_LOCAL __declspec (thread)
+#else /* !__GNUC__ && !__clang__ && !_MSC_VER */
+#define JERRY_THREAD_LOCAL _Thread_local
+#endif /* __GNUC__ || __clang__ */
+#endif /* !JERRY_THREAD_LOCAL */
+
+/**
+ * Pointer to the current context of the calling thread.
+ */
+static JERRY_THREAD_LOCAL jerry_context_t *current_context_p = NULL;
 
 /**
  * Set the current_context_p as the passed pointer.
@@ -39,6 +39,8 @@ void jerry_port_default_set_log_level (jerry_log_level_t level);
 
 void jerry_port_default_set_current_context (jerry_context_t *context_p);
 
+double jerry_port_default_get_monotonic_time (void);
+
 /**
  * @}
  */
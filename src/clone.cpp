@@ -0,0 +1,385 @@
+#include <cmath>
+#include <cstring>
+#include "clone.hpp"
+
+static inline void put(ext::clone::buffer &out, uint8_t byte) {
+  *out.reserve(1) = byte;
+  out.len += 1;
+}
+
+static uint32_t element_size(uint8_t type) {
+  switch (type) {
+    case JERRY_TYPEDARRAY_UINT8:
+    case JERRY_TYPEDARRAY_UINT8CLAMPED:
+    case JERRY_TYPEDARRAY_INT8:
+      return 1;
+    case JERRY_TYPEDARRAY_UINT16:
+    case JERRY_TYPEDARRAY_INT16:
+      return 2;
+    case JERRY_TYPEDARRAY_UINT32:
+    case JERRY_TYPEDARRAY_INT32:
+    case JERRY_TYPEDARRAY_FLOAT32:
+      return 4;
+    case JERRY_TYPEDARRAY_FLOAT64:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+uint8_t *ext::clone::buffer::reserve(size_t size) {
+  if (len + size > cap) {
+    size_t next = cap ? cap * 2 : 256;
+    while (next < len + size) {
+      next *= 2;
+    }
+    data = (uint8_t *) realloc(data, next);
+    cap = next;
+  }
+  return data + len;
+}
+
+int ext::clone::init() {
+  jerry_value_t global_object = jerry_get_global_object();
+  jerry_value_t object_name = JERRY_STRING("Object");
+  jerry_value_t object = jerry_get_property(global_object, object_name);
+  jerry_value_t keys_name = JERRY_STRING("keys");
+  context_data<state>::get()->object_keys = jerry_get_property(object, keys_name);
+
+  jerry_release_value(keys_name);
+  jerry_release_value(object);
+  jerry_release_value(object_name);
+  jerry_release_value(global_object);
+  return 0;
+}
+
+jerry_value_t ext::clone::write(jerry_value_t value, buffer &out) {
+  size_t start = out.len;
+  put(out, CLONE_VERSION);
+
+  writer w{out, map<jerry_value_t, uint32_t>(0), 0};
+  jerry_value_t result = write_value(w, value);
+  if (jerry_value_is_error(result)) {
+    out.len = start;
+  }
+
+  w.seen.foreach([](jerry_value_t k, uint32_t index, void *userData) -> void {
+    jerry_release_value(k);
+  }, nullptr);
+  return result;
+}
+
+jerry_value_t ext::clone::read(const uint8_t *data, size_t len) {
+  if (len == 0 || data[0] != CLONE_VERSION) {
+    return malformed();
+  }
+
+  reader r{data + 1, data + len, nullptr, 0, 0, 0};
+  jerry_value_t value = read_value(r);
+  if (!jerry_value_is_error(value) && r.pos != r.end) {
+    jerry_release_value(value);
+    value = malformed();
+  }
+
+  for (uint32_t i = 0; i < r.refs_len; i++) {
+    jerry_release_value(r.refs[i]);
+  }
+  free(r.refs);
+  return value;
+}
+
+jerry_value_t ext::clone::write_value(writer &w, jerry_value_t value) {
+  buffer &out = w.out;
+  if (jerry_value_is_undefined(value)) {
+    put(out, CLONE_UNDEFINED);
+  } else if (jerry_value_is_null(value)) {
+    put(out, CLONE_NULL);
+  } else if (jerry_value_is_boolean(value)) {
+    put(out, jerry_get_boolean_value(value) ? CLONE_TRUE : CLONE_FALSE);
+  } else if (jerry_value_is_number(value)) {
+    double number = jerry_get_number_value(value);
+    if (number >= INT32_MIN && number <= INT32_MAX && (double) (int32_t) number == number &&
+        !(number == 0 && std::signbit(number))) {
+      auto integer = (int32_t) number;
+      put(out, CLONE_INT32);
+      write_bytes(out, &integer, sizeof(integer));
+    } else {
+      put(out, CLONE_DOUBLE);
+      write_bytes(out, &number, sizeof(number));
+    }
+  } else if (jerry_value_is_string(value)) {
+    put(out, CLONE_STRING);
+    return write_string(out, value);
+  } else if (jerry_value_is_function(value)) {
+    return jerry_create_error(JERRY_ERROR_TYPE, (const jerry_char_t *) "DataCloneError: functions can not be cloned");
+  } else if (jerry_value_is_object(value)) {
+    return write_object(w, value);
+  } else {
+    return jerry_create_error(JERRY_ERROR_TYPE, (const jerry_char_t *) "DataCloneError: value can not be cloned");
+  }
+  return jerry_create_undefined();
+}
+
+jerry_value_t ext::clone::write_object(writer &w, jerry_value_t value) {
+  buffer &out = w.out;
+  uint32_t *ref = w.seen.get(value);
+  if (ref != nullptr) {
+    put(out, CLONE_REFERENCE);
+    write_varint(out, *ref);
+    return jerry_create_undefined();
+  }
+
+  if (w.depth >= CLONE_MAX_DEPTH) {
+    return jerry_create_error(JERRY_ERROR_RANGE, (const jerry_char_t *) "DataCloneError: object nesting is too deep");
+  }
+  // held until the write ends, so a collected object can not alias a later one
+  w.seen.add(jerry_acquire_value(value), (uint32_t) w.seen.size());
+
+  if (jerry_value_is_arraybuffer(value)) {
+    jerry_length_t size = jerry_get_arraybuffer_byte_length(value);
+    put(out, CLONE_ARRAYBUFFER);
+    write_varint(out, size);
+    out.len += jerry_arraybuffer_read(value, 0, out.reserve(size), size);
+    return jerry_create_undefined();
+  }
+
+  if (jerry_value_is_typedarray(value)) {
+    jerry_length_t offset = 0;
+    jerry_length_t size = 0;
+    jerry_value_t arraybuffer = jerry_get_typedarray_buffer(value, &offset, &size);
+    put(out, CLONE_TYPEDARRAY);
+    put(out, (uint8_t) jerry_get_typedarray_type(value));
+    write_varint(out, size);
+    out.len += jerry_arraybuffer_read(arraybuffer, offset, out.reserve(size), size);
+    jerry_release_value(arraybuffer);
+    return jerry_create_undefined();
+  }
+
+  jerry_value_t result = jerry_create_undefined();
+  w.depth += 1;
+  if (jerry_value_is_array(value)) {
+    uint32_t length = jerry_get_array_length(value);
+    put(out, CLONE_ARRAY);
+    write_varint(out, length);
+    for (uint32_t i = 0; i < length && !jerry_value_is_error(result); i++) {
+      jerry_value_t item = jerry_get_property_by_index(value, i);
+      if (jerry_value_is_error(item)) {
+        result = item;
+      } else {
+        result = write_value(w, item);
+        jerry_release_value(item);
+      }
+    }
+  } else {
+    jerry_value_t keys = jerry_call_function(context_data<state>::get()->object_keys, JERRY_UNDEFINED, &value, 1);
+    if (jerry_value_is_error(keys)) {
+      w.depth -= 1;
+      return keys;
+    }
+    uint32_t count = jerry_get_array_length(keys);
+    put(out, CLONE_OBJECT);
+    write_varint(out, count);
+    for (uint32_t i = 0; i < count && !jerry_value_is_error(result); i++) {
+      jerry_value_t key = jerry_get_property_by_index(keys, i);
+      write_string(out, key);
+      jerry_value_t item = jerry_get_property(value, key);
+      if (jerry_value_is_error(item)) {
+        result = item;
+      } else {
+        result = write_value(w, item);
+        jerry_release_value(item);
+      }
+      jerry_release_value(key);
+    }
+    jerry_release_value(keys);
+  }
+  w.depth -= 1;
+  return result;
+}
+
+void ext::clone::write_varint(buffer &out, uint64_t value) {
+  uint8_t *p = out.reserve(10);
+  uint8_t *start = p;
+  while (value >= 0x80) {
+    *p++ = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (uint8_t) value;
+  out.len += (size_t) (p - start);
+}
+
+void ext::clone::write_bytes(buffer &out, const void *data, size_t len) {
+  memcpy(out.reserve(len), data, len);
+  out.len += len;
+}
+
+jerry_value_t ext::clone::write_string(buffer &out, jerry_value_t value) {
+  jerry_size_t size = jerry_get_utf8_string_size(value);
+  write_varint(out, size);
+  out.len += jerry_string_to_utf8_char_buffer(value, out.reserve(size), size);
+  return jerry_create_undefined();
+}
+
+jerry_value_t ext::clone::read_value(reader &r) {
+  if (r.pos >= r.end) {
+    return malformed();
+  }
+
+  uint8_t tag = *r.pos++;
+  switch (tag) {
+    case CLONE_UNDEFINED:
+      return jerry_create_undefined();
+    case CLONE_NULL:
+      return jerry_create_null();
+    case CLONE_FALSE:
+    case CLONE_TRUE:
+      return jerry_create_boolean(tag == CLONE_TRUE);
+    case CLONE_INT32: {
+      int32_t integer;
+      if (r.end - r.pos < (ptrdiff_t) sizeof(integer)) {
+        return malformed();
+      }
+      memcpy(&integer, r.pos, sizeof(integer));
+      r.pos += sizeof(integer);
+      return jerry_create_number(integer);
+    }
+    case CLONE_DOUBLE: {
+      double number;
+      if (r.end - r.pos < (ptrdiff_t) sizeof(number)) {
+        return malformed();
+      }
+      memcpy(&number, r.pos, sizeof(number));
+      r.pos += sizeof(number);
+      return jerry_create_number(number);
+    }
+    case CLONE_STRING: {
+      uint32_t size;
+      if (!read_varint(r, &size) || (size_t) (r.end - r.pos) < size ||
+          !jerry_is_valid_utf8_string(r.pos, size)) {
+        return malformed();
+      }
+      jerry_value_t str = jerry_create_string_sz_from_utf8(r.pos, size);
+      r.pos += size;
+      return str;
+    }
+    default:
+      return read_object(r, tag);
+  }
+}
+
+jerry_value_t ext::clone::read_object(reader &r, uint8_t tag) {
+  uint32_t value;
+  if (!read_varint(r, &value)) {
+    return malformed();
+  }
+
+  if (tag == CLONE_REFERENCE) {
+    return value < r.refs_len ? jerry_acquire_value(r.refs[value]) : malformed();
+  }
+
+  size_t remaining = (size_t) (r.end - r.pos);
+  if (tag == CLONE_ARRAYBUFFER) {
+    if (remaining < value) {
+      return malformed();
+    }
+    jerry_value_t arraybuffer = jerry_create_arraybuffer(value);
+    jerry_arraybuffer_write(arraybuffer, 0, r.pos, value);
+    r.pos += value;
+    add_reference(r, arraybuffer);
+    return arraybuffer;
+  }
+
+  if (tag == CLONE_TYPEDARRAY) {
+    // the varint read above was the element type, a single byte
+    uint8_t type = (uint8_t) value;
+    uint32_t size;
+    if (value > 0x7f || element_size(type) == 0 || !read_varint(r, &size) ||
+        (size_t) (r.end - r.pos) < size || size % element_size(type) != 0) {
+      return malformed();
+    }
+    jerry_value_t arraybuffer = jerry_create_arraybuffer(size);
+    jerry_arraybuffer_write(arraybuffer, 0, r.pos, size);
+    r.pos += size;
+    // the non _sz variant passes the byte length as the element count
+    jerry_value_t array = jerry_create_typedarray_for_arraybuffer_sz((jerry_typedarray_type_t) type, arraybuffer, 0,
+                                                                     size / element_size(type));
+    jerry_release_value(arraybuffer);
+    add_reference(r, array);
+    return array;
+  }
+
+  // every entry takes at least a byte, which bounds lengths from hostile input
+  if ((tag != CLONE_ARRAY && tag != CLONE_OBJECT) || remaining < value || r.depth >= CLONE_MAX_DEPTH) {
+    return malformed();
+  }
+
+  jerry_value_t result = tag == CLONE_ARRAY ? jerry_create_array(value) : jerry_create_object();
+  add_reference(r, result);
+  r.depth += 1;
+  for (uint32_t i = 0; i < value; i++) {
+    jerry_value_t key = jerry_create_undefined();
+    if (tag == CLONE_OBJECT) {
+      uint32_t size;
+      if (!read_varint(r, &size) || (size_t) (r.end - r.pos) < size || !jerry_is_valid_utf8_string(r.pos, size)) {
+        jerry_release_value(result);
+        result = malformed();
+        break;
+      }
+      key = jerry_create_string_sz_from_utf8(r.pos, size);
+      r.pos += size;
+    }
+
+    jerry_value_t item = read_value(r);
+    if (jerry_value_is_error(item)) {
+      jerry_release_value(key);
+      jerry_release_value(result);
+      result = item;
+      break;
+    }
+
+    jerry_value_t retval;
+    if (tag == CLONE_ARRAY) {
+      retval = jerry_set_property_by_index(result, i, item);
+    } else {
+      // defined rather than assigned, so keys like __proto__ stay plain data
+      jerry_property_descriptor_t desc;
+      jerry_init_property_descriptor_fields(&desc);
+      desc.is_value_defined = true;
+      desc.value = item;
+      desc.is_writable_defined = desc.is_writable = true;
+      desc.is_enumerable_defined = desc.is_enumerable = true;
+      desc.is_configurable_defined = desc.is_configurable = true;
+      retval = jerry_define_own_property(result, key, &desc);
+    }
+    jerry_release_value(retval);
+    jerry_release_value(item);
+    jerry_release_value(key);
+  }
+  r.depth -= 1;
+  return result;
+}
+
+bool ext::clone::read_varint(reader &r, uint32_t *value) {
+  uint64_t result = 0;
+  for (uint32_t shift = 0; shift < 35 && r.pos < r.end; shift += 7) {
+    uint8_t byte = *r.pos++;
+    result |= (uint64_t) (byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = (uint32_t) result;
+      return result <= UINT32_MAX;
+    }
+  }
+  return false;
+}
+
+void ext::clone::add_reference(reader &r, jerry_value_t value) {
+  if (r.refs_len == r.refs_cap) {
+    r.refs_cap = r.refs_cap ? r.refs_cap * 2 : 16;
+    r.refs = (jerry_value_t *) realloc(r.refs, r.refs_cap * sizeof(jerry_value_t));
+  }
+  r.refs[r.refs_len++] = jerry_acquire_value(value);
+}
+
+jerry_value_t ext::clone::malformed() {
+  return jerry_create_error(JERRY_ERROR_TYPE, (const jerry_char_t *) "DataCloneError: malformed message");
+}
@@ -0,0 +1,140 @@
+#ifndef JPROTECTOR_CLONE_HPP
+#define JPROTECTOR_CLONE_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include "map.hpp"
+#include "marco.hpp"
+#include "context.hpp"
+
+extern "C" {
+#include "jerryscript.h"
+};
+
+#define CLONE_VERSION 1
+// nesting deeper than this is refused instead of exhausting the native stack
+#define CLONE_MAX_DEPTH 256
+
+namespace ext {
+  typedef enum {
+    CLONE_UNDEFINED = 0,
+    CLONE_NULL,
+    CLONE_FALSE,
+    CLONE_TRUE,
+    CLONE_INT32,
+    CLONE_DOUBLE,
+    CLONE_STRING,
+    CLONE_ARRAY,
+    CLONE_OBJECT,
+    CLONE_ARRAYBUFFER,
+    CLONE_TYPEDARRAY,
+    CLONE_REFERENCE,
+  } clone_tag_t;
+
+  /*
+   * Binary structured clone of the values crossing postMessage/onmessage.
+   *
+   *   message := CLONE_VERSION value
+   *   value   := tag payload, payload by tag:
+   *     UNDEFINED NULL FALSE TRUE  -
+   *     INT32                      4 bytes
+   *     DOUBLE                     8 bytes
+   *     STRING                     varint byte length, UTF-8 bytes
+   *     ARRAY                      varint length, values
+   *     OBJECT                     varint count, count * (varint length, UTF-8 key, value)
+   *     ARRAYBUFFER                varint byte length, bytes
+   *     TYPEDARRAY                 jerry_typedarray_type_t byte, varint byte length, bytes
+   *     REFERENCE                  varint index of an earlier ARRAY, OBJECT, ARRAYBUFFER
+   *                                or TYPEDARRAY, counted in the order they appear
+   *
+   * Numbers are little endian, varints are LEB128. References keep shared
+   * and cyclic objects intact, but a typed array always gets a copy of just
+   * its own view. Functions can not be cloned.
+   */
+  class clone {
+    struct state {
+      state() : object_keys(0) {};
+
+      void release() {
+        jerry_release_value(object_keys);
+      }
+
+      // jerry_get_object_keys only lists array indices in this engine revision
+      jerry_value_t object_keys;
+    };
+
+  public:
+    // growable output, workers keep one so posting does not allocate
+    struct buffer {
+      buffer() : data(nullptr), len(0), cap(0) {};
+
+      buffer(const buffer &) = delete;
+
+      buffer &operator=(const buffer &) = delete;
+
+      ~buffer() {
+        free(data);
+      }
+
+      uint8_t *reserve(size_t size);
+
+      void swap(buffer &other) {
+        std::swap(data, other.data);
+        std::swap(len, other.len);
+        std::swap(cap, other.cap);
+      }
+
+      uint8_t *data;
+      size_t len;
+      size_t cap;
+    };
+
+    // captures Object.keys before the script can replace it
+    static int init();
+
+    // appends `value` to `out`; returns undefined, or the error to throw
+    static jerry_value_t write(jerry_value_t value, buffer &out);
+
+    // returns the decoded value, or an error for malformed input
+    static jerry_value_t read(const uint8_t *data, size_t len);
+
+  private:
+    struct writer {
+      buffer &out;
+      map<jerry_value_t, uint32_t> seen;
+      uint32_t depth;
+    };
+
+    struct reader {
+      const uint8_t *pos;
+      const uint8_t *end;
+      jerry_value_t *refs;
+      uint32_t refs_len;
+      uint32_t refs_cap;
+      uint32_t depth;
+    };
+
+    static jerry_value_t write_value(writer &w, jerry_value_t value);
+
+    static jerry_value_t write_object(writer &w, jerry_value_t value);
+
+    static void write_varint(buffer &out, uint64_t value);
+
+    static void write_bytes(buffer &out, const void *data, size_t len);
+
+    static jerry_value_t write_string(buffer &out, jerry_value_t value);
+
+    static jerry_value_t read_value(reader &r);
+
+    static jerry_value_t read_object(reader &r, uint8_t tag);
+
+    static bool read_varint(reader &r, uint32_t *value);
+
+    static void add_reference(reader &r, jerry_value_t value);
+
+    static jerry_value_t malformed();
+  };
+}
+
+#endif //JPROTECTOR_CLONE_HPP
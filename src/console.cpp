@@ -1,117 +1,283 @@
+#include <cmath>
 #include "console.hpp"
 
-map<string, double> ext::console::time_label_map;
+ext::console::state::state() : labels(nullptr),
+                               labels_len(0),
+                               labels_cap(0),
+                               summary(false),
+                               origin(jerry_port_default_get_monotonic_time()) {
+}
+
+ext::console::state::~state() {
+  for (uint32_t i = 0; i < labels_len; i++) {
+    free(labels[i].histogram);
+  }
+  free(labels);
+}
 
 int ext::console::init() {
+  static constexpr binding console_bindings[] = {
+    {"debug", debug, nullptr, BINDING_METHOD},
+    {"warn", warn, nullptr, BINDING_METHOD},
+    {"info", info, nullptr, BINDING_METHOD},
+    {"log", log, nullptr, BINDING_METHOD},
+    {"error", error, nullptr, BINDING_METHOD},
+    {"time", time, nullptr, BINDING_METHOD},
+    {"timeEnd", time_end, nullptr, BINDING_METHOD},
+    {"timeLog", time_log, nullptr, BINDING_METHOD},
+    {"timeSummary", time_summary, nullptr, BINDING_METHOD},
+    {"count", count, nullptr, BINDING_METHOD},
+    {"countReset", count_reset, nullptr, BINDING_METHOD},
+  };
+  static constexpr binding performance_bindings[] = {
+    {"now", now, nullptr, BINDING_METHOD},
+  };
+
   jerry_value_t global_object = jerry_get_global_object();
   jerry_value_t console_object = jerry_create_object();
-
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(console_object, debug, debug);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(console_object, warn, warn);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(console_object, info, info);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(console_object, log, log);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(console_object, error, error);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(console_object, time, time);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(console_object, timeEnd, time_end);
-
+  ext::names::install(console_object, console_bindings);
   JERRY_SET_PROPERTY(global_object, console, console_object);
 
+  jerry_value_t performance_object = jerry_create_object();
+  ext::names::install(performance_object, performance_bindings);
+  JERRY_SET_PROPERTY(global_object, performance, performance_object);
+
+  jerry_release_value(performance_object);
   jerry_release_value(console_object);
   jerry_release_value(global_object);
 
   return 0;
 }
 
-string ext::console::concat_args_to_str(const char *level, const jerry_value_t *args_p, jerry_length_t args_cnt) {
-  string constr(level);
-  for (uint32_t i = 0; i < args_cnt; i++) {
-    JERRY_CONV_STR_TO_CHAR_BUFFER(msg, msg_len, char_buffer, args_p + i);
-    constr << (char *) char_buffer << " ";
-  }
-  return constr;
-}
-
 JERRY_EXTERNAL_FUNC(ext::console::debug) {
   if (args_cnt != 0) {
-    string constr = concat_args_to_str("[DEBUG] ", args_p, args_cnt);
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_CONSOLE, constr.c_str());
-#endif
+    ext::log::write(SECURITY_WORKER_LOG_DEBUG, "[DEBUG] ", args_p, args_cnt);
   }
-
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::console::warn) {
   if (args_cnt != 0) {
-    string constr = concat_args_to_str("[WARN] ", args_p, args_cnt);
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_WARN, constr.c_str());
-#endif
+    ext::log::write(SECURITY_WORKER_LOG_WARN, "[WARN] ", args_p, args_cnt);
   }
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::console::error) {
   if (args_cnt != 0) {
-    string constr = concat_args_to_str("[ERROR] ", args_p, args_cnt);
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_ERROR, constr.c_str());
-#endif
+    ext::log::write(SECURITY_WORKER_LOG_ERROR, "[ERROR] ", args_p, args_cnt);
   }
-
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::console::info) {
   if (args_cnt != 0) {
-    string constr = concat_args_to_str("[INFO] ", args_p, args_cnt);
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_CONSOLE, constr.c_str());
-#endif
+    ext::log::write(SECURITY_WORKER_LOG_INFO, "[INFO] ", args_p, args_cnt);
   }
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::console::log) {
   if (args_cnt != 0) {
-    string constr = concat_args_to_str("[LOG] ", args_p, args_cnt);
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_CONSOLE, constr.c_str());
-#endif
+    ext::log::write(SECURITY_WORKER_LOG_LOG, "[LOG] ", args_p, args_cnt);
   }
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::console::time) {
-  JERRY_CONV_STR_TO_CHAR_BUFFER(arg, arg_len, char_buffer, args_p);
-  string key((char *) char_buffer);
-  double now = jerry_port_get_current_time();
-  time_label_map.add(key, now);
+  string key;
+  label *l = find(context_data<state>::get(), args_p, args_cnt, true, key);
+  if (l->running) {
+    string constr;
+    constr << "Timer '" << key << "' already exists";
+    ext::log::text(SECURITY_WORKER_LOG_WARN, constr.c_str(), constr.size());
+    return JERRY_UNDEFINED;
+  }
+
+  l->running = true;
+  l->start = jerry_port_default_get_monotonic_time();
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::console::time_end) {
-  JERRY_CONV_STR_TO_CHAR_BUFFER(arg, arg_len, char_buffer, args_p);
-  string key((char *) char_buffer);
-  int32_t index = time_label_map.find(key);
+  double now = jerry_port_default_get_monotonic_time();
+  auto s = context_data<state>::get();
+  string key;
+  label *l = find(s, args_p, args_cnt, false, key);
+
+  string constr;
+  if (l == nullptr || !l->running) {
+    constr << "Timer '" << key << "' does not exist";
+    ext::log::text(SECURITY_WORKER_LOG_WARN, constr.c_str(), constr.size());
+    return JERRY_UNDEFINED;
+  }
+
+  l->running = false;
+  record(l, now - l->start);
+  if (!s->summary) {
+    constr << "[TIMER] " << key << ": ";
+    append_ms(constr, now - l->start);
+    ext::log::text(SECURITY_WORKER_LOG_LOG, constr.c_str(), constr.size());
+  }
+
+  return JERRY_UNDEFINED;
+}
+
+JERRY_EXTERNAL_FUNC(ext::console::time_log) {
+  double now = jerry_port_default_get_monotonic_time();
+  string key;
+  label *l = find(context_data<state>::get(), args_p, args_cnt, false, key);
 
   string constr;
-  if (index == -1) {
+  if (l == nullptr || !l->running) {
     constr << "Timer '" << key << "' does not exist";
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_WARN, constr.c_str());
-#endif
+    ext::log::text(SECURITY_WORKER_LOG_WARN, constr.c_str(), constr.size());
+    return JERRY_UNDEFINED;
+  }
+
+  constr << "[TIMER] " << key << ": ";
+  append_ms(constr, now - l->start);
+  if (args_cnt > 1) {
+    constr << ' ';
+    ext::log::write(SECURITY_WORKER_LOG_LOG, constr.c_str(), args_p + 1, args_cnt - 1);
   } else {
-    double now = jerry_port_get_current_time();
-    jerry_value_t speed_time = jerry_create_number(now - *time_label_map.get(key));
-    JERRY_CONV_STR_TO_CHAR_BUFFER(msg, msg_len, time_char_buffer, &speed_time);
-    jerry_release_value(speed_time);
-    constr << "[TIMER] " << key << ": " << (char *) time_char_buffer << "ms";
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_CONSOLE, constr.c_str());
-#endif
+    ext::log::text(SECURITY_WORKER_LOG_LOG, constr.c_str(), constr.size());
+  }
+
+  return JERRY_UNDEFINED;
+}
+
+JERRY_EXTERNAL_FUNC(ext::console::time_summary) {
+  auto s = context_data<state>::get();
+  if (args_cnt != 0 && jerry_value_is_boolean(*args_p)) {
+    s->summary = jerry_get_boolean_value(*args_p);
+    return JERRY_UNDEFINED;
   }
 
+  // one line per label that has finished a timing, in the order first used
+  s->label_index.foreach([](string key, uint32_t index, void *data) -> void {
+    label *l = &((state *) data)->labels[index];
+    if (l->samples == 0) {
+      return;
+    }
+
+    string constr;
+    constr << "[TIMER] " << key << ": " << (unsigned long long) l->samples << " runs, min ";
+    append_ms(constr, l->min);
+    constr << ", mean ";
+    append_ms(constr, l->total / (double) l->samples);
+    constr << ", p99 ";
+    append_ms(constr, percentile(l, 0.99));
+    constr << ", max ";
+    append_ms(constr, l->max);
+    ext::log::text(SECURITY_WORKER_LOG_LOG, constr.c_str(), constr.size());
+  }, s);
+
   return JERRY_UNDEFINED;
 }
+
+JERRY_EXTERNAL_FUNC(ext::console::count) {
+  string key;
+  label *l = find(context_data<state>::get(), args_p, args_cnt, true, key);
+  l->count += 1;
+
+  string constr;
+  constr << "[COUNT] " << key << ": " << l->count;
+  ext::log::text(SECURITY_WORKER_LOG_LOG, constr.c_str(), constr.size());
+  return JERRY_UNDEFINED;
+}
+
+JERRY_EXTERNAL_FUNC(ext::console::count_reset) {
+  string key;
+  label *l = find(context_data<state>::get(), args_p, args_cnt, false, key);
+  if (l == nullptr || l->count == 0) {
+    string constr;
+    constr << "Count for '" << key << "' does not exist";
+    ext::log::text(SECURITY_WORKER_LOG_WARN, constr.c_str(), constr.size());
+    return JERRY_UNDEFINED;
+  }
+
+  l->count = 0;
+  return JERRY_UNDEFINED;
+}
+
+JERRY_EXTERNAL_FUNC(ext::console::now) {
+  // like performance.now(), relative to when the worker started
+  return jerry_create_number(jerry_port_default_get_monotonic_time() - context_data<state>::get()->origin);
+}
+
+ext::console::label *ext::console::find(state *s, const jerry_value_t *args_p, jerry_length_t args_cnt,
+                                        bool create, string &key) {
+  if (args_cnt == 0 || jerry_value_is_undefined(*args_p)) {
+    key << "default";
+  } else {
+    JERRY_VIEW_STR_CHARS(arg, arg_len, char_buffer, args_p);
+    key.append((const char *) char_buffer, arg_len);
+  }
+
+  uint32_t *index = s->label_index.get(key);
+  if (index != nullptr) {
+    return &s->labels[*index];
+  }
+  if (!create) {
+    return nullptr;
+  }
+
+  if (s->labels_len == s->labels_cap) {
+    s->labels_cap = s->labels_cap ? s->labels_cap * 2 : 8;
+    s->labels = (label *) realloc(s->labels, s->labels_cap * sizeof(label));
+  }
+  label *l = &s->labels[s->labels_len];
+  *l = label{false, 0, 0, 0, INFINITY, 0, 0, nullptr};
+  s->label_index.add(key, s->labels_len++);
+  return l;
+}
+
+void ext::console::record(label *l, double elapsed) {
+  l->samples += 1;
+  l->total += elapsed;
+  l->min = elapsed < l->min ? elapsed : l->min;
+  l->max = elapsed > l->max ? elapsed : l->max;
+
+  if (l->histogram == nullptr) {
+    l->histogram = (uint32_t *) calloc(TIME_BUCKETS, sizeof(uint32_t));
+  }
+
+  // values under TIME_SUB_BUCKETS microseconds are exact, larger ones keep
+  // their top 4 bits below the leading one
+  double us = elapsed * 1000 + 0.5;
+  uint64_t v = us < 1 ? 0 : us >= 68719476736.0 ? 68719476735ULL : (uint64_t) us;
+  uint32_t bucket = (uint32_t) v;
+  if (v >= TIME_SUB_BUCKETS) {
+    uint32_t e = 63 - (uint32_t) __builtin_clzll(v);
+    bucket = (e - 3) * TIME_SUB_BUCKETS + (uint32_t) ((v >> (e - 4)) & (TIME_SUB_BUCKETS - 1));
+  }
+  l->histogram[bucket] += 1;
+}
+
+double ext::console::percentile(const label *l, double fraction) {
+  auto target = (uint64_t) ceil(fraction * (double) l->samples);
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < TIME_BUCKETS; i++) {
+    seen += l->histogram[i];
+    if (seen < target) {
+      continue;
+    }
+
+    // the top of the bucket, which is never past the slowest run
+    double top = i;
+    if (i >= TIME_SUB_BUCKETS) {
+      uint32_t shift = i / TIME_SUB_BUCKETS - 1;
+      top = (double) (((uint64_t) (TIME_SUB_BUCKETS + i % TIME_SUB_BUCKETS + 1) << shift) - 1);
+    }
+    top /= 1000;
+    return top < l->max ? (top > l->min ? top : l->min) : l->max;
+  }
+  return l->max;
+}
+
+void ext::console::append_ms(string &out, double ms) {
+  char digits[32];
+  int n = snprintf(digits, sizeof(digits), "%.3fms", ms);
+  out.append(digits, (size_t) n);
+}
@@ -6,23 +6,56 @@
 #include "map.hpp"
 #include "marco.hpp"
 #include "error.hpp"
+#include "context.hpp"
+#include "log.hpp"
+#include "names.hpp"
 
 extern "C" {
 #include "jerryscript.h"
 
-#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
-#endif
 };
 
+// log-linear histogram of timings in microseconds, 16 buckets per power of two
+#define TIME_SUB_BUCKETS 16
+#define TIME_BUCKETS (34 * TIME_SUB_BUCKETS)
+
 namespace ext {
   class console {
+    // what console.time/count keep per label
+    struct label {
+      bool running;
+      double start;
+      uint32_t count;
+      uint64_t samples;
+      double min;
+      double max;
+      double total;
+      // allocated with the first sample
+      uint32_t *histogram;
+    };
+
+    struct state {
+      state();
+
+      ~state();
+
+      void release() {};
+
+      // labels index `labels`, which only grows
+      map<string, uint32_t> label_index;
+      label *labels;
+      uint32_t labels_len;
+      uint32_t labels_cap;
+      // timeEnd only aggregates, timeSummary() reports
+      bool summary;
+      double origin;
+    };
+
   public:
     static int init();
 
   private:
-    static string concat_args_to_str(const char *level, const jerry_value_t *args_p, jerry_length_t args_cnt);
-
     static JERRY_EXTERNAL_FUNC(debug);
 
     static JERRY_EXTERNAL_FUNC(warn);
@@ -37,7 +70,23 @@ namespace ext {
 
     static JERRY_EXTERNAL_FUNC(time_end);
 
-    static map<string, double> time_label_map;
+    static JERRY_EXTERNAL_FUNC(time_log);
+
+    static JERRY_EXTERNAL_FUNC(time_summary);
+
+    static JERRY_EXTERNAL_FUNC(count);
+
+    static JERRY_EXTERNAL_FUNC(count_reset);
+
+    static JERRY_EXTERNAL_FUNC(now);
+
+    static label *find(state *s, const jerry_value_t *args_p, jerry_length_t args_cnt, bool create, string &key);
+
+    static void record(label *l, double elapsed);
+
+    static double percentile(const label *l, double fraction);
+
+    static void append_ms(string &out, double ms);
   };
 }
 
@@ -0,0 +1,78 @@
+#include <cstdlib>
+#include "context.hpp"
+
+extern "C" {
+#include "emscripten.h"
+};
+
+const jerry_context_data_manager_t ext::context::owner_manager = {
+        nullptr,
+        nullptr,
+        nullptr,
+        sizeof(void *)
+};
+
+ext::context::scope::scope(jerry_context_t *ctx) : prev(jerry_port_get_current_context()) {
+  jerry_port_default_set_current_context(ctx);
+}
+
+ext::context::scope::~scope() {
+  jerry_port_default_set_current_context(prev);
+}
+
+void *ext::context::alloc(size_t size, void *cb_data_p) {
+  return malloc(size);
+}
+
+jerry_context_t *ext::context::create() {
+  return jerry_create_context(WORKER_HEAP_SIZE_KB * 1024, alloc, nullptr);
+}
+
+void ext::context::destroy(jerry_context_t *ctx) {
+  {
+    scope s(ctx);
+    jerry_cleanup();
+  }
+  free(ctx);
+}
+
+jerry_context_t *ext::context::current() {
+  return jerry_port_get_current_context();
+}
+
+void ext::context::set_owner(void *owner) {
+  *(void **) jerry_get_context_data(&owner_manager) = owner;
+}
+
+void *ext::context::owner() {
+  return *(void **) jerry_get_context_data(&owner_manager);
+}
+
+ext::host_ref::host_ref(jerry_context_t *ctx) : context(ctx), pending(0) {
+}
+
+ext::host_ref *ext::host_ref::create() {
+  return new host_ref(context::current());
+}
+
+void ext::host_ref::async_call(void (*callback)(void *), int millis) {
+  pending += 1;
+  emscripten_async_call(callback, (void *) this, millis);
+}
+
+jerry_context_t *ext::host_ref::resolve(void *user_data) {
+  auto ref = (host_ref *) user_data;
+  ref->pending -= 1;
+  jerry_context_t *ctx = ref->context;
+  if (ctx == nullptr && ref->pending == 0) {
+    delete ref;
+  }
+  return ctx;
+}
+
+void ext::host_ref::orphan() {
+  context = nullptr;
+  if (pending == 0) {
+    delete this;
+  }
+}
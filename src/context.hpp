@@ -0,0 +1,115 @@
+#ifndef JPROTECTOR_CONTEXT_HPP
+#define JPROTECTOR_CONTEXT_HPP
+
+#include <cstdint>
+#include <new>
+
+extern "C" {
+#include "jerryscript.h"
+#include "jerryscript-port-default.h"
+};
+
+#ifndef WORKER_HEAP_SIZE_KB
+#define WORKER_HEAP_SIZE_KB 512
+#endif
+
+namespace ext {
+  /*
+   * Every worker owns an external engine context. Host callbacks (timers,
+   * fetch, websocket) have to switch to the context they were registered
+   * from before touching the engine, `scope` does that and switches back.
+   */
+  class context {
+  public:
+    class scope {
+    public:
+      explicit scope(jerry_context_t *ctx);
+
+      ~scope();
+
+    private:
+      jerry_context_t *prev;
+    };
+
+    static jerry_context_t *create();
+
+    static void destroy(jerry_context_t *ctx);
+
+    static jerry_context_t *current();
+
+    static void set_owner(void *owner);
+
+    static void *owner();
+
+  private:
+    static void *alloc(size_t size, void *cb_data_p);
+
+    static const jerry_context_data_manager_t owner_manager;
+  };
+
+  /*
+   * A context as seen by host callbacks that can not be cancelled, like
+   * emscripten_async_call. Every callback scheduled through it holds a
+   * reference; the module orphans it on release and whichever callback
+   * comes last frees it.
+   */
+  class host_ref {
+  public:
+    // for the current context
+    static host_ref *create();
+
+    // runs `callback` with this handle after `millis` milliseconds
+    void async_call(void (*callback)(void *), int millis);
+
+    // called first thing by a callback with its handle, returns the context
+    // to switch to, nullptr once the context is gone
+    static jerry_context_t *resolve(void *user_data);
+
+    // no callback touches the context from now on, frees the handle if none is pending
+    void orphan();
+
+  private:
+    explicit host_ref(jerry_context_t *ctx);
+
+    jerry_context_t *context;
+    uint32_t pending;
+  };
+
+  /*
+   * Per-context module state. T is constructed lazily on first get(),
+   * T::release() runs while the engine is still alive (drop jerry values,
+   * abort host requests) and the destructor after the engine is gone.
+   */
+  template<typename T>
+  class context_data {
+  public:
+    static T *get() {
+      return (T *) jerry_get_context_data(&manager);
+    }
+
+  private:
+    static void init(void *data) {
+      new(data) T();
+    }
+
+    static void deinit(void *data) {
+      ((T *) data)->release();
+    }
+
+    static void finalize(void *data) {
+      ((T *) data)->~T();
+    }
+
+    static const jerry_context_data_manager_t manager;
+  };
+
+  template<typename T>
+  const jerry_context_data_manager_t context_data<T>::manager = {
+          context_data<T>::init,
+          context_data<T>::deinit,
+          context_data<T>::finalize,
+          sizeof(T)
+  };
+}
+
+#endif //JPROTECTOR_CONTEXT_HPP
@@ -1,62 +1,45 @@
+#include "core.hpp"
 #include "string.hpp"
 #include "console.hpp"
+#include "log.hpp"
 #include "timer.hpp"
 #include "helper.hpp"
+#include "clone.hpp"
+#include "names.hpp"
 #include "marco.hpp"
 #include "error.hpp"
 #include "websocket.hpp"
 #include "request.hpp"
 #include "self.hpp"
+#include "slice.hpp"
+#include "scratch.hpp"
+#include "context.hpp"
 #include "b64.h"
 #include "aes.hpp"
 
 #define ENKEY "dtaacJLo7XZi845WnNalLM6HvaUVmbtnpTVTKcriHpAh3dXk"
 #define ENIV "NJC4ZR7spT6FD8AEDbpJCNJ2GTmgSgft2gB8rKPHc7BYNyZb"
+// leads snapshot payloads; no source payload starts with a NUL, as it would
+// be empty, and the tag is a whole word so the snapshot after it stays aligned
+#define SNAPSHOT_TAG "\0SNP"
+#define SNAPSHOT_TAG_SIZE 4
+#define SNAPSHOT_MAX_SIZE (64 * 1024 * 1024)
+// base64 chars unwrapped at a time, they decode to whole AES blocks
+#define UNWRAP_CHUNK 4096
 
-bool is_alive = false;
-
-char *decrypt(char *code, int len) {
-  auto tmp = (char *) malloc((size_t) len + 1);
-  memset(tmp, '\0', (size_t) len + 1);
-  memcpy(tmp, code, (size_t) len);
-  code = tmp;
-  for (int i = 0, j = len - 1; i < j; i++, j--) {
-    char k = code[i];
-    code[i] = code[j];
-    code[j] = k;
-  }
-  auto b64 = b64_decode(code, (size_t) len);
-  free(tmp);
-  return (char *) b64;
-}
-
-extern "C" {
-#include "jerryscript.h"
-
-int security_worker_onmessage(char *data) {
-  string code(data);
-  if (is_alive || code.size()) {
-    jerry_value_t global_object = jerry_get_global_object();
-    jerry_value_t onmessage_prop_name = JERRY_STRING("__onmessage__");
-    jerry_value_t onmessage_prop = jerry_get_property(global_object, onmessage_prop_name);
-    if (jerry_value_is_function(onmessage_prop)) {
-      jerry_value_t args[1];
-      args[0] = jerry_create_string((jerry_char_t *) code.c_str());
-      jerry_value_t retval = jerry_call_function(onmessage_prop, JERRY_UNDEFINED, args, 1);
-      ext::error::log_runtime_error(retval);
-      jerry_release_value(retval);
-      jerry_release_value(args[0]);
-    }
-    jerry_release_value(onmessage_prop);
-    jerry_release_value(onmessage_prop_name);
-    jerry_release_value(global_object);
-  }
-  return 0;
-}
-
-int security_worker_new(char *js_code, size_t b64_len, size_t real_len, size_t en_len, char *$$_code) {
-  js_code = decrypt(js_code, (int) b64_len);
+struct security_worker {
+  jerry_context_t *context;
+  security_worker_post_t post;
+  void *user_data;
+  // the tagged snapshot functions were loaded from, their bytecode is not copied
+  uint32_t *snapshot;
+#ifndef __EMSCRIPTEN__
+  // JSON.stringify from before the script ran, prints posted messages
+  jerry_value_t stringify;
+#endif
+};
 
+void code_key_iv(char *codekey, char *codeiv) {
   char rkey[17] = {'\0'};
   char riv[17] = {'\0'};
   for (int i = 0; i < 16; i++) {
@@ -64,9 +47,6 @@ int security_worker_new(char *js_code, size_t b64_len, size_t real_len, size_t e
     riv[i] = ENIV[16 + i];
   }
 
-  char codekey[17] = {'\0'};
-  char codeiv[17] = {'\0'};
-
   for (int i = 0, j = 15; i < j; i++, j--) {
     char k = rkey[i];
     codekey[i] = rkey[j];
@@ -76,44 +56,210 @@ int security_worker_new(char *js_code, size_t b64_len, size_t real_len, size_t e
     codeiv[i] = riv[j];
     codeiv[j] = k;
   }
+}
+
+/*
+ * Reverses, base64 decodes and decrypts the payload in a single pass: each
+ * chunk is reversed into a small buffer, decoded to its place in the result
+ * and decrypted there while it is still in cache. Returns the plaintext,
+ * padding stripped, or nullptr for a malformed payload.
+ */
+static uint8_t *unwrap(const char *code, size_t len, size_t en_len, size_t *real_len) {
+  if (en_len == 0 || en_len % AES_BLOCKLEN != 0 || B64_DECODED_SIZE(len) < en_len) {
+    return nullptr;
+  }
+
+  char codekey[17] = {'\0'};
+  char codeiv[17] = {'\0'};
+  code_key_iv(codekey, codeiv);
 
   struct AES_ctx ctx;
   AES_init_ctx_iv(&ctx, (uint8_t *) codekey, (uint8_t *) codeiv);
-  AES_CBC_decrypt_buffer(&ctx, (uint8_t *) js_code, (uint32_t) en_len);
 
-  int padding = js_code[en_len - 1];
-  real_len = en_len - padding;
+  auto out = (uint8_t *) malloc(B64_DECODED_SIZE(len) + 1);
+  char chunk[UNWRAP_CHUNK];
+  size_t decoded = 0;
+  size_t decrypted = 0;
+  for (size_t pos = 0; pos < len && decrypted < en_len; pos += UNWRAP_CHUNK) {
+    size_t n = len - pos < UNWRAP_CHUNK ? len - pos : UNWRAP_CHUNK;
+    const char *src = code + len - pos;
+    for (size_t i = 0; i < n; i++) {
+      chunk[i] = *--src;
+    }
+
+    size_t got = b64_decode_to(chunk, n, out + decoded);
+    decoded += got;
+    size_t ready = (decoded < en_len ? decoded : en_len) / AES_BLOCKLEN * AES_BLOCKLEN;
+    AES_CBC_decrypt_buffer(&ctx, out + decrypted, (uint32_t) (ready - decrypted));
+    decrypted = ready;
 
-  auto tmp = (char *) malloc(real_len + 1);
-  memset(tmp, '\0', real_len + 1);
-  memcpy(tmp, js_code, real_len);
+    // decoding stopped at `=` or a char that is not base64
+    if (got != B64_DECODED_SIZE(n)) {
+      break;
+    }
+  }
 
-  string script(tmp);
-  free(tmp);
-  free(js_code);
+  // PKCS#7
+  uint8_t padding = decrypted == en_len ? out[en_len - 1] : 0;
+  if (padding == 0 || padding > AES_BLOCKLEN) {
+    free(out);
+    return nullptr;
+  }
 
-  if (script.size()) {
+  *real_len = en_len - padding;
+  out[*real_len] = '\0';
+  return out;
+}
+
+#ifndef __EMSCRIPTEN__
+static uint32_t *compile_snapshot(const char *source, size_t len, size_t *snapshot_len) {
+  jerry_context_t *context = ext::context::create();
+  if (context == nullptr) {
+    return nullptr;
+  }
+
+  uint32_t *buffer = nullptr;
+  *snapshot_len = 0;
+  {
+    ext::context::scope scope(context);
+    // no magic strings here: a snapshot would refer to them by index, and
+    // packed payloads outlive the table of the build that packed them
     jerry_init(JERRY_INIT_EMPTY);
 
-    string $$str;
-    $$str << "var $ = " << $$_code;
-    jerry_value_t evalret = jerry_eval((jerry_char_t *) $$str.c_str(), $$str.size(), JERRY_PARSE_NO_OPTS);
-    ext::error::log_compile_error(evalret);
-    jerry_release_value(evalret);
+    jerry_value_t parsed_code = jerry_parse((jerry_char_t *) "<anonymous>", 11, (jerry_char_t *) source, len,
+                                            JERRY_PARSE_NO_OPTS);
+    bool compiles = !jerry_value_is_error(parsed_code);
+    jerry_release_value(parsed_code);
+
+    // the only other failure is a buffer too small, so grow until it fits
+    for (size_t size = (len + 1024) & ~(size_t) 3; compiles && size <= SNAPSHOT_MAX_SIZE; size *= 2) {
+      buffer = (uint32_t *) realloc(buffer, size);
+      jerry_value_t retval = jerry_generate_snapshot((jerry_char_t *) "<anonymous>", 11,
+                                                     (jerry_char_t *) source, len, 0, buffer, size);
+      if (!jerry_value_is_error(retval)) {
+        *snapshot_len = (size_t) jerry_get_number_value(retval);
+      }
+      jerry_release_value(retval);
+      if (*snapshot_len != 0) {
+        break;
+      }
+    }
+  }
+  ext::context::destroy(context);
 
-    ext::console::init();
-    ext::timer::init();
-    ext::helper::init();
-    ext::error::init();
-    ext::request::init();
-    ext::websocket::init();
-    ext::self::init();
+  if (*snapshot_len == 0) {
+    free(buffer);
+    return nullptr;
+  }
+  return buffer;
+}
+#endif
 
+extern "C" {
+#include "jerryscript.h"
+
+int security_worker_onmessage(security_worker_t *worker, const char *data, size_t len) {
+  if (worker == nullptr || data == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  if (ext::slice::defer(data, len, false)) {
+    return 0;
+  }
+  int ret = ext::helper::dispatch(ext::clone::read((const uint8_t *) data, len));
+  ext::helper::flush();
+  return ret;
+}
+
+int security_worker_onmessage_json(security_worker_t *worker, const char *json) {
+  if (worker == nullptr || json == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  size_t len = strlen(json);
+  if (ext::slice::defer(json, len, true)) {
+    return 0;
+  }
+  int ret = ext::helper::dispatch(jerry_json_parse((const jerry_char_t *) json, (jerry_size_t) len));
+  ext::helper::flush();
+  return ret;
+}
+
+security_worker_t *security_worker_new(char *js_code, size_t b64_len, size_t /* real_len */, size_t en_len, char *$$_code) {
+  return security_worker_create(js_code, b64_len, en_len, $$_code, nullptr, nullptr);
+}
+
+security_worker_t *security_worker_create(char *js_code, size_t b64_len, size_t en_len, char *$$_code,
+                                          security_worker_post_t post, void *user_data) {
+  size_t real_len = 0;
+  js_code = (char *) unwrap(js_code, b64_len, en_len, &real_len);
+  if (js_code == nullptr) {
+    return nullptr;
+  }
+
+  // unwrap mallocs, so a snapshot right after the tag is word aligned
+  bool is_snapshot = real_len > SNAPSHOT_TAG_SIZE && memcmp(js_code, SNAPSHOT_TAG, SNAPSHOT_TAG_SIZE) == 0;
+  size_t script_len = is_snapshot ? real_len - SNAPSHOT_TAG_SIZE : strnlen(js_code, real_len);
+  if (!script_len) {
+    free(js_code);
+    return nullptr;
+  }
+
+  jerry_context_t *context = ext::context::create();
+  if (context == nullptr) {
+    free(js_code);
+    return nullptr;
+  }
+
+  auto worker = new security_worker_t{context, post, user_data, is_snapshot ? (uint32_t *) js_code : nullptr};
+  ext::context::scope scope(context);
+  jerry_init(JERRY_INIT_EMPTY);
+  ext::names::register_magic();
+  ext::context::set_owner(worker);
+#ifndef __EMSCRIPTEN__
+  // taken before $$ or the script can replace it
+  jerry_value_t global_object = jerry_get_global_object();
+  jerry_value_t json_name = JERRY_STRING("JSON");
+  jerry_value_t json_val = jerry_get_property(global_object, json_name);
+  jerry_value_t stringify_name = JERRY_STRING("stringify");
+  worker->stringify = jerry_get_property(json_val, stringify_name);
+  jerry_release_value(stringify_name);
+  jerry_release_value(json_val);
+  jerry_release_value(json_name);
+  jerry_release_value(global_object);
+#endif
+
+  string $$str;
+  $$str << "var $ = " << $$_code;
+  jerry_value_t evalret = jerry_eval((jerry_char_t *) $$str.c_str(), $$str.size(), JERRY_PARSE_NO_OPTS);
+  ext::error::log_compile_error(evalret);
+  jerry_release_value(evalret);
+
+  ext::names::init();
+  ext::log::init();
+  ext::clone::init();
+  ext::console::init();
+  ext::timer::init();
+  ext::helper::init();
+  ext::error::init();
+  ext::request::init();
+  ext::websocket::init();
+  ext::self::init();
+
+  if (is_snapshot) {
+    jerry_value_t retval = jerry_exec_snapshot(worker->snapshot + SNAPSHOT_TAG_SIZE / sizeof(uint32_t), script_len,
+                                               0, 0);
+    ext::error::log_runtime_error(retval);
+    jerry_release_value(retval);
+  } else {
     jerry_value_t parsed_code = jerry_parse((jerry_char_t *) "<anonymous>",
                                             11,
-                                            (jerry_char_t *) script.c_str(),
-                                            script.size(),
+                                            (jerry_char_t *) js_code,
+                                            script_len,
                                             JERRY_PARSE_NO_OPTS);
+    free(js_code);
 
     if (!jerry_value_is_error(parsed_code)) {
       jerry_value_t retval = jerry_run(parsed_code);
@@ -124,19 +270,212 @@ int security_worker_new(char *js_code, size_t b64_len, size_t real_len, size_t e
     }
 
     jerry_release_value(parsed_code);
-    is_alive = true;
+  }
+  ext::helper::flush();
+#ifdef __EMSCRIPTEN__
+  if (post != nullptr) {
+    return worker;
+  }
+
+  char ready[128];
+  snprintf(ready, sizeof(ready), "typeof __ready_bridge__ == 'function' && __ready_bridge__(%lu)",
+           (unsigned long) (uintptr_t) worker);
+  emscripten_run_script(ready);
+#endif
+  return worker;
+}
+
+int security_worker_post(security_worker_t *worker, const char *data, size_t len) {
+  if (worker->post != nullptr) {
+    worker->post(worker, data, len, worker->user_data);
+    return 0;
+  }
+
 #ifdef __EMSCRIPTEN__
-    emscripten_run_script("typeof __ready_bridge__ == 'function' && __ready_bridge__()");
+  // the host reads the batch straight out of the heap, the worker handle
+  // tells it which instance posted
+  EM_ASM({
+    if (typeof __post_message_bridge__ == 'function') {
+      __post_message_bridge__(HEAPU8.subarray($1, $1 + $2), $0);
+    }
+  }, worker, data, len);
+#else
+  // the native host prints one message per line, as JSON
+  ext::context::scope scope(worker->context);
+  for (size_t pos = 0; pos + sizeof(uint32_t) <= len;) {
+    uint32_t frame;
+    memcpy(&frame, data + pos, sizeof(frame));
+    pos += sizeof(frame);
+
+    jerry_value_t value = ext::clone::read((const uint8_t *) data + pos, frame);
+    // a cyclic message throws, and is printed as undefined like one that can not be read
+    jerry_value_t json = jerry_value_is_error(value) ? JERRY_UNDEFINED
+                                                     : jerry_call_function(worker->stringify, JERRY_UNDEFINED, &value, 1);
+    if (jerry_value_is_string(json)) {
+      jerry_size_t text_len = jerry_get_utf8_string_size(json);
+      ext::scratch::buffer text(text_len);
+      fwrite(text.data, 1, jerry_string_to_utf8_char_buffer(json, text.data, text_len), stdout);
+    } else {
+      fputs("undefined", stdout);
+    }
+    fputc('\n', stdout);
+    jerry_release_value(json);
+    jerry_release_value(value);
+    pos += frame;
+  }
 #endif
+  return 0;
+}
+
+int security_worker_timer_stats(security_worker_t *worker, security_worker_timer_stats_t *stats) {
+  if (worker == nullptr || stats == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  ext::timer::stats(stats);
+  return 0;
+}
+
+int security_worker_batch_config(security_worker_t *worker, const security_worker_batch_config_t *config) {
+  if (worker == nullptr || config == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  ext::helper::batch_config(config);
+  return 0;
+}
+
+int security_worker_batch_stats(security_worker_t *worker, security_worker_batch_stats_t *stats) {
+  if (worker == nullptr || stats == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  ext::helper::batch_stats(stats);
+  return 0;
+}
+
+int security_worker_log_config(security_worker_t *worker, const security_worker_log_config_t *config) {
+  if (worker == nullptr || config == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  ext::log::config(config);
+  return 0;
+}
+
+int security_worker_log_stats(security_worker_t *worker, security_worker_log_stats_t *stats) {
+  if (worker == nullptr || stats == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  ext::log::stats(stats);
+  return 0;
+}
+
+int security_worker_request_config(security_worker_t *worker, const security_worker_request_config_t *config) {
+  if (worker == nullptr || config == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  ext::request::config(config);
+  return 0;
+}
+
+int security_worker_request_stats(security_worker_t *worker, security_worker_request_stats_t *stats,
+                                  security_worker_request_origin_t origin, void *user_data) {
+  if (worker == nullptr || stats == nullptr) {
+    return -1;
   }
+
+  ext::context::scope scope(worker->context);
+  ext::request::stats(stats, origin, user_data);
   return 0;
 }
 
-int security_worker_exit() {
-  if (is_alive) {
-    is_alive = false;
-    jerry_cleanup();
+int security_worker_slice_config(security_worker_t *worker, const security_worker_slice_config_t *config) {
+  if (worker == nullptr || config == nullptr) {
+    return -1;
   }
+
+  ext::context::scope scope(worker->context);
+  ext::slice::config(config);
   return 0;
 }
+
+int security_worker_slice_stats(security_worker_t *worker, security_worker_slice_stats_t *stats) {
+  if (worker == nullptr || stats == nullptr) {
+    return -1;
+  }
+
+  ext::context::scope scope(worker->context);
+  ext::slice::stats(stats);
+  return 0;
+}
+
+int security_worker_exit(security_worker_t *worker) {
+  if (worker == nullptr) {
+    return -1;
+  }
+
+#ifndef __EMSCRIPTEN__
+  {
+    ext::context::scope scope(worker->context);
+    jerry_release_value(worker->stringify);
+  }
+#endif
+  ext::context::destroy(worker->context);
+  free(worker->snapshot);
+  delete worker;
+  return 0;
+}
+
+#ifndef __EMSCRIPTEN__
+char *security_worker_pack(const char *source, size_t len, size_t *en_len) {
+  char codekey[17] = {'\0'};
+  char codeiv[17] = {'\0'};
+  code_key_iv(codekey, codeiv);
+
+  // workers start from bytecode; source that does not compile is packed as
+  // is, so the worker still reports the error when it starts
+  size_t snapshot_len = 0;
+  uint32_t *snapshot = compile_snapshot(source, len, &snapshot_len);
+  size_t tag_len = snapshot != nullptr ? SNAPSHOT_TAG_SIZE : 0;
+  if (snapshot != nullptr) {
+    source = (const char *) snapshot;
+    len = snapshot_len;
+  }
+
+  // PKCS#7, the inverse of the padding strip in security_worker_new
+  size_t padding = AES_BLOCKLEN - (tag_len + len) % AES_BLOCKLEN;
+  size_t total = tag_len + len + padding;
+  auto buf = (uint8_t *) malloc(total);
+  memcpy(buf, SNAPSHOT_TAG, tag_len);
+  memcpy(buf + tag_len, source, len);
+  memset(buf + tag_len + len, (int) padding, padding);
+  free(snapshot);
+
+  struct AES_ctx ctx;
+  AES_init_ctx_iv(&ctx, (uint8_t *) codekey, (uint8_t *) codeiv);
+  AES_CBC_encrypt_buffer(&ctx, buf, (uint32_t) total);
+
+  size_t code_len = B64_ENCODED_SIZE(total);
+  auto code = (char *) malloc(code_len + 1);
+  code[b64_encode_to(buf, total, code)] = '\0';
+  free(buf);
+  for (size_t i = 0, j = code_len - 1; i < j; i++, j--) {
+    char k = code[i];
+    code[i] = code[j];
+    code[j] = k;
+  }
+
+  *en_len = total;
+  return code;
+}
+#endif
 }
@@ -0,0 +1,181 @@
+#ifndef JPROTECTOR_CORE_HPP
+#define JPROTECTOR_CORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+// one isolated worker, backed by its own engine context
+typedef struct security_worker security_worker_t;
+
+// `data` is one message in the binary clone format described in clone.hpp
+int security_worker_onmessage(security_worker_t *worker, const char *data, size_t len);
+
+// same, for hosts that speak JSON; the text is parsed inside the worker
+int security_worker_onmessage_json(security_worker_t *worker, const char *json);
+
+// receives what the worker passes to postMessage(), batched per turn: `data`
+// holds one or more frames of a 4 byte little endian length followed by a
+// message in the binary clone format; it is only valid during the call
+typedef void (*security_worker_post_t)(security_worker_t *worker, const char *data, size_t len, void *user_data);
+
+// `real_len` is unused and kept so existing hosts keep their argument order, the
+// plaintext length is recovered from the padding while the payload is unwrapped
+security_worker_t *security_worker_new(char *js_code, size_t b64_len, size_t real_len, size_t en_len, char *$$_code);
+
+// like security_worker_new, but postMessage() goes to `post` instead of the host bridge
+security_worker_t *security_worker_create(char *js_code, size_t b64_len, size_t en_len, char *$$_code,
+                                          security_worker_post_t post, void *user_data);
+
+// delivers one batch of frames to the host, see security_worker_post_t
+int security_worker_post(security_worker_t *worker, const char *data, size_t len);
+
+int security_worker_exit(security_worker_t *worker);
+
+typedef struct security_worker_timer_stats {
+  uint32_t active;           // timers currently scheduled
+  uint64_t scheduled;        // setTimeout/setInterval calls, interval repeats excluded
+  uint64_t fired;            // callbacks run
+  uint64_t cancelled;        // clearTimeout/clearInterval hits
+  uint64_t wakeups;          // host timer callbacks, each may fire many timers
+  double lateness_max_ms;    // worst delay between deadline and callback
+  double lateness_total_ms;  // divide by fired for the mean
+} security_worker_timer_stats_t;
+
+int security_worker_timer_stats(security_worker_t *worker, security_worker_timer_stats_t *stats);
+
+typedef struct security_worker_batch_config {
+  uint32_t max_bytes;        // flush within a turn once the batch is this large
+  uint32_t max_messages;     // or holds this many messages
+  double max_latency_ms;     // or its oldest message waited this long; 0 disables each limit
+} security_worker_batch_config_t;
+
+int security_worker_batch_config(security_worker_t *worker, const security_worker_batch_config_t *config);
+
+typedef struct security_worker_batch_stats {
+  uint64_t messages;         // postMessage calls delivered
+  uint64_t batches;          // host deliveries, divide messages by this for the mean
+  uint64_t bytes;            // delivered, frame headers included
+  uint32_t max_messages;     // largest batch
+  uint64_t size_flushes;     // batches cut short by max_bytes or max_messages
+  uint64_t latency_flushes;  // batches cut short by max_latency_ms
+} security_worker_batch_stats_t;
+
+int security_worker_batch_stats(security_worker_t *worker, security_worker_batch_stats_t *stats);
+
+// console levels, in the order of the per level arrays below
+typedef enum security_worker_log_level {
+  SECURITY_WORKER_LOG_DEBUG = 0,
+  SECURITY_WORKER_LOG_INFO,
+  SECURITY_WORKER_LOG_LOG,
+  SECURITY_WORKER_LOG_WARN,
+  SECURITY_WORKER_LOG_ERROR,
+  SECURITY_WORKER_LOG_LEVELS
+} security_worker_log_level_t;
+
+// receives the lines logged during a turn once it ends, `time_ms` is when
+// each was logged; `text` is only valid during the call
+typedef void (*security_worker_log_sink_t)(security_worker_t *worker, security_worker_log_level_t level,
+                                           double time_ms, const char *text, size_t len, void *user_data);
+
+typedef struct security_worker_log_limit {
+  uint32_t sample_every;     // keep one line in this many, 0 keeps all
+  double rate_per_sec;       // lines let through per second, 0 disables the limit
+  double burst;              // lines let through at once before the rate applies
+} security_worker_log_limit_t;
+
+typedef struct security_worker_log_config {
+  security_worker_log_limit_t levels[SECURITY_WORKER_LOG_LEVELS];
+  security_worker_log_sink_t sink;  // nullptr logs through emscripten_log
+  void *sink_data;
+} security_worker_log_config_t;
+
+int security_worker_log_config(security_worker_t *worker, const security_worker_log_config_t *config);
+
+typedef struct security_worker_log_stats {
+  uint64_t written[SECURITY_WORKER_LOG_LEVELS];  // lines handed to the sink
+  uint64_t sampled[SECURITY_WORKER_LOG_LEVELS];  // dropped by sample_every
+  uint64_t limited[SECURITY_WORKER_LOG_LEVELS];  // dropped by the rate limit
+  uint64_t overflowed;       // dropped because the ring filled up while the sink ran
+  uint64_t truncated;        // cut to LOG_MAX_RECORD bytes
+  uint64_t flushes;          // hand overs to the sink, at the end of a turn or of the ring
+} security_worker_log_stats_t;
+
+int security_worker_log_stats(security_worker_t *worker, security_worker_log_stats_t *stats);
+
+typedef struct security_worker_request_config {
+  uint32_t max_active;       // fetches in flight at once, later requests wait; 0 disables the limit
+  uint32_t cache_entries;    // GET responses kept for reuse, 0 disables the cache
+  size_t cache_bytes;        // body bytes the cache may hold
+} security_worker_request_config_t;
+
+int security_worker_request_config(security_worker_t *worker, const security_worker_request_config_t *config);
+
+typedef struct security_worker_request_stats {
+  uint64_t requests;         // request() calls
+  uint64_t fetches;          // sent to the network
+  uint64_t coalesced;        // joined an identical GET already waiting or in flight
+  uint64_t cache_hits;       // answered from a fresh cache entry
+  uint64_t revalidated;      // answered from the cache after a 304
+  uint64_t failed;           // fetches that ended in onerror
+  uint64_t bytes;            // response bodies received
+  uint32_t active;           // fetches in flight
+  uint32_t waiting;          // fetches waiting for max_active
+} security_worker_request_stats_t;
+
+// receives the stats of one origin, `scheme://host[:port]`
+typedef void (*security_worker_request_origin_t)(const char *origin, const security_worker_request_stats_t *stats,
+                                                 void *user_data);
+
+// totals go to `stats`, then `origin` (may be NULL) is called once per origin seen
+int security_worker_request_stats(security_worker_t *worker, security_worker_request_stats_t *stats,
+                                  security_worker_request_origin_t origin, void *user_data);
+
+typedef struct security_worker_slice_config {
+  uint32_t budget_us;        // script time per host turn, then messages and due timers wait for the next; 0 disables
+  uint32_t limit_us;         // script still running this long into a turn is stopped; 0 disables
+} security_worker_slice_config_t;
+
+int security_worker_slice_config(security_worker_t *worker, const security_worker_slice_config_t *config);
+
+typedef struct security_worker_slice_stats {
+  uint64_t turns;            // host turns timed against the budget
+  uint64_t yields;           // turns that ran out of budget with work left for the next
+  uint64_t deferred;         // inbound messages that waited for a later turn
+  uint64_t stopped;          // turns whose script was stopped at limit_us
+  uint32_t waiting;          // inbound messages waiting now
+} security_worker_slice_stats_t;
+
+int security_worker_slice_stats(security_worker_t *worker, security_worker_slice_stats_t *stats);
+
+#ifndef __EMSCRIPTEN__
+// compile plain source to a bytecode snapshot and wrap it the way the compiler
+// does (source that does not parse is wrapped as is), returns a malloc()ed
+// payload for security_worker_new() and stores the ciphertext length in *en_len
+char *security_worker_pack(const char *source, size_t len, size_t *en_len);
+
+// workers spread over a fixed set of threads, addressed by the id spawn returns
+typedef struct security_worker_pool security_worker_pool_t;
+
+// 0 threads means one per core
+security_worker_pool_t *security_worker_pool_new(unsigned int threads);
+
+uint32_t security_worker_pool_spawn(security_worker_pool_t *pool, const char *js_code, size_t b64_len,
+                                    size_t en_len, const char *$$_code);
+
+int security_worker_pool_post(security_worker_pool_t *pool, uint32_t worker, const char *data, size_t len);
+
+int security_worker_pool_terminate(security_worker_pool_t *pool, uint32_t worker);
+
+// returns -1 once drained; *data is a malloc()ed clone message of *len bytes,
+// NULL when the worker failed to start
+int security_worker_pool_receive(security_worker_pool_t *pool, uint32_t *worker, char **data, size_t *len);
+
+// readable while messages are waiting in security_worker_pool_receive()
+int security_worker_pool_fd(security_worker_pool_t *pool);
+
+void security_worker_pool_exit(security_worker_pool_t *pool);
+#endif
+}
+
+#endif //JPROTECTOR_CORE_HPP
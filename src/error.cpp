@@ -1,88 +1,189 @@
+#include <cstdlib>
 #include "error.hpp"
+#include "names.hpp"
+
+const jerry_object_native_info_t ext::error::native_info = {free};
+
+ext::error::state::state() : limit(ERROR_STACK_LIMIT), names(nullptr), names_len(0), names_cap(0) {
+}
+
+ext::error::state::~state() {
+  free(names);
+}
+
+void ext::error::state::release() {
+  jerry_set_error_object_created_callback(nullptr, nullptr);
+  for (uint32_t i = 0; i < names_len; i++) {
+    jerry_release_value(names[i]);
+  }
+  names_len = 0;
+}
 
 int ext::error::init() {
+  static constexpr binding error_bindings[] = {
+    {"stackTraceLimit", get_stack_trace_limit, set_stack_trace_limit, BINDING_ACCESSOR},
+  };
+  static constexpr binding prototype_bindings[] = {
+    {"toString", to_string, nullptr, BINDING_METHOD},
+    {"stack", get_stack, set_stack, BINDING_ACCESSOR | BINDING_HIDDEN},
+  };
+
   jerry_value_t global_object = jerry_get_global_object();
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, _print_error_stack_, ext::error::printStack);
+  JERRY_PROPERTY_BLOCK(global_object, Error);
+  JERRY_PROPERTY_BLOCK(Error_prop, prototype);
+  ext::names::install(Error_prop, error_bindings);
+  ext::names::install(prototype_prop, prototype_bindings);
+  JERRY_PROPERTY_BLOCK_END(prototype);
+  JERRY_PROPERTY_BLOCK_END(Error);
   jerry_release_value(global_object);
 
-  string format_error;
-  format_error << "var E = Error; "
-               << "Error = function() {   "
-               << "   E.apply(this, arguments);"
-               << "   this.message = arguments[0];"
-               << "   this.stack = null; "
-               << "   delete this.stack; "
-               << "}; "
-               << "Error.prototype = E.prototype; "
-               << "Error.prototype.toString = function(){ "
-               << "   var stack = _print_error_stack_();"
-               << "   stack.shift(); "
-               << "   stack = stack.map(function(v){ return '            at ' + v; }); "
-               << "   return 'Error: ' + this.message + '\\n' + stack.join('\\n'); "
-               << "}; "
-               << "Object.defineProperties(Error.prototype, { "
-               << "   stack: {"
-               << "       configurable: true, "
-               << "       enumerable: false, "
-               << "       get: function() { "
-               << "           var stack = _print_error_stack_();"
-               << "           stack.shift(); "
-               << "           stack = stack.map(function(v){ return '            at ' + v; }); "
-               << "           return 'Error \\n' + stack.join('\\n'); "
-               << "       } "
-               << "   } "
-               << "}); ";
-
-  auto code = (jerry_char_t *) format_error.c_str();
-  jerry_value_t retval = jerry_eval(code, format_error.size(), JERRY_PARSE_NO_OPTS);
-  ext::error::log_compile_error(retval);
-  jerry_release_value(retval);
-
+  // errors made from here on carry a backtrace instead of a stack array
+  context_data<state>::get();
+  jerry_set_error_object_created_callback(capture, nullptr);
   return 0;
 }
 
-JERRY_EXTERNAL_FUNC(ext::error::printStack) {
-  return jerry_get_backtrace(11);
+JERRY_EXTERNAL_FUNC(ext::error::to_string) {
+  string out;
+  format(this_value, out);
+  return jerry_create_string_sz((const jerry_char_t *) out.c_str(), (jerry_size_t) out.size());
 }
 
-void ext::error::log_runtime_error(jerry_value_t &retval) {
-  if (jerry_value_is_error(retval)) {
-    string error_str("[ERROR] ");
-    jerry_value_clear_error_flag(&retval);
+JERRY_EXTERNAL_FUNC(ext::error::get_stack) {
+  return to_string(func_value, this_value, args_p, args_cnt);
+}
+
+JERRY_EXTERNAL_FUNC(ext::error::set_stack) {
+  // an assigned stack shadows the formatted one
+  if (args_cnt > 0 && jerry_value_is_object(this_value)) {
+    jerry_property_descriptor_t desc;
+    jerry_init_property_descriptor_fields(&desc);
+    desc.is_value_defined = true;
+    desc.value = jerry_acquire_value(*args_p);
+    desc.is_writable_defined = true;
+    desc.is_writable = true;
+    desc.is_configurable_defined = true;
+    desc.is_configurable = true;
+    jerry_release_value(jerry_define_own_property(this_value, ext::names::get(NAME_stack), &desc));
+    jerry_free_property_descriptor_fields(&desc);
+  }
+  return JERRY_UNDEFINED;
+}
+
+JERRY_EXTERNAL_FUNC(ext::error::get_stack_trace_limit) {
+  return jerry_create_number(context_data<state>::get()->limit);
+}
+
+JERRY_EXTERNAL_FUNC(ext::error::set_stack_trace_limit) {
+  if (args_cnt > 0 && jerry_value_is_number(*args_p)) {
+    double limit = jerry_get_number_value(*args_p);
+    context_data<state>::get()->limit = limit > 0 ? (uint32_t) (limit < ERROR_MAX_FRAMES ? limit : ERROR_MAX_FRAMES) : 0;
+  }
+  return JERRY_UNDEFINED;
+}
+
+void ext::error::capture(const jerry_value_t error_object, void *user_p) {
+  auto s = context_data<state>::get();
+  if (s->limit == 0) {
+    return;
+  }
+
+  jerry_backtrace_frame_t frames[ERROR_MAX_FRAMES];
+  uint32_t len = jerry_get_backtrace_frames(frames, s->limit);
+  if (len == 0) {
+    return;
+  }
+
+  auto trace = (backtrace *) malloc(sizeof(backtrace) + len * sizeof(backtrace::frame));
+  trace->len = len;
+  auto out = (backtrace::frame *) (trace + 1);
+  for (uint32_t i = 0; i < len; i++) {
+    out[i].name = intern(s, frames[i].resource_name);
+    out[i].line = frames[i].line;
+  }
+  jerry_set_object_native_pointer(error_object, trace, &native_info);
+}
+
+uint32_t ext::error::intern(state *s, jerry_value_t name) {
+  // a handful of scripts, and literal strings compare by value
+  for (uint32_t i = 0; i < s->names_len; i++) {
+    if (s->names[i] == name) {
+      return i;
+    }
+  }
+
+  if (s->names_len == s->names_cap) {
+    s->names_cap = s->names_cap == 0 ? 8 : s->names_cap * 2;
+    s->names = (jerry_value_t *) realloc(s->names, s->names_cap * sizeof(jerry_value_t));
+  }
+  s->names[s->names_len] = jerry_acquire_value(name);
+  return s->names_len++;
+}
+
+void ext::error::append(jerry_value_t value, string &out) {
+  JERRY_VIEW_STR_CHARS(str, len, chars, &value);
+  out.append((const char *) chars, len);
+}
+
+void ext::error::format(jerry_value_t error, string &out) {
+  if (!jerry_value_is_object(error)) {
+    append(error, out);
+    return;
+  }
 
-    jerry_value_t message_name = JERRY_STRING("message");
-    jerry_value_t message_prop = jerry_get_property(retval, message_name);
-    jerry_value_t message_prop_error = jerry_get_value_from_error(message_prop, false);
-    jerry_value_t message_prop_error_val = jerry_value_to_string(message_prop_error);
-    JERRY_CONV_STR_TO_CHAR_BUFFER(msg_str, msg_str_len, msg_buffer, &message_prop_error_val);
-    error_str << "Error: " << (char *) msg_buffer << "\n";
-
-    jerry_release_value(message_prop_error_val);
-    jerry_release_value(message_prop_error);
-    jerry_release_value(message_prop);
-    jerry_release_value(message_name);
-
-    jerry_value_t stack_name = JERRY_STRING("stack");
-    jerry_value_t stack_prop = jerry_get_property(retval, stack_name);
-    jerry_value_t stack_prop_error = jerry_get_value_from_error(stack_prop, false);
-    uint32_t stack_len = jerry_get_array_length(stack_prop_error);
-    for (uint32_t i = 0; i < stack_len; i++) {
-      jerry_value_t stack_prop_error_val = jerry_get_property_by_index(stack_prop_error, i);
-      JERRY_CONV_STR_TO_CHAR_BUFFER(stack_str, stack_str_len, stack_buffer, &stack_prop_error_val);
-      error_str << "            at " << (char *) stack_buffer;
-      if (i < stack_len - 1) {
-        error_str << "\n";
-      }
-      jerry_release_value(stack_prop_error_val);
+  // `name: message` as Error.prototype.toString has it, then the frames
+  jerry_value_t name = jerry_get_property(error, ext::names::get(NAME_name));
+  jerry_value_t message = jerry_get_property(error, ext::names::get(NAME_message));
+  bool has_name = !jerry_value_is_undefined(name) && !jerry_value_is_error(name);
+  bool has_message = !jerry_value_is_undefined(message) && !jerry_value_is_error(message);
+  if (has_name) {
+    append(name, out);
+  } else {
+    out << "Error";
+  }
+  if (has_message) {
+    JERRY_VIEW_STR_CHARS(message_str, message_len, message_chars, &message);
+    if (message_len > 0) {
+      out << ": ";
+      out.append((const char *) message_chars, message_len);
     }
+  }
+  jerry_release_value(message);
+  jerry_release_value(name);
 
-    jerry_release_value(stack_prop_error);
-    jerry_release_value(stack_prop);
-    jerry_release_value(stack_name);
+  void *trace = nullptr;
+  const jerry_object_native_info_t *info = nullptr;
+  if (!jerry_get_object_native_pointer(error, &trace, &info) || info != &native_info) {
+    return;
+  }
 
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_ERROR, error_str.c_str());
-#endif
+  auto s = context_data<state>::get();
+  auto frames = (backtrace::frame *) ((backtrace *) trace + 1);
+  for (uint32_t i = 0; i < ((backtrace *) trace)->len; i++) {
+    out << "\n            at ";
+    // snapshot code has no resource name, eval'd code an empty one
+    jerry_value_t name = s->names[frames[i].name];
+    if (jerry_value_is_undefined(name)) {
+      out << "<anonymous>";
+    } else if (jerry_get_string_size(name) > 0) {
+      append(name, out);
+    } else {
+      out << "<unknown>";
+    }
+    out << ":" << frames[i].line;
+  }
+}
+
+void ext::error::log_runtime_error(jerry_value_t &retval) {
+  if (jerry_value_is_error(retval)) {
+    jerry_value_clear_error_flag(&retval);
+    string error_str("[ERROR] ");
+    if (jerry_get_error_type(retval) != JERRY_ERROR_NONE) {
+      format(retval, error_str);
+    } else {
+      append(retval, error_str);
+    }
+    ext::log::text(SECURITY_WORKER_LOG_ERROR, error_str.c_str(), error_str.size());
   }
 }
 
@@ -94,10 +195,8 @@ void ext::error::log_compile_error(jerry_value_t &retval) {
     JERRY_CONV_STR_TO_CHAR_BUFFER(error, error_len, error_buffer, &parsed_error_str);
     jerry_release_value(parsed_error_str);
     jerry_release_value(parsed_error);
-#ifdef __EMSCRIPTEN__
     string error_str("[ERROR] ");
     error_str << (char *)error_buffer;
-    emscripten_log(EM_LOG_ERROR, error_str.c_str());
-#endif
+    ext::log::text(SECURITY_WORKER_LOG_ERROR, error_str.c_str(), error_str.size());
   }
 }
\ No newline at end of file
@@ -1,28 +1,83 @@
 #ifndef JPROTECTOR_ERROR_HPP
 #define JPROTECTOR_ERROR_HPP
 
+#include <cstdint>
 #include "marco.hpp"
 #include "string.hpp"
+#include "context.hpp"
+#include "log.hpp"
 
 extern "C" {
 #include "jerryscript.h"
 
-#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
-#endif
 };
 
+// frames kept per error unless Error.stackTraceLimit says otherwise
+#define ERROR_STACK_LIMIT 10
+#define ERROR_MAX_FRAMES 64
+
 namespace ext {
+  /*
+   * Error objects get their backtrace recorded when the engine creates
+   * them, as a resource name and line per frame, and nothing is turned into
+   * strings until `stack`, toString() or the error log asks for it. The
+   * resource names are shared by all the records of a context.
+   */
   class error {
+    struct backtrace {
+      struct frame {
+        // index into state::names
+        uint32_t name;
+        uint32_t line;
+      };
+
+      uint32_t len;
+      // followed by len frames
+    };
+
+    struct state {
+      state();
+
+      ~state();
+
+      void release();
+
+      // Error.stackTraceLimit, 0 records nothing
+      uint32_t limit;
+      jerry_value_t *names;
+      uint32_t names_len;
+      uint32_t names_cap;
+    };
+
   public:
     static int init();
 
+    // `name: message` and the recorded frames, appended to out
+    static void format(jerry_value_t error, string &out);
+
     static void log_runtime_error(jerry_value_t &retval);
 
     static void log_compile_error(jerry_value_t &retval);
 
   private:
-    static JERRY_EXTERNAL_FUNC(printStack);
+    static const jerry_object_native_info_t native_info;
+
+    static JERRY_EXTERNAL_FUNC(to_string);
+
+    static JERRY_EXTERNAL_FUNC(get_stack);
+
+    static JERRY_EXTERNAL_FUNC(set_stack);
+
+    static JERRY_EXTERNAL_FUNC(get_stack_trace_limit);
+
+    static JERRY_EXTERNAL_FUNC(set_stack_trace_limit);
+
+    static void capture(const jerry_value_t error_object, void *user_p);
+
+    static uint32_t intern(state *s, jerry_value_t name);
+
+    static void append(jerry_value_t value, string &out);
   };
 }
 
@@ -1,34 +1,20 @@
 #include "helper.hpp"
 
 int ext::helper::init() {
+  // onmessage is an accessor, so dispatch holds the handler itself instead
+  // of looking it up on the global for every message
+  static constexpr binding bindings[] = {
+    {"btoa", btoa, nullptr, BINDING_METHOD},
+    {"atob", atob, nullptr, BINDING_METHOD},
+    {"postMessage", post_message, nullptr, BINDING_METHOD},
+    {"$$", $$, nullptr, BINDING_METHOD},
+    {"onmessage", onmessage_getter, onmessage_setter, BINDING_ACCESSOR | BINDING_FIXED},
+  };
+
   jerry_value_t global_object = jerry_get_global_object();
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, btoa, btoa);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, atob, atob);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, __post_message_bridge__, post_message_bridge);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, $$, $$);
+  ext::names::install(global_object, bindings);
   jerry_release_value(global_object);
 
-  string post_message_code;
-  post_message_code << "function postMessage(o) {"
-                    << "  o = {message: o};"
-                    << "  __post_message_bridge__(JSON.stringify(o));"
-                    << "};"
-                    << "function __onmessage__(o) {"
-                    << "  if(typeof onmessage == 'function'){"
-                    << "    try{"
-                    << "      o = JSON.parse(o);"
-                    << "      onmessage(o.message);"
-                    << "    }catch(e){"
-                    << "      console.error(e.toString());"
-                    << "    }"
-                    << "  }"
-                    << "};";
-
-  auto code = (jerry_char_t *) post_message_code.c_str();
-  jerry_value_t retval = jerry_eval(code, post_message_code.size(), JERRY_PARSE_NO_OPTS);
-  ext::error::log_compile_error(retval);
-  jerry_release_value(retval);
-
   return 0;
 }
 
@@ -37,15 +23,15 @@ JERRY_EXTERNAL_FUNC(ext::helper::btoa) {
     return JERRY_STRING("");
   }
 
-  JERRY_CONV_STR_TO_CHAR_BUFFER(str, str_len, char_buffer, args_p);
+  JERRY_VIEW_STR_CHARS(str, str_len, char_buffer, args_p);
   if (str_len == 0) {
     return JERRY_STRING("");
   }
 
-  char *encode_str = b64_encode((const unsigned char *) char_buffer, str_len);
-  jerry_value_t retval = JERRY_STRING(encode_str);
-  delete encode_str;
-  encode_str = nullptr;
+  auto encode_str = (char *) malloc(B64_ENCODED_SIZE(str_len));
+  size_t encode_len = b64_encode_to((const unsigned char *) char_buffer, str_len, encode_str);
+  jerry_value_t retval = jerry_create_string_sz((const jerry_char_t *) encode_str, (jerry_size_t) encode_len);
+  free(encode_str);
 
   return retval;
 }
@@ -55,38 +41,150 @@ JERRY_EXTERNAL_FUNC(ext::helper::atob) {
     return JERRY_STRING("");
   }
 
-  JERRY_CONV_STR_TO_CHAR_BUFFER(str, str_len, char_buffer, args_p);
+  JERRY_VIEW_STR_CHARS(str, str_len, char_buffer, args_p);
   if (str_len == 0) {
     return JERRY_STRING("");
   }
 
-  unsigned char *decode_str = b64_decode((const char *) char_buffer, str_len);
+  auto decode_str = (jerry_char_t *) malloc(B64_DECODED_SIZE(str_len) + 1);
+  size_t decode_len = b64_decode_to((const char *) char_buffer, str_len, decode_str);
+  decode_str[decode_len] = '\0';
   jerry_value_t retval = JERRY_STRING(decode_str);
-  delete decode_str;
-  decode_str = nullptr;
+  free(decode_str);
 
   return retval;
 }
 
-JERRY_EXTERNAL_FUNC(ext::helper::post_message_bridge) {
-  if (args_cnt == 0 || !jerry_value_is_string(*args_p)) {
-    return JERRY_UNDEFINED;
+int ext::helper::dispatch(jerry_value_t message) {
+  if (jerry_value_is_error(message)) {
+    ext::error::log_runtime_error(message);
+    jerry_release_value(message);
+    return -1;
   }
 
-  JERRY_CONV_STR_TO_CHAR_BUFFER(arg, arg_len, arg_buffer, args_p);
-  string code;
-  code << "if(typeof __post_message_bridge__ == 'function' ) {"
-       << "__post_message_bridge__("
-       << (char *) arg_buffer
-       << ");};";
+  // the handler may reassign onmessage while it runs
+  jerry_value_t handler = jerry_acquire_value(context_data<state>::get()->onmessage);
+  if (jerry_value_is_function(handler)) {
+    jerry_value_t retval = jerry_call_function(handler, JERRY_UNDEFINED, &message, 1);
+    ext::error::log_runtime_error(retval);
+    jerry_release_value(retval);
+  }
 
-#ifdef __EMSCRIPTEN__
-  emscripten_run_script(code.c_str());
-#endif
+  jerry_release_value(handler);
+  jerry_release_value(message);
+  return 0;
+}
+
+JERRY_EXTERNAL_FUNC(ext::helper::onmessage_getter) {
+  return jerry_acquire_value(context_data<state>::get()->onmessage);
+}
 
+JERRY_EXTERNAL_FUNC(ext::helper::onmessage_setter) {
+  auto s = context_data<state>::get();
+  jerry_release_value(s->onmessage);
+  s->onmessage = args_cnt == 0 ? JERRY_UNDEFINED : jerry_acquire_value(*args_p);
   return JERRY_UNDEFINED;
 }
 
+void ext::helper::flush() {
+  ext::log::flush();
+
+  auto s = context_data<state>::get();
+  if (s->delivering) {
+    return;
+  }
+
+  s->delivering = true;
+  while (s->count != 0) {
+    // the host may answer synchronously, what it triggers queues up in `batch`
+    s->batch.swap(s->spare);
+    uint32_t count = s->count;
+    s->count = 0;
+
+    s->stats.messages += count;
+    s->stats.batches += 1;
+    s->stats.bytes += s->spare.len;
+    if (count > s->stats.max_messages) {
+      s->stats.max_messages = count;
+    }
+
+    security_worker_post((security_worker_t *) ext::context::owner(), (const char *) s->spare.data, s->spare.len);
+    s->spare.len = 0;
+  }
+  s->delivering = false;
+}
+
+void ext::helper::batch_config(const security_worker_batch_config_t *config) {
+  context_data<state>::get()->config = *config;
+}
+
+void ext::helper::batch_stats(security_worker_batch_stats_t *out) {
+  *out = context_data<state>::get()->stats;
+}
+
+JERRY_EXTERNAL_FUNC(ext::helper::post_message) {
+  auto s = context_data<state>::get();
+
+  // a getter running mid-clone may post too; its message is written aside
+  // and queued right after the one being cloned
+  bool nested = s->cloning;
+  clone::buffer scratch;
+  clone::buffer &out = nested ? scratch : s->batch;
+  size_t start = out.len;
+  out.reserve(sizeof(uint32_t));
+  out.len += sizeof(uint32_t);
+
+  s->cloning = true;
+  jerry_value_t retval = clone::write(args_cnt == 0 ? JERRY_UNDEFINED : *args_p, out);
+  s->cloning = nested;
+  bool failed = jerry_value_is_error(retval);
+  if (failed) {
+    out.len = start;
+  } else {
+    auto frame = (uint32_t) (out.len - start - sizeof(uint32_t));
+    memcpy(out.data + start, &frame, sizeof(frame));
+  }
+
+  if (nested) {
+    if (!failed) {
+      memcpy(s->nested.reserve(scratch.len), scratch.data, scratch.len);
+      s->nested.len += scratch.len;
+      s->nested_count += 1;
+    }
+    return retval;
+  }
+
+  bool first = s->count == 0;
+  s->count += failed ? 0 : 1;
+  if (s->nested_count != 0) {
+    memcpy(s->batch.reserve(s->nested.len), s->nested.data, s->nested.len);
+    s->batch.len += s->nested.len;
+    s->count += s->nested_count;
+    s->nested.len = 0;
+    s->nested_count = 0;
+  }
+
+  const security_worker_batch_config_t &config = s->config;
+  if (s->count == 0) {
+    return retval;
+  }
+  if ((config.max_bytes != 0 && s->batch.len >= config.max_bytes) ||
+      (config.max_messages != 0 && s->count >= config.max_messages)) {
+    s->stats.size_flushes += 1;
+    flush();
+  } else if (config.max_latency_ms > 0) {
+    double now = emscripten_get_now();
+    if (first) {
+      s->oldest = now;
+    } else if (now - s->oldest >= config.max_latency_ms) {
+      s->stats.latency_flushes += 1;
+      flush();
+    }
+  }
+
+  return retval;
+}
+
 JERRY_EXTERNAL_FUNC(ext::helper::$$) {
   if (args_cnt == 0 || !jerry_value_is_string(*args_p)) {
     return JERRY_UNDEFINED;
@@ -96,5 +194,7 @@ JERRY_EXTERNAL_FUNC(ext::helper::$$) {
 #ifdef __EMSCRIPTEN__
   char *result = emscripten_run_script_string((char *)arg_buffer);
   return JERRY_STRING(result);
+#else
+  return JERRY_UNDEFINED;
 #endif
 }
\ No newline at end of file
@@ -3,27 +3,81 @@
 
 #include "error.hpp"
 #include "marco.hpp"
+#include "context.hpp"
+#include "core.hpp"
+#include "clone.hpp"
+#include "names.hpp"
+#include "log.hpp"
 
 extern "C" {
 #include "jerryscript.h"
 #include "b64.h"
 
-#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
-#endif
 }
 
+// a batch is cut short once it holds this much
+#define BATCH_MAX_BYTES 65536
+#define BATCH_MAX_MESSAGES 1024
+// or once its first message has waited this long within one turn
+#define BATCH_MAX_LATENCY_MS 16
+
 namespace ext {
   class helper {
+    struct state {
+      state() : onmessage(JERRY_UNDEFINED),
+                count(0),
+                nested_count(0),
+                oldest(0),
+                cloning(false),
+                delivering(false),
+                config{BATCH_MAX_BYTES, BATCH_MAX_MESSAGES, BATCH_MAX_LATENCY_MS},
+                stats() {};
+
+      void release() {
+        jerry_release_value(onmessage);
+      };
+
+      // what the script assigned to onmessage, kept by the accessor on the global
+      jerry_value_t onmessage;
+      // messages of the current turn, serialized in place for the host
+      clone::buffer batch;
+      // the batch being delivered, so the host may post back meanwhile
+      clone::buffer spare;
+      // messages posted by getters while a clone is being written
+      clone::buffer nested;
+      uint32_t count;
+      uint32_t nested_count;
+      double oldest;
+      bool cloning;
+      bool delivering;
+      security_worker_batch_config_t config;
+      security_worker_batch_stats_t stats;
+    };
+
   public:
     static int init();
 
+    // hands an inbound message, or the error decoding it, to onmessage
+    static int dispatch(jerry_value_t message);
+
+    // delivers the queued messages, called whenever control returns to the host
+    static void flush();
+
+    static void batch_config(const security_worker_batch_config_t *config);
+
+    static void batch_stats(security_worker_batch_stats_t *out);
+
   private:
     static JERRY_EXTERNAL_FUNC(atob);
 
     static JERRY_EXTERNAL_FUNC(btoa);
 
-    static JERRY_EXTERNAL_FUNC(post_message_bridge);
+    static JERRY_EXTERNAL_FUNC(post_message);
+
+    static JERRY_EXTERNAL_FUNC(onmessage_getter);
+
+    static JERRY_EXTERNAL_FUNC(onmessage_setter);
 
     static JERRY_EXTERNAL_FUNC($$);
   };
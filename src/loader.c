@@ -3,7 +3,7 @@
 #include <stdlib.h>
 #include <memory.h>
 #include "aes.h"
-#include "mini_gzip.h"
+#include "miniz.h"
 
 #ifdef __EMSCRIPTEN__
 #include "emscripten.h"
@@ -17,8 +17,153 @@
 #define GZIP_SIZE 0
 #define UNPACK_SIZE 0
 
+// ciphertext decrypted and inflated per step, a multiple of the AES block
+#define LOADER_CHUNK 4096
+#define LOADER_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define GZIP_HEADER_SIZE 10
+#define GZIP_TRAILER_SIZE 8
+#define GZIP_FHCRC 0x02
+#define GZIP_FEXTRA 0x04
+#define GZIP_FNAME 0x08
+#define GZIP_FCOMMENT 0x10
+
+struct loader {
+  struct AES_ctx ctx;
+  uint8_t *data;
+  size_t len;
+  // bytes of `data` already decrypted in place, always a block boundary
+  size_t decrypted;
+};
+
+static void decrypt_to(struct loader *l, size_t end) {
+  while (l->decrypted < end && l->decrypted < l->len) {
+    size_t chunk = LOADER_MIN(LOADER_CHUNK, l->len - l->decrypted);
+    AES_CBC_decrypt_buffer(&l->ctx, l->data + l->decrypted, (uint32_t) chunk);
+    l->decrypted += chunk;
+  }
+}
+
+// nibble table CRC-32 like miniz's, whose mz_ulong state breaks where long is 64 bit
+static uint32_t crc32_update(uint32_t crc, const uint8_t *p, size_t len) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+  };
+  crc = ~crc;
+  while (len--) {
+    crc = (crc >> 4) ^ table[(crc & 0xf) ^ (*p & 0xf)];
+    crc = (crc >> 4) ^ table[(crc & 0xf) ^ (*p++ >> 4)];
+  }
+  return ~crc;
+}
+
+static uint32_t read_le32(const uint8_t *p) {
+  return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+// a CBC block only depends on the ciphertext block before it, so the trailer
+// is read ahead of the stream; must run before `data` is decrypted in place
+static void read_trailer(const uint8_t *data, size_t gzip_len, uint32_t *crc, uint32_t *isize) {
+  size_t first = (gzip_len - GZIP_TRAILER_SIZE) / AES_BLOCKLEN * AES_BLOCKLEN;
+  size_t end = (gzip_len + AES_BLOCKLEN - 1) / AES_BLOCKLEN * AES_BLOCKLEN;
+  uint8_t blocks[AES_BLOCKLEN * 2];
+  memcpy(blocks, data + first, end - first);
+
+  struct AES_ctx ctx;
+  AES_init_ctx_iv(&ctx, (uint8_t *) ENKEY, first == 0 ? (uint8_t *) ENIV : (uint8_t *) data + first - AES_BLOCKLEN);
+  AES_CBC_decrypt_buffer(&ctx, blocks, (uint32_t) (end - first));
+
+  const uint8_t *trailer = blocks + (gzip_len - GZIP_TRAILER_SIZE - first);
+  *crc = read_le32(trailer);
+  *isize = read_le32(trailer + 4);
+}
+
+// returns the length of the gzip header, decrypting as far as it reaches,
+// or 0 when the payload is not a deflate gzip member
+static size_t read_header(struct loader *l, size_t gzip_len) {
+  decrypt_to(l, GZIP_HEADER_SIZE);
+  const uint8_t *p = l->data;
+  if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8) {
+    return 0;
+  }
+
+  uint8_t flags = p[3];
+  size_t pos = GZIP_HEADER_SIZE;
+  if (flags & GZIP_FEXTRA) {
+    decrypt_to(l, pos + 2);
+    pos += 2 + (p[pos] | p[pos + 1] << 8);
+  }
+  // FNAME and FCOMMENT are zero terminated
+  for (uint8_t field = GZIP_FNAME; field <= GZIP_FCOMMENT; field <<= 1) {
+    if (flags & field) {
+      do {
+        decrypt_to(l, pos + 1);
+      } while (pos < gzip_len && p[pos++] != 0);
+    }
+  }
+  if (flags & GZIP_FHCRC) {
+    pos += 2;
+  }
+  return pos < gzip_len - GZIP_TRAILER_SIZE ? pos : 0;
+}
+
+// decrypts and inflates chunk by chunk straight into a buffer sized from the
+// gzip trailer, returns it zero terminated or NULL for a corrupt payload
+static char *unpack(uint8_t *data, size_t len, size_t gzip_len) {
+  if (gzip_len < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE || gzip_len > len || len % AES_BLOCKLEN != 0) {
+    return NULL;
+  }
+
+  uint32_t crc, isize;
+  read_trailer(data, gzip_len, &crc, &isize);
+
+  struct loader l;
+  AES_init_ctx_iv(&l.ctx, (uint8_t *) ENKEY, (uint8_t *) ENIV);
+  l.data = data;
+  l.len = len;
+  l.decrypted = 0;
+
+  size_t in_pos = read_header(&l, gzip_len);
+  if (in_pos == 0) {
+    return NULL;
+  }
+
+  uint8_t *out = (uint8_t *) malloc((size_t) isize + 1);
+  if (out == NULL) {
+    return NULL;
+  }
+
+  tinfl_decompressor inflator;
+  tinfl_init(&inflator);
+  size_t deflate_end = gzip_len - GZIP_TRAILER_SIZE;
+  size_t out_pos = 0;
+  uint32_t out_crc = 0;
+  tinfl_status status;
+  do {
+    decrypt_to(&l, in_pos + LOADER_CHUNK);
+    size_t avail = LOADER_MIN(l.decrypted, deflate_end);
+    size_t in_bytes = avail - in_pos;
+    size_t out_bytes = isize - out_pos;
+    mz_uint32 flags = TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF | (avail < deflate_end ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+    status = tinfl_decompress(&inflator, data + in_pos, &in_bytes, out, out + out_pos, &out_bytes, flags);
+    out_crc = crc32_update(out_crc, out + out_pos, out_bytes);
+    in_pos += in_bytes;
+    out_pos += out_bytes;
+  } while (status == TINFL_STATUS_NEEDS_MORE_INPUT && in_pos < deflate_end);
+
+  if (status != TINFL_STATUS_DONE || out_pos != isize || out_crc != crc) {
+    free(out);
+    return NULL;
+  }
+
+  out[out_pos] = '\0';
+  return (char *) out;
+}
+
 int main() {
-  uint8_t compress_bytes[] = {};
+  // static keeps large payloads off the stack, it is decrypted in place
+  static uint8_t compress_bytes[] = {};
 #ifdef __EMSCRIPTEN__
   int unchange = emscripten_run_script_int("(function(){eval('var rEFGxb=1;')}());typeof rEFGxb=='undefined';");
   if(!unchange){
@@ -70,23 +215,15 @@ int main() {
   if(emscripten_websocket_is_supported()) {
 #endif
 
-  struct AES_ctx ctx;
-  AES_init_ctx_iv(&ctx, (uint8_t *) ENKEY, (uint8_t *) ENIV);
-  AES_CBC_decrypt_buffer(&ctx, compress_bytes, ENLEN);
-  char *tmp = (char *) malloc(GZIP_SIZE);
-  memset(tmp, 0, GZIP_SIZE);
-  memcpy(tmp, compress_bytes, GZIP_SIZE);
-
-  struct mini_gzip gz;
-  uint8_t mem_out[UNPACK_SIZE + 1];
-  memset(mem_out, '\0', UNPACK_SIZE + 1);
-  int ret = mini_gz_start(&gz, tmp, GZIP_SIZE);
-  int out_len = mini_gz_unpack(&gz, mem_out, UNPACK_SIZE);
-  free(tmp);
+  char *script = unpack(compress_bytes, ENLEN, GZIP_SIZE);
+  if (script == NULL) {
+    return 0;
+  }
 
 #ifdef __EMSCRIPTEN__
-  emscripten_run_script((char *)mem_out);
+  emscripten_run_script(script);
 #endif
+  free(script);
 
 #ifdef __EMSCRIPTEN__
   }
@@ -0,0 +1,259 @@
+#include <cstring>
+#include "log.hpp"
+
+// a record of this length sends the reader back to the start of the ring
+#define LOG_WRAP 0xffffffffu
+#define LOG_ALIGN(SIZE) (((SIZE) + 7) & ~(size_t) 7)
+
+ext::log::state::state() : ring((uint8_t *) malloc(LOG_RING_SIZE)),
+                           head(0),
+                           tail(0),
+                           used(0),
+                           seen(),
+                           tokens(),
+                           refilled(),
+                           reported(0),
+                           flushing(false),
+                           config(),
+                           stats() {
+}
+
+ext::log::state::~state() {
+  free(ring);
+}
+
+void ext::log::state::release() {
+  // lines of the last turn still reach the host
+  if (!flushing) {
+    drain(this);
+  }
+}
+
+int ext::log::init() {
+  // allocates the ring before the script runs
+  context_data<state>::get();
+  return 0;
+}
+
+void ext::log::write(security_worker_log_level_t level, const char *prefix,
+                     const jerry_value_t *args_p, jerry_length_t args_cnt) {
+  auto s = context_data<state>::get();
+  double now = emscripten_get_now();
+  if (!admit(s, level, now)) {
+    return;
+  }
+
+  jerry_length_t strs_cnt = args_cnt < LOG_MAX_ARGS ? args_cnt : LOG_MAX_ARGS;
+  jerry_value_t strs[LOG_MAX_ARGS];
+  size_t prefix_len = strlen(prefix);
+  size_t len = prefix_len;
+  for (jerry_length_t i = 0; i < strs_cnt; i++) {
+    // a throwing toString() leaves its argument empty
+    strs[i] = jerry_value_to_string(args_p[i]);
+    len += jerry_get_string_size(strs[i]) + 1;
+  }
+
+  bool truncated = len > LOG_MAX_RECORD || strs_cnt < args_cnt;
+  record *rec = reserve(s, len > LOG_MAX_RECORD ? LOG_MAX_RECORD : len);
+  if (rec != nullptr) {
+    // the strings are copied straight into the ring, cut at its end
+    auto out = (jerry_char_t *) (rec + 1);
+    size_t pos = prefix_len < rec->len ? prefix_len : rec->len;
+    memcpy(out, prefix, pos);
+    for (jerry_length_t i = 0; i < strs_cnt && pos < rec->len; i++) {
+      pos += jerry_substring_to_char_buffer(strs[i], 0, UINT32_MAX, out + pos, (jerry_size_t) (rec->len - pos));
+      if (pos < rec->len) {
+        out[pos++] = ' ';
+      }
+    }
+
+    rec->level = level;
+    rec->time = now;
+    commit(s, rec, pos);
+    s->stats.truncated += truncated;
+  }
+
+  for (jerry_length_t i = 0; i < strs_cnt; i++) {
+    jerry_release_value(strs[i]);
+  }
+}
+
+void ext::log::text(security_worker_log_level_t level, const char *data, size_t len) {
+  auto s = context_data<state>::get();
+  double now = emscripten_get_now();
+  if (!admit(s, level, now)) {
+    return;
+  }
+
+  if (len > LOG_MAX_RECORD) {
+    len = LOG_MAX_RECORD;
+    s->stats.truncated += 1;
+  }
+
+  record *rec = reserve(s, len);
+  if (rec != nullptr) {
+    memcpy(rec + 1, data, len);
+    rec->level = level;
+    rec->time = now;
+  }
+}
+
+void ext::log::flush() {
+  auto s = context_data<state>::get();
+  if (s->flushing) {
+    return;
+  }
+
+  s->flushing = true;
+  drain(s);
+  s->flushing = false;
+}
+
+void ext::log::config(const security_worker_log_config_t *config) {
+  auto s = context_data<state>::get();
+  s->config = *config;
+
+  // buckets start full
+  double now = emscripten_get_now();
+  for (int i = 0; i < SECURITY_WORKER_LOG_LEVELS; i++) {
+    double burst = s->config.levels[i].burst;
+    s->tokens[i] = burst > 1 ? burst : 1;
+    s->refilled[i] = now;
+  }
+}
+
+void ext::log::stats(security_worker_log_stats_t *out) {
+  *out = context_data<state>::get()->stats;
+}
+
+bool ext::log::admit(state *s, security_worker_log_level_t level, double now) {
+  const security_worker_log_limit_t &limit = s->config.levels[level];
+  if (limit.sample_every > 1 && s->seen[level]++ % limit.sample_every != 0) {
+    s->stats.sampled[level] += 1;
+    return false;
+  }
+
+  if (limit.rate_per_sec > 0) {
+    double burst = limit.burst > 1 ? limit.burst : 1;
+    double tokens = s->tokens[level] + (now - s->refilled[level]) * limit.rate_per_sec / 1000;
+    s->tokens[level] = tokens < burst ? tokens : burst;
+    s->refilled[level] = now;
+    if (s->tokens[level] < 1) {
+      s->stats.limited[level] += 1;
+      return false;
+    }
+    s->tokens[level] -= 1;
+  }
+
+  return true;
+}
+
+ext::log::record *ext::log::reserve(state *s, size_t len) {
+  record *rec = fit(s, len);
+  if (rec == nullptr && !s->flushing) {
+    // a full ring is handed over early rather than dropping lines
+    s->flushing = true;
+    drain(s);
+    s->flushing = false;
+    rec = fit(s, len);
+  }
+
+  if (rec == nullptr) {
+    s->stats.overflowed += 1;
+  }
+  return rec;
+}
+
+ext::log::record *ext::log::fit(state *s, size_t len) {
+  size_t size = LOG_ALIGN(sizeof(record) + len);
+  if (s->used == 0) {
+    s->head = s->tail = 0;
+  }
+
+  if (s->head < s->tail || (s->head == s->tail && s->used != 0)) {
+    if (s->tail - s->head < size) {
+      return nullptr;
+    }
+  } else if (LOG_RING_SIZE - s->head < size) {
+    if (s->tail < size) {
+      return nullptr;
+    }
+
+    ((record *) (s->ring + s->head))->len = LOG_WRAP;
+    s->used += LOG_RING_SIZE - s->head;
+    s->head = 0;
+  }
+
+  auto rec = (record *) (s->ring + s->head);
+  rec->len = (uint32_t) len;
+  s->head = (s->head + size) % LOG_RING_SIZE;
+  s->used += size;
+  return rec;
+}
+
+void ext::log::commit(state *s, record *rec, size_t len) {
+  // gives back what the line did not use, it is the newest record
+  size_t unused = LOG_ALIGN(sizeof(record) + rec->len) - LOG_ALIGN(sizeof(record) + len);
+  rec->len = (uint32_t) len;
+  s->head = ((uint8_t *) rec - s->ring) + LOG_ALIGN(sizeof(record) + len);
+  s->head %= LOG_RING_SIZE;
+  s->used -= unused;
+}
+
+void ext::log::emit(state *s, string &pending, int &pending_flags,
+                    security_worker_log_level_t level, double time, const char *data, size_t len) {
+  if (s->config.sink != nullptr) {
+    s->config.sink((security_worker_t *) ext::context::owner(), level, time, data, len, s->config.sink_data);
+    return;
+  }
+
+  // consecutive lines of the same kind go out in one call
+  int flags = level == SECURITY_WORKER_LOG_ERROR ? EM_LOG_ERROR
+                                                 : level == SECURITY_WORKER_LOG_WARN ? EM_LOG_WARN : EM_LOG_CONSOLE;
+  if (pending_flags != flags && pending.size() != 0) {
+    emscripten_log(pending_flags, "%s", pending.c_str());
+    pending.clear();
+  }
+  if (pending.size() != 0) {
+    pending << '\n';
+  }
+  pending.append(data, len);
+  pending_flags = flags;
+}
+
+void ext::log::drain(state *s) {
+  if (s->used == 0 && s->stats.overflowed == s->reported) {
+    return;
+  }
+
+  string pending;
+  int pending_flags = 0;
+  s->stats.flushes += 1;
+  while (s->used != 0) {
+    auto rec = (record *) (s->ring + s->tail);
+    if (rec->len == LOG_WRAP) {
+      s->used -= LOG_RING_SIZE - s->tail;
+      s->tail = 0;
+      continue;
+    }
+
+    // the record is held while the sink runs, lines it logs go after it
+    emit(s, pending, pending_flags, (security_worker_log_level_t) rec->level, rec->time,
+         (const char *) (rec + 1), rec->len);
+    s->stats.written[rec->level] += 1;
+    size_t size = LOG_ALIGN(sizeof(record) + rec->len);
+    s->tail = (s->tail + size) % LOG_RING_SIZE;
+    s->used -= size;
+  }
+
+  if (s->stats.overflowed != s->reported) {
+    string notice("[WARN] ");
+    notice << s->stats.overflowed - s->reported << " console lines dropped, the log ring was full while it was handed over";
+    s->reported = s->stats.overflowed;
+    emit(s, pending, pending_flags, SECURITY_WORKER_LOG_WARN, emscripten_get_now(), notice.c_str(), notice.size());
+  }
+
+  if (pending.size() != 0) {
+    emscripten_log(pending_flags, "%s", pending.c_str());
+  }
+}
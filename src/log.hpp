@@ -0,0 +1,94 @@
+#ifndef JPROTECTOR_LOG_HPP
+#define JPROTECTOR_LOG_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include "string.hpp"
+#include "marco.hpp"
+#include "context.hpp"
+#include "core.hpp"
+
+extern "C" {
+#include "jerryscript.h"
+
+#include "emscripten.h"
+};
+
+// lines logged within one turn are kept in a ring of this many bytes
+#define LOG_RING_SIZE 65536
+// a longer line is cut short
+#define LOG_MAX_RECORD 4096
+// console arguments past this many are left out of the line
+#define LOG_MAX_ARGS 32
+
+namespace ext {
+  /*
+   * Console output is written to a ring of records during a turn and
+   * handed to the host sink when the turn ends, or early once the ring is
+   * full, so logging from a loop costs a copy of the line instead of a
+   * host call. Each level may be sampled and rate limited; lines dropped
+   * that way are only counted.
+   */
+  class log {
+    struct record {
+      uint32_t len;
+      uint32_t level;
+      double time;
+    };
+
+    struct state {
+      state();
+
+      ~state();
+
+      void release();
+
+      uint8_t *ring;
+      size_t head;
+      size_t tail;
+      size_t used;
+      // lines seen and tokens left per level, for sampling and rate limits
+      uint64_t seen[SECURITY_WORKER_LOG_LEVELS];
+      double tokens[SECURITY_WORKER_LOG_LEVELS];
+      double refilled[SECURITY_WORKER_LOG_LEVELS];
+      // overflowed count when the last drop notice went out
+      uint64_t reported;
+      bool flushing;
+      security_worker_log_config_t config;
+      security_worker_log_stats_t stats;
+    };
+
+  public:
+    static int init();
+
+    // one line of the console arguments, each followed by a space
+    static void write(security_worker_log_level_t level, const char *prefix,
+                      const jerry_value_t *args_p, jerry_length_t args_cnt);
+
+    // one line of native text
+    static void text(security_worker_log_level_t level, const char *data, size_t len);
+
+    // hands the logged lines to the sink, called whenever control returns to the host
+    static void flush();
+
+    static void config(const security_worker_log_config_t *config);
+
+    static void stats(security_worker_log_stats_t *out);
+
+  private:
+    static bool admit(state *s, security_worker_log_level_t level, double now);
+
+    static record *reserve(state *s, size_t len);
+
+    static record *fit(state *s, size_t len);
+
+    static void commit(state *s, record *rec, size_t len);
+
+    static void emit(state *s, string &pending, int &pending_flags,
+                     security_worker_log_level_t level, double time, const char *data, size_t len);
+
+    static void drain(state *s);
+  };
+}
+
+#endif //JPROTECTOR_LOG_HPP
@@ -1,181 +1,382 @@
 #ifndef JPROTECTOR_MAP_HPP
 #define JPROTECTOR_MAP_HPP
 
-#include <memory>
-#include <memory.h>
-#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "string.hpp"
+
+#define MAP_EMPTY_SLOT 0xffffffffu
+#define MAP_MIN_CAPACITY 8
+
+template<typename T, typename Enable = void>
+struct map_hash;
+
+template<typename T>
+struct map_hash<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+  static uint32_t hash(const T &key) {
+    // murmur3 finalizer, ids are sequential so the low bits need mixing
+    auto h = (uint64_t) key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+  }
+};
 
-#define PAIR_PTR_SIZE(LEN) ((LEN) * sizeof(pair *))
+template<>
+struct map_hash<string> {
+  static uint32_t hash(const string &key) {
+    const char *p = key.c_str();
+    uint32_t h = 2166136261u;
+    for (size_t i = 0, len = key.size(); i < len; i++) {
+      h = (h ^ (uint8_t) p[i]) * 16777619u;
+    }
+    return h;
+  }
+};
 
+/*
+ * Insertion ordered hash map. Keys and values are stored inline in a dense
+ * array (so foreach keeps insertion order, which listener dispatch relies
+ * on) and looked up through a robin-hood probed index of dense positions.
+ * Removal leaves a hole in the dense array that is compacted away once
+ * holes make up half of it, but never while a foreach is running.
+ *
+ * Pointers returned by get() are invalidated by the next add() or remove().
+ */
 template<typename T, typename U>
 class map {
-  struct pair {
-  public:
-    pair() : key(nullptr), value(nullptr) {};
-
-    pair(const pair &p) {
-      if (this != &p) {
-        key = new T(*p.key);
-        value = new U(*p.value);
-      }
-    }
-
-    pair &operator=(const pair &p) {
-      if (this != &p) {
-        key = new T(*p.key);
-        value = new U(*p.value);
-      }
-      return *this;
-    }
-
-    ~pair() {
-      delete key;
-      delete value;
-      key = nullptr;
-      value = nullptr;
-    }
+  struct entry {
+    T key;
+    U value;
+  };
 
-    T *key;
-    U *value;
+  struct slot {
+    uint32_t hash;
+    uint32_t index;
   };
 
   typedef void (*foreach_func)(T, U, void *);
 
 public:
-  explicit map(size_t size = 10) : capacity(0), max_capacity(size) {
-    items = new pair *[size];
-    for (int i = 0; i < size; i++) {
-      items[i] = NULL;
+  explicit map(size_t size = MAP_MIN_CAPACITY) : entries(nullptr),
+                                                 live(nullptr),
+                                                 len(0),
+                                                 count(0),
+                                                 capacity(0),
+                                                 slots(nullptr),
+                                                 mask(0),
+                                                 iterating(0) {
+    // a zero sized map allocates on the first add
+    if (size != 0) {
+      reserve(size);
     }
   }
 
-  map(const map &m) {
-    if (this != &m) {
-      capacity = m.capacity;
-      max_capacity = m.max_capacity;
-      items = new pair *[capacity];
-      for (uint32_t i = 0; i < capacity; i++) {
-        items[i] = new pair(*m.items[i]);
+  map(const map &m) : map(m.count) {
+    for (uint32_t i = 0; i < m.len; i++) {
+      if (m.live[i]) {
+        add(m.entries[i].key, m.entries[i].value);
       }
     }
   }
 
+  map(map &&m) noexcept : entries(m.entries),
+                          live(m.live),
+                          len(m.len),
+                          count(m.count),
+                          capacity(m.capacity),
+                          slots(m.slots),
+                          mask(m.mask),
+                          iterating(0) {
+    m.entries = nullptr;
+    m.live = nullptr;
+    m.slots = nullptr;
+    m.len = m.count = m.capacity = m.mask = 0;
+  }
+
   map &operator=(const map &m) {
     if (this != &m) {
-      capacity = m.capacity;
-      max_capacity = m.max_capacity;
-      items = new pair *[capacity];
-      for (uint32_t i = 0; i < capacity; i++) {
-        items[i] = new pair(*m.items[i]);
-      }
+      map copy(m);
+      swap(copy);
     }
     return *this;
   }
 
-  ~map() {
-    for (uint32_t i = 0; i < capacity; i++) {
-      delete items[i];
-      items[i] = nullptr;
+  map &operator=(map &&m) noexcept {
+    if (this != &m) {
+      swap(m);
     }
-    delete items;
-    items = nullptr;
+    return *this;
+  }
+
+  ~map() {
+    clear();
+    free(entries);
+    free(live);
+    free(slots);
+  }
+
+  uint32_t add(const T &key, const U &value) {
+    return emplace(T(key), U(value));
   }
 
-  uint32_t add(const T &key, const U &value);
+  uint32_t add(T &&key, U &&value) {
+    return emplace(std::move(key), std::move(value));
+  }
 
   int32_t remove(const T &key);
 
-  U *get(const T &key);
+  U *get(const T &key) {
+    int32_t index = find(key);
+    return index == -1 ? nullptr : &entries[index].value;
+  }
 
-  int32_t find(const T &key);
+  int32_t find(const T &key) {
+    uint32_t pos = lookup(key, map_hash<T>::hash(key));
+    return pos == MAP_EMPTY_SLOT ? -1 : (int32_t) slots[pos].index;
+  }
 
   void foreach(foreach_func, void *);
 
   size_t size() {
-    return capacity;
+    return count;
   }
 
   size_t max_size() {
-    return max_capacity;
+    return capacity;
   }
 
 private:
-  pair **items;
-  size_t capacity;
-  size_t max_capacity;
+  uint32_t emplace(T &&key, U &&value);
+
+  uint32_t lookup(const T &key, uint32_t hash);
+
+  void insert_slot(uint32_t hash, uint32_t index);
+
+  void erase_slot(uint32_t pos);
+
+  void reserve(size_t size);
+
+  void rehash();
+
+  void compact();
+
+  void clear();
+
+  void swap(map &m) {
+    std::swap(entries, m.entries);
+    std::swap(live, m.live);
+    std::swap(len, m.len);
+    std::swap(count, m.count);
+    std::swap(capacity, m.capacity);
+    std::swap(slots, m.slots);
+    std::swap(mask, m.mask);
+  }
+
+  uint32_t distance(uint32_t pos, uint32_t hash) {
+    return (pos - (hash & mask)) & mask;
+  }
+
+  entry *entries;
+  bool *live;
+  uint32_t len;
+  uint32_t count;
+  uint32_t capacity;
+  slot *slots;
+  uint32_t mask;
+  uint32_t iterating;
 };
 
 template<typename T, typename U>
-uint32_t map<T, U>::add(const T &key, const U &value) {
-  int32_t index = this->find(key);
-  pair *p = new pair();
-  p->key = new T(key);
-  p->value = new U(value);
-  if (index == -1) {
-    if (max_capacity <= capacity) {
-      max_capacity *= 2;
-      auto s = new pair *[max_capacity];
-      memset(s, NULL, PAIR_PTR_SIZE(max_capacity));
-      memcpy(s, items, PAIR_PTR_SIZE(capacity));
-      delete items;
-      items = s;
-    }
-    items[capacity++] = p;
-    return (uint32_t) (capacity - 1);
-  }
-
-  return (uint32_t) index;
+uint32_t map<T, U>::emplace(T &&key, U &&value) {
+  uint32_t hash = map_hash<T>::hash(key);
+  uint32_t pos = lookup(key, hash);
+  if (pos != MAP_EMPTY_SLOT) {
+    return slots[pos].index;
+  }
+
+  if (len == capacity) {
+    if (len != 0 && iterating == 0 && count <= len / 2) {
+      compact();
+    } else {
+      reserve(capacity * 2);
+    }
+  }
+
+  uint32_t index = len++;
+  new(&entries[index]) entry{std::move(key), std::move(value)};
+  live[index] = true;
+  count += 1;
+  insert_slot(hash, index);
+  return index;
 }
 
 template<typename T, typename U>
-inline int32_t map<T, U>::remove(const T &key) {
-  int32_t index = this->find(key);
-  if (index == -1) {
+int32_t map<T, U>::remove(const T &key) {
+  uint32_t pos = lookup(key, map_hash<T>::hash(key));
+  if (pos == MAP_EMPTY_SLOT) {
     return -1;
   }
 
-  delete items[index];
-  items[index] = nullptr;
+  uint32_t index = slots[pos].index;
+  erase_slot(pos);
+  entries[index].~entry();
+  live[index] = false;
+  count -= 1;
 
-  memcpy(items + index, items + index + 1, PAIR_PTR_SIZE(capacity - (index + 1)));
-  items[capacity--] = NULL;
-  return index;
+  if (index == len - 1) {
+    len -= 1;
+  } else if (iterating == 0 && len >= MAP_MIN_CAPACITY && count <= len / 2) {
+    compact();
+  }
+  return (int32_t) index;
+}
+
+template<typename T, typename U>
+uint32_t map<T, U>::lookup(const T &key, uint32_t hash) {
+  if (count == 0) {
+    return MAP_EMPTY_SLOT;
+  }
+
+  uint32_t pos = hash & mask;
+  for (uint32_t dist = 0;; dist++) {
+    const slot &s = slots[pos];
+    if (s.index == MAP_EMPTY_SLOT || distance(pos, s.hash) < dist) {
+      return MAP_EMPTY_SLOT;
+    }
+    if (s.hash == hash && entries[s.index].key == key) {
+      return pos;
+    }
+    pos = (pos + 1) & mask;
+  }
+}
+
+template<typename T, typename U>
+void map<T, U>::insert_slot(uint32_t hash, uint32_t index) {
+  slot cur{hash, index};
+  uint32_t pos = hash & mask;
+  for (uint32_t dist = 0;; dist++) {
+    slot &s = slots[pos];
+    if (s.index == MAP_EMPTY_SLOT) {
+      s = cur;
+      return;
+    }
+
+    // robin hood: the entry closer to its home slot moves on
+    uint32_t existing = distance(pos, s.hash);
+    if (existing < dist) {
+      std::swap(cur, s);
+      dist = existing;
+    }
+    pos = (pos + 1) & mask;
+  }
 }
 
 template<typename T, typename U>
-inline U *map<T, U>::get(const T &key) {
-  int32_t index = this->find(key);
-  if (index > -1) {
-    return items[index]->value;
+void map<T, U>::erase_slot(uint32_t pos) {
+  // backward shift instead of tombstones keeps probe chains short
+  uint32_t next = (pos + 1) & mask;
+  while (slots[next].index != MAP_EMPTY_SLOT && distance(next, slots[next].hash) != 0) {
+    slots[pos] = slots[next];
+    pos = next;
+    next = (next + 1) & mask;
   }
+  slots[pos].index = MAP_EMPTY_SLOT;
+}
 
-  return nullptr;
+template<typename T, typename U>
+void map<T, U>::reserve(size_t size) {
+  if (size < MAP_MIN_CAPACITY) {
+    size = MAP_MIN_CAPACITY;
+  }
+  if (size <= capacity) {
+    return;
+  }
+
+  auto grown = (entry *) malloc(size * sizeof(entry));
+  for (uint32_t i = 0; i < len; i++) {
+    if (live[i]) {
+      new(&grown[i]) entry{std::move(entries[i].key), std::move(entries[i].value)};
+      entries[i].~entry();
+    }
+  }
+  free(entries);
+  entries = grown;
+  live = (bool *) realloc(live, size * sizeof(bool));
+  capacity = (uint32_t) size;
+  rehash();
 }
 
 template<typename T, typename U>
-inline int32_t map<T, U>::find(const T &key) {
-  for (uint32_t i = 0; i < capacity; i++) {
-    pair *item = items[i];
-    if (item == NULL) {
-      break;
+void map<T, U>::rehash() {
+  // keep the index at most half full
+  uint32_t slots_len = MAP_MIN_CAPACITY * 2;
+  while (slots_len < capacity * 2) {
+    slots_len *= 2;
+  }
+
+  free(slots);
+  slots = (slot *) malloc(slots_len * sizeof(slot));
+  mask = slots_len - 1;
+  for (uint32_t i = 0; i < slots_len; i++) {
+    slots[i].index = MAP_EMPTY_SLOT;
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    if (live[i]) {
+      insert_slot(map_hash<T>::hash(entries[i].key), i);
     }
+  }
+}
 
-    if (*item->key == key) {
-      return i;
+template<typename T, typename U>
+void map<T, U>::compact() {
+  uint32_t to = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    if (!live[i]) {
+      continue;
+    }
+    if (i != to) {
+      new(&entries[to]) entry{std::move(entries[i].key), std::move(entries[i].value)};
+      entries[i].~entry();
+      live[to] = true;
+      live[i] = false;
     }
+    to += 1;
   }
+  len = to;
+  rehash();
+}
 
-  return -1;
+template<typename T, typename U>
+void map<T, U>::clear() {
+  for (uint32_t i = 0; i < len; i++) {
+    if (live[i]) {
+      entries[i].~entry();
+      live[i] = false;
+    }
+  }
+  for (uint32_t i = 0; slots != nullptr && i <= mask; i++) {
+    slots[i].index = MAP_EMPTY_SLOT;
+  }
+  len = count = 0;
 }
 
 template<typename T, typename U>
-inline void map<T, U>::foreach(foreach_func func, void *userData) {
-  for (uint32_t i = 0; i < capacity; i++) {
-    pair *item = items[i];
-    if (item != NULL) {
-      func(*(item->key), *(item->value), userData);
+void map<T, U>::foreach(foreach_func func, void *userData) {
+  // entries added by `func` are visited too, removed ones are skipped
+  iterating += 1;
+  for (uint32_t i = 0; i < len; i++) {
+    if (live[i]) {
+      func(entries[i].key, entries[i].value, userData);
     }
   }
+  iterating -= 1;
 }
 
 
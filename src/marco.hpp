@@ -2,6 +2,7 @@
 #define JPROTECTOR_MARCO_HPP
 
 #include "memory.h"
+#include "scratch.hpp"
 
 extern "C" {
 #include "jerryscript.h"
@@ -37,14 +38,23 @@ VALUE_TYPE PROP_NAME##_value = jerry_get_##PROP_TYPE##_value(PROP_NAME##_prop_va
 jerry_release_value(PROP_NAME##_prop_value); \
 jerry_release_value(PROP_NAME##_prop_name);
 
+// CHARS is a zero terminated copy, in scratch space until the scope ends
 #define JERRY_CONV_STR_TO_CHAR_BUFFER(STR_PROP_NAME, LEN_PROP_NAME, CHARS, ARGS_PTR) \
 jerry_value_t STR_PROP_NAME = jerry_value_to_string(*(ARGS_PTR)); \
 jerry_length_t LEN_PROP_NAME = jerry_get_string_size(STR_PROP_NAME); \
-jerry_char_t CHARS[LEN_PROP_NAME + 1]; \
-memset(CHARS, 0, LEN_PROP_NAME + 1); \
+ext::scratch::buffer CHARS##_scratch(LEN_PROP_NAME + 1); \
+jerry_char_t *CHARS = CHARS##_scratch.data; \
 jerry_string_to_char_buffer(STR_PROP_NAME, CHARS, LEN_PROP_NAME); \
+CHARS[LEN_PROP_NAME] = '\0'; \
 jerry_release_value(STR_PROP_NAME);
 
+// same, read in place where possible: CHARS is not zero terminated and
+// only valid until the scope ends
+#define JERRY_VIEW_STR_CHARS(STR_PROP_NAME, LEN_PROP_NAME, CHARS, ARGS_PTR) \
+ext::scratch::view STR_PROP_NAME(*(ARGS_PTR)); \
+jerry_length_t LEN_PROP_NAME = STR_PROP_NAME.size; \
+const jerry_char_t *CHARS = STR_PROP_NAME.data;
+
 #define JERRY_SAFE_GET_OBJ_KEY_BLOCK(VALUE, PROP_NAME) \
 jerry_value_t PROP_NAME##_key = jerry_create_string((const jerry_char_t *) #PROP_NAME); \
 jerry_value_t PROP_NAME##_prop = jerry_get_property(VALUE, PROP_NAME##_key);
@@ -0,0 +1,88 @@
+#include <cstring>
+#include "names.hpp"
+
+#define NAMES_STRING(NAME) #NAME,
+
+static const char *const name_strings[ext::NAME_COUNT] = {
+  NAMES_LIST(NAMES_STRING)
+};
+
+ext::names::state::state() {
+  for (uint32_t i = 0; i < NAME_COUNT; i++) {
+    values[i] = JERRY_STRING(name_strings[i]);
+  }
+}
+
+void ext::names::state::release() {
+  for (uint32_t i = 0; i < NAME_COUNT; i++) {
+    jerry_release_value(values[i]);
+  }
+}
+
+int ext::names::init() {
+  context_data<state>::get();
+  return 0;
+}
+
+#define NAMES_MAGIC(NAME) #NAME,
+
+static const char *const magic_strings[] = {
+  NAMES_LIST(NAMES_MAGIC)
+  MAGIC_LIST(NAMES_MAGIC)
+};
+
+static const uint32_t magic_count = sizeof(magic_strings) / sizeof(magic_strings[0]);
+
+// the engine wants them sorted by length, then bytewise
+struct magic_table {
+  magic_table() {
+    for (uint32_t i = 0; i < magic_count; i++) {
+      auto item = (const jerry_char_t *) magic_strings[i];
+      auto length = (jerry_length_t) strlen(magic_strings[i]);
+      uint32_t j = i;
+      for (; j > 0 && (lengths[j - 1] > length ||
+                       (lengths[j - 1] == length && memcmp(items[j - 1], item, length) > 0)); j--) {
+        items[j] = items[j - 1];
+        lengths[j] = lengths[j - 1];
+      }
+      items[j] = item;
+      lengths[j] = length;
+    }
+  }
+
+  const jerry_char_t *items[magic_count];
+  jerry_length_t lengths[magic_count];
+};
+
+void ext::names::register_magic() {
+  // shared by every context, built by whichever worker starts first
+  static const magic_table table;
+  jerry_register_magic_strings(table.items, magic_count, table.lengths);
+}
+
+void ext::names::install(jerry_value_t obj, const binding *table, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    jerry_value_t name = JERRY_STRING(table[i].name);
+    jerry_value_t retval;
+    if (table[i].flags & BINDING_ACCESSOR) {
+      jerry_property_descriptor_t desc;
+      jerry_init_property_descriptor_fields(&desc);
+      desc.is_enumerable_defined = true;
+      desc.is_enumerable = !(table[i].flags & BINDING_HIDDEN);
+      desc.is_configurable_defined = true;
+      desc.is_configurable = !(table[i].flags & BINDING_FIXED);
+      desc.is_get_defined = true;
+      desc.getter = jerry_create_external_function(table[i].handler);
+      desc.is_set_defined = table[i].setter != nullptr;
+      desc.setter = table[i].setter != nullptr ? jerry_create_external_function(table[i].setter) : JERRY_UNDEFINED;
+      retval = jerry_define_own_property(obj, name, &desc);
+      jerry_free_property_descriptor_fields(&desc);
+    } else {
+      jerry_value_t func = jerry_create_external_function(table[i].handler);
+      retval = jerry_set_property(obj, name, func);
+      jerry_release_value(func);
+    }
+    jerry_release_value(retval);
+    jerry_release_value(name);
+  }
+}
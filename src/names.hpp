@@ -0,0 +1,147 @@
+#ifndef JPROTECTOR_NAMES_HPP
+#define JPROTECTOR_NAMES_HPP
+
+#include <cstddef>
+#include "marco.hpp"
+#include "context.hpp"
+
+extern "C" {
+#include "jerryscript.h"
+};
+
+// property names the bindings read or write per call rather than once at init
+#define NAMES_LIST(X) \
+X(onmessage) \
+X(message) \
+X(name) \
+X(stack) \
+X(status) \
+X(statusText) \
+X(totalBytes) \
+X(text) \
+X(response) \
+X(id) \
+X(url) \
+X(protocol)
+
+// the other names bindings install or read, registered with NAMES_LIST as
+// engine magic strings so creating any of them allocates nothing
+#define MAGIC_LIST(X) \
+X(setTimeout) \
+X(setInterval) \
+X(clearTimeout) \
+X(clearInterval) \
+X(btoa) \
+X(atob) \
+X(postMessage) \
+X($$) \
+X(self) \
+X(console) \
+X(performance) \
+X(debug) \
+X(warn) \
+X(info) \
+X(error) \
+X(time) \
+X(timeEnd) \
+X(timeLog) \
+X(timeSummary) \
+X(count) \
+X(countReset) \
+X(request) \
+X(uri) \
+X(method) \
+X(body) \
+X(headers) \
+X(timeout) \
+X(responseType) \
+X(withCredentials) \
+X(success) \
+X(onchunk) \
+X(pause) \
+X(resume) \
+X(abort) \
+X(WebSocket) \
+X(addEventListener) \
+X(removeEventListener) \
+X(close) \
+X(send) \
+X(bufferedAmount) \
+X(highWaterMark) \
+X(stackTraceLimit)
+
+#define NAMES_ENUM(NAME) NAME_##NAME,
+
+// like JERRY_PROPERTY_BLOCK, with the name taken from the table
+#define JERRY_NAMED_PROPERTY_BLOCK(OBJ, PROP_NAME) \
+jerry_value_t PROP_NAME##_prop = jerry_get_property(OBJ, ext::names::get(ext::NAME_##PROP_NAME));
+
+#define JERRY_NAMED_PROPERTY_BLOCK_END(PROP_NAME) \
+jerry_release_value(PROP_NAME##_prop);
+
+#define JERRY_SET_NAMED_PROPERTY(OBJ, PROP_NAME, PROP_VAL) \
+jerry_release_value(jerry_set_property(OBJ, ext::names::get(ext::NAME_##PROP_NAME), PROP_VAL));
+
+namespace ext {
+  typedef enum {
+    NAMES_LIST(NAMES_ENUM)
+    NAME_COUNT
+  } name_t;
+
+  typedef enum {
+    // a function in a data property, like an assignment makes
+    BINDING_METHOD = 0,
+    // a getter, and the setter if there is one, instead
+    BINDING_ACCESSOR = 1 << 0,
+    // not configurable
+    BINDING_FIXED = 1 << 1,
+    // accessors only, not enumerable
+    BINDING_HIDDEN = 1 << 2,
+  } binding_flags_t;
+
+  // one entry of the tables the modules install at init
+  struct binding {
+    const char *name;
+    jerry_external_handler_t handler;
+    jerry_external_handler_t setter;
+    uint32_t flags;
+  };
+
+  /*
+   * Strings for the names in NAMES_LIST, created once per context so the
+   * hot paths do not build and free a string for every property access.
+   * Modules describe their globals and prototypes as binding tables, which
+   * install() puts in place in one pass over names the engine already knows.
+   */
+  class names {
+    struct state {
+      state();
+
+      void release();
+
+      jerry_value_t values[NAME_COUNT];
+    };
+
+  public:
+    static int init();
+
+    // right after jerry_init, before any of the names is created
+    static void register_magic();
+
+    // puts every binding of a table on `obj`
+    static void install(jerry_value_t obj, const binding *table, size_t count);
+
+    template<size_t N>
+    static void install(jerry_value_t obj, const binding (&table)[N]) {
+      install(obj, table, N);
+    }
+
+    // borrowed, valid for the lifetime of the context
+    static jerry_value_t get(name_t name) {
+      return context_data<state>::get()->values[name];
+    }
+  };
+}
+
+
+#endif //JPROTECTOR_NAMES_HPP
@@ -0,0 +1,100 @@
+#ifndef JPROTECTOR_BUFFER_HPP
+#define JPROTECTOR_BUFFER_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace ext {
+  // growable byte buffer used for socket I/O, consumed from the front
+  class buffer {
+  public:
+    buffer() : ptr(nullptr), len(0), cap(0), pos(0) {};
+
+    ~buffer() {
+      free(ptr);
+      ptr = nullptr;
+    }
+
+    void append(const void *data, size_t size) {
+      reserve(size);
+      memcpy(ptr + len, data, size);
+      len += size;
+    }
+
+    void append(const char *c_str) {
+      append(c_str, strlen(c_str));
+    }
+
+    // grow by `size` bytes and return them, for callers that fill in place
+    uint8_t *extend(size_t size) {
+      reserve(size);
+      len += size;
+      return ptr + len - size;
+    }
+
+    // drop `size` bytes from the front
+    void consume(size_t size) {
+      pos += size;
+      if (pos >= len) {
+        pos = len = 0;
+      }
+    }
+
+    // hand the underlying allocation to the caller, NUL terminated
+    char *release() {
+      reserve(1);
+      if (pos) {
+        memmove(ptr, ptr + pos, len - pos);
+        len -= pos;
+        pos = 0;
+      }
+      ptr[len] = '\0';
+      char *p = (char *) ptr;
+      ptr = nullptr;
+      len = cap = 0;
+      return p;
+    }
+
+    uint8_t *data() {
+      return ptr + pos;
+    }
+
+    size_t size() {
+      return len - pos;
+    }
+
+  private:
+    // make room for `extra` more bytes at the end
+    void reserve(size_t extra) {
+      if (len + extra <= cap) {
+        return;
+      }
+      if (pos) {
+        memmove(ptr, ptr + pos, len - pos);
+        len -= pos;
+        pos = 0;
+        if (len + extra <= cap) {
+          return;
+        }
+      }
+      size_t c = cap ? cap : 256;
+      while (c < len + extra) {
+        c *= 2;
+      }
+      ptr = (uint8_t *) realloc(ptr, c);
+      cap = c;
+    }
+
+    buffer(const buffer &);
+
+    buffer &operator=(const buffer &);
+
+    uint8_t *ptr;
+    size_t len;
+    size_t cap;
+    size_t pos;
+  };
+}
+
+#endif //JPROTECTOR_BUFFER_HPP
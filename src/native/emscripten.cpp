@@ -0,0 +1,23 @@
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include "emscripten.h"
+#include "loop.hpp"
+
+void emscripten_async_call(em_arg_callback_func func, void *arg, int millis) {
+  ext::loop::set_timer(millis, func, arg);
+}
+
+void emscripten_log(int flags, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+double emscripten_get_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1000.0 + (double) ts.tv_nsec / 1e6;
+}
@@ -0,0 +1,45 @@
+#ifndef JPROTECTOR_NATIVE_EMSCRIPTEN_H
+#define JPROTECTOR_NATIVE_EMSCRIPTEN_H
+
+/*
+ * Native (Linux) implementation of the part of the emscripten host API the
+ * bindings use, so ext:: runs the same code paths outside the browser.
+ * Only on the include path of non-emscripten builds.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int EM_BOOL;
+#define EM_TRUE 1
+#define EM_FALSE 0
+
+typedef int EMSCRIPTEN_RESULT;
+#define EMSCRIPTEN_RESULT_SUCCESS 0
+#define EMSCRIPTEN_RESULT_NOT_SUPPORTED (-1)
+#define EMSCRIPTEN_RESULT_INVALID_TARGET (-3)
+#define EMSCRIPTEN_RESULT_INVALID_PARAM (-5)
+#define EMSCRIPTEN_RESULT_FAILED (-6)
+
+#define EM_LOG_CONSOLE 1
+#define EM_LOG_WARN 2
+#define EM_LOG_ERROR 4
+
+typedef void (*em_arg_callback_func)(void *);
+
+void emscripten_async_call(em_arg_callback_func func, void *arg, int millis);
+
+void emscripten_log(int flags, const char *format, ...);
+
+// milliseconds from a monotonic clock, with sub-millisecond precision
+double emscripten_get_now(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //JPROTECTOR_NATIVE_EMSCRIPTEN_H
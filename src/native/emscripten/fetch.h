@@ -0,0 +1,82 @@
+#ifndef JPROTECTOR_NATIVE_EMSCRIPTEN_FETCH_H
+#define JPROTECTOR_NATIVE_EMSCRIPTEN_FETCH_H
+
+/*
+ * emscripten_fetch over plain HTTP/1.1 sockets driven by ext::loop.
+ * Only `http://` URLs are supported, TLS is left to a proxy in front.
+ * With EMSCRIPTEN_FETCH_STREAM_DATA the body is handed to onprogress as it
+ * arrives (data, numBytes, dataOffset) and is not kept.
+ */
+
+#include "../emscripten.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EMSCRIPTEN_FETCH_LOAD_TO_MEMORY 1
+#define EMSCRIPTEN_FETCH_STREAM_DATA 2
+#define EMSCRIPTEN_FETCH_PERSIST_FILE 4
+#define EMSCRIPTEN_FETCH_APPEND 8
+#define EMSCRIPTEN_FETCH_REPLACE 16
+#define EMSCRIPTEN_FETCH_NO_DOWNLOAD 32
+#define EMSCRIPTEN_FETCH_SYNCHRONOUS 64
+#define EMSCRIPTEN_FETCH_WAITABLE 128
+
+struct emscripten_fetch_t;
+
+typedef struct emscripten_fetch_attr_t {
+  char requestMethod[32];
+  void *userData;
+  void (*onsuccess)(struct emscripten_fetch_t *fetch);
+  void (*onerror)(struct emscripten_fetch_t *fetch);
+  void (*onprogress)(struct emscripten_fetch_t *fetch);
+  void (*onreadystatechange)(struct emscripten_fetch_t *fetch);
+  uint32_t attributes;
+  unsigned long timeoutMSecs;
+  EM_BOOL withCredentials;
+  const char *destinationPath;
+  const char *userName;
+  const char *password;
+  const char *const *requestHeaders;
+  const char *overriddenMimeType;
+  const char *requestData;
+  size_t requestDataSize;
+} emscripten_fetch_attr_t;
+
+typedef struct emscripten_fetch_t {
+  unsigned int id;
+  void *userData;
+  const char *url;
+  const char *data;
+  uint64_t numBytes;
+  uint64_t dataOffset;
+  uint64_t totalBytes;
+  unsigned short readyState;
+  unsigned short status;
+  char statusText[64];
+  uint32_t __proxyState;
+  emscripten_fetch_attr_t __attributes;
+} emscripten_fetch_t;
+
+void emscripten_fetch_attr_init(emscripten_fetch_attr_t *fetch_attr);
+
+emscripten_fetch_t *emscripten_fetch(emscripten_fetch_attr_t *fetch_attr, const char *url);
+
+// the response header lines once they arrived; the copy is cut to dstSizeBytes
+// and NUL terminated, the terminator is counted in the return value
+size_t emscripten_fetch_get_response_headers_length(emscripten_fetch_t *fetch);
+
+size_t emscripten_fetch_get_response_headers(emscripten_fetch_t *fetch, char *dst, size_t dstSizeBytes);
+
+EMSCRIPTEN_RESULT emscripten_fetch_close(emscripten_fetch_t *fetch);
+
+// not in emscripten: holds back reading the response of a streamed fetch,
+// the browser has no way to do that
+void native_fetch_pause(emscripten_fetch_t *fetch, EM_BOOL paused);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //JPROTECTOR_NATIVE_EMSCRIPTEN_FETCH_H
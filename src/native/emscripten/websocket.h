@@ -0,0 +1,100 @@
+#ifndef JPROTECTOR_NATIVE_EMSCRIPTEN_WEBSOCKET_H
+#define JPROTECTOR_NATIVE_EMSCRIPTEN_WEBSOCKET_H
+
+/*
+ * RFC 6455 client over plain sockets driven by ext::loop.
+ * Only `ws://` URLs are supported, TLS is left to a proxy in front.
+ */
+
+#include "../emscripten.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int EMSCRIPTEN_WEBSOCKET_T;
+
+#define EMSCRIPTEN_EVENT_WEB_SOCKET_OPEN 0
+#define EMSCRIPTEN_EVENT_WEB_SOCKET_MESSAGE 1
+#define EMSCRIPTEN_EVENT_WEB_SOCKET_ERROR 2
+#define EMSCRIPTEN_EVENT_WEB_SOCKET_CLOSE 3
+
+typedef struct EmscriptenWebSocketOpenEvent {
+  EMSCRIPTEN_WEBSOCKET_T socket;
+} EmscriptenWebSocketOpenEvent;
+
+typedef struct EmscriptenWebSocketMessageEvent {
+  EMSCRIPTEN_WEBSOCKET_T socket;
+  uint8_t *data;
+  uint32_t numBytes;
+  EM_BOOL isText;
+} EmscriptenWebSocketMessageEvent;
+
+typedef struct EmscriptenWebSocketErrorEvent {
+  EMSCRIPTEN_WEBSOCKET_T socket;
+} EmscriptenWebSocketErrorEvent;
+
+typedef struct EmscriptenWebSocketCloseEvent {
+  EMSCRIPTEN_WEBSOCKET_T socket;
+  EM_BOOL wasClean;
+  unsigned short code;
+  char reason[512];
+} EmscriptenWebSocketCloseEvent;
+
+typedef EM_BOOL (*em_websocket_open_callback_func)(int eventType, const EmscriptenWebSocketOpenEvent *e,
+                                                   void *userData);
+
+typedef EM_BOOL (*em_websocket_message_callback_func)(int eventType, const EmscriptenWebSocketMessageEvent *e,
+                                                      void *userData);
+
+typedef EM_BOOL (*em_websocket_error_callback_func)(int eventType, const EmscriptenWebSocketErrorEvent *e,
+                                                    void *userData);
+
+typedef EM_BOOL (*em_websocket_close_callback_func)(int eventType, const EmscriptenWebSocketCloseEvent *e,
+                                                    void *userData);
+
+typedef struct EmscriptenWebSocketCreateAttributes {
+  const char *url;
+  const char *protocols;
+  EM_BOOL createOnMainThread;
+} EmscriptenWebSocketCreateAttributes;
+
+void emscripten_websocket_init_create_attributes(EmscriptenWebSocketCreateAttributes *attributes);
+
+EM_BOOL emscripten_websocket_is_supported(void);
+
+EMSCRIPTEN_WEBSOCKET_T emscripten_websocket_new(EmscriptenWebSocketCreateAttributes *attributes);
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onopen_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                           em_websocket_open_callback_func callback);
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onmessage_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                              em_websocket_message_callback_func callback);
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onerror_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                            em_websocket_error_callback_func callback);
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onclose_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                            em_websocket_close_callback_func callback);
+
+EMSCRIPTEN_RESULT emscripten_websocket_send_utf8_text(EMSCRIPTEN_WEBSOCKET_T socket, const char *textData);
+
+EMSCRIPTEN_RESULT emscripten_websocket_send_binary(EMSCRIPTEN_WEBSOCKET_T socket, void *binaryData,
+                                                   uint32_t dataLength);
+
+// not in emscripten: sends `dataLength` bytes as one text frame, NULs
+// included, where the browser call stops at the first NUL
+EMSCRIPTEN_RESULT native_websocket_send_utf8_text(EMSCRIPTEN_WEBSOCKET_T socket, const char *textData,
+                                                  uint32_t dataLength);
+
+EMSCRIPTEN_RESULT emscripten_websocket_get_buffered_amount(EMSCRIPTEN_WEBSOCKET_T socket, size_t *bufferedAmount);
+
+EMSCRIPTEN_RESULT emscripten_websocket_close(EMSCRIPTEN_WEBSOCKET_T socket, unsigned short code, const char *reason);
+
+EMSCRIPTEN_RESULT emscripten_websocket_delete(EMSCRIPTEN_WEBSOCKET_T socket);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //JPROTECTOR_NATIVE_EMSCRIPTEN_WEBSOCKET_H
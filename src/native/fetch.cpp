@@ -0,0 +1,403 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <unistd.h>
+#include "emscripten/fetch.h"
+#include "buffer.hpp"
+#include "loop.hpp"
+#include "net.hpp"
+
+#define FETCH_READ_SIZE 16384
+
+struct native_fetch {
+  emscripten_fetch_t fetch; // handed out to the caller, must stay first
+  int fd;
+  ext::loop::watcher *io;
+  ext::loop::watcher *timer;
+  ext::buffer out;
+  ext::buffer in;
+  ext::buffer body;
+  // response header lines, without the status line
+  char *headers;
+  size_t header_len;
+  int64_t content_length;
+  // body bytes handed to onprogress, EMSCRIPTEN_FETCH_STREAM_DATA only
+  uint64_t streamed;
+  bool chunked;
+  bool done;
+  bool paused;
+  // inside onprogress, a close then waits until it returns
+  bool calling;
+  bool closed;
+};
+
+static thread_local unsigned int fetch_id = 0;
+
+static void fetch_finish(native_fetch *nf, bool ok);
+
+static void fetch_io_handler(int fd, uint32_t events, void *user_data);
+
+static bool fetch_streaming(native_fetch *nf) {
+  return (nf->fetch.__attributes.attributes & EMSCRIPTEN_FETCH_STREAM_DATA) && nf->fetch.__attributes.onprogress;
+}
+
+static void fetch_free(native_fetch *nf) {
+  free((void *) nf->fetch.url);
+  free((void *) nf->fetch.data);
+  free(nf->headers);
+  delete nf;
+}
+
+// a paused stream stops reading, the request itself is still sent
+static void fetch_rewatch(native_fetch *nf) {
+  uint32_t events = (nf->out.size() ? EPOLLOUT : 0) | (nf->paused ? 0 : EPOLLIN);
+  if (events == 0) {
+    ext::loop::unwatch(nf->io);
+    nf->io = nullptr;
+  } else if (nf->io == nullptr) {
+    nf->io = ext::loop::watch(nf->fd, events, fetch_io_handler, nf);
+  } else {
+    ext::loop::modify(nf->io, events);
+  }
+}
+
+static void fetch_fail_handler(void *user_data) {
+  auto nf = (native_fetch *) user_data;
+  nf->timer = nullptr;
+  fetch_finish(nf, false);
+}
+
+static void fetch_timeout_handler(void *user_data) {
+  auto nf = (native_fetch *) user_data;
+  nf->timer = nullptr;
+  snprintf(nf->fetch.statusText, sizeof(nf->fetch.statusText), "Timeout");
+  fetch_finish(nf, false);
+}
+
+static bool header_is(const char *line, size_t len, const char *name) {
+  size_t n = strlen(name);
+  return len > n && line[n] == ':' && strncasecmp(line, name, n) == 0;
+}
+
+static void fetch_parse_headers(native_fetch *nf, const char *head, size_t len) {
+  const char *end = head + len;
+  const char *eol = (const char *) memmem(head, len, "\r\n", 2);
+  if (eol == nullptr) {
+    eol = end;
+  }
+
+  // status line: HTTP/1.1 200 OK
+  const char *sp = (const char *) memchr(head, ' ', (size_t) (eol - head));
+  if (sp != nullptr) {
+    nf->fetch.status = (unsigned short) strtoul(sp + 1, nullptr, 10);
+    const char *text = (const char *) memchr(sp + 1, ' ', (size_t) (eol - sp - 1));
+    if (text != nullptr) {
+      size_t text_len = (size_t) (eol - text - 1);
+      if (text_len >= sizeof(nf->fetch.statusText)) {
+        text_len = sizeof(nf->fetch.statusText) - 1;
+      }
+      memcpy(nf->fetch.statusText, text + 1, text_len);
+      nf->fetch.statusText[text_len] = '\0';
+    }
+  }
+
+  nf->content_length = -1;
+  nf->headers = eol + 2 < end ? strndup(eol + 2, (size_t) (end - eol - 2)) : strdup("");
+  for (const char *line = eol + 2; line < end; line = eol + 2) {
+    eol = (const char *) memmem(line, (size_t) (end - line), "\r\n", 2);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    auto line_len = (size_t) (eol - line);
+    if (header_is(line, line_len, "Content-Length")) {
+      nf->content_length = strtoll(line + 15, nullptr, 10);
+    } else if (header_is(line, line_len, "Transfer-Encoding")) {
+      nf->chunked = memmem(line, line_len, "chunked", 7) != nullptr;
+    }
+  }
+
+  unsigned short status = nf->fetch.status;
+  if (strcmp(nf->fetch.__attributes.requestMethod, "HEAD") == 0 ||
+      (status >= 100 && status < 200) || status == 204 || status == 304) {
+    nf->content_length = 0;
+    nf->chunked = false;
+  }
+  nf->fetch.readyState = 2;
+}
+
+// returns true once the whole response has been received
+static bool fetch_parse(native_fetch *nf) {
+  if (nf->header_len == 0) {
+    auto head = (const char *) nf->in.data();
+    auto found = (const char *) memmem(head, nf->in.size(), "\r\n\r\n", 4);
+    if (found == nullptr) {
+      return false;
+    }
+    nf->header_len = (size_t) (found - head) + 4;
+    fetch_parse_headers(nf, head, (size_t) (found - head));
+    nf->in.consume(nf->header_len);
+    nf->fetch.readyState = 3;
+  }
+
+  if (!nf->chunked) {
+    return nf->content_length >= 0 && (int64_t) (nf->streamed + nf->in.size()) >= nf->content_length;
+  }
+
+  for (;;) {
+    auto data = (const char *) nf->in.data();
+    auto eol = (const char *) memmem(data, nf->in.size(), "\r\n", 2);
+    if (eol == nullptr) {
+      return false;
+    }
+    size_t size = strtoul(data, nullptr, 16);
+    if (size == 0) {
+      return true;
+    }
+    size_t line_len = (size_t) (eol - data) + 2;
+    if (nf->in.size() < line_len + size + 2) {
+      return false;
+    }
+    nf->body.append(data + line_len, size);
+    nf->in.consume(line_len + size + 2);
+  }
+}
+
+// hands what arrived of the body to onprogress, false if it closed the fetch
+static bool fetch_stream(native_fetch *nf) {
+  ext::buffer &body = nf->chunked ? nf->body : nf->in;
+  size_t len = body.size();
+  if (!nf->chunked && nf->content_length >= 0 && nf->streamed + len > (uint64_t) nf->content_length) {
+    len = (size_t) ((uint64_t) nf->content_length - nf->streamed);
+  }
+  if (nf->header_len == 0 || len == 0) {
+    return true;
+  }
+
+  emscripten_fetch_t *fetch = &nf->fetch;
+  fetch->data = (const char *) body.data();
+  fetch->numBytes = len;
+  fetch->dataOffset = nf->streamed;
+  nf->calling = true;
+  fetch->__attributes.onprogress(fetch);
+  nf->calling = false;
+  fetch->data = nullptr;
+  if (nf->closed) {
+    fetch_free(nf);
+    return false;
+  }
+
+  nf->streamed += len;
+  body.consume(len);
+  return true;
+}
+
+static void fetch_io_handler(int fd, uint32_t events, void *user_data) {
+  auto nf = (native_fetch *) user_data;
+
+  if ((events & EPOLLOUT) && nf->out.size()) {
+    ssize_t n = write(fd, nf->out.data(), nf->out.size());
+    if (n < 0 && errno != EAGAIN) {
+      fetch_finish(nf, false);
+      return;
+    }
+    if (n > 0) {
+      nf->out.consume((size_t) n);
+    }
+    if (nf->out.size() == 0) {
+      fetch_rewatch(nf);
+    }
+  }
+
+  if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) || nf->paused) {
+    return;
+  }
+
+  char chunk[FETCH_READ_SIZE];
+  for (;;) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n > 0) {
+      nf->in.append(chunk, (size_t) n);
+      bool complete = fetch_parse(nf);
+      if (fetch_streaming(nf) && !fetch_stream(nf)) {
+        return;
+      }
+      if (complete) {
+        fetch_finish(nf, true);
+        return;
+      }
+      if (nf->paused) {
+        return;
+      }
+    } else if (n == 0) {
+      // connection closed: without a length the body runs until EOF
+      fetch_finish(nf, nf->header_len != 0 && !nf->chunked && nf->content_length < 0);
+      return;
+    } else {
+      if (errno != EAGAIN) {
+        fetch_finish(nf, false);
+      }
+      return;
+    }
+  }
+}
+
+static void fetch_finish(native_fetch *nf, bool ok) {
+  if (nf->done) {
+    return;
+  }
+  nf->done = true;
+
+  ext::loop::unwatch(nf->io);
+  ext::loop::clear_timer(nf->timer);
+  nf->io = nullptr;
+  nf->timer = nullptr;
+  if (nf->fd != -1) {
+    close(nf->fd);
+    nf->fd = -1;
+  }
+
+  emscripten_fetch_t *fetch = &nf->fetch;
+  if (ok && fetch_streaming(nf)) {
+    fetch->numBytes = fetch->totalBytes = nf->streamed;
+    fetch->dataOffset = 0;
+  } else if (ok) {
+    ext::buffer &body = nf->chunked ? nf->body : nf->in;
+    fetch->numBytes = fetch->totalBytes = nf->content_length >= 0
+                                          ? (uint64_t) nf->content_length
+                                          : (uint64_t) body.size();
+    fetch->data = body.release();
+  } else if (nf->header_len == 0) {
+    fetch->status = 0;
+  }
+  fetch->readyState = 4;
+
+  // the callback is allowed to emscripten_fetch_close() the request
+  bool succeeded = ok && fetch->status >= 200 && fetch->status < 300;
+  if (succeeded && fetch->__attributes.onsuccess != nullptr) {
+    fetch->__attributes.onsuccess(fetch);
+  } else if (!succeeded && fetch->__attributes.onerror != nullptr) {
+    fetch->__attributes.onerror(fetch);
+  }
+}
+
+void emscripten_fetch_attr_init(emscripten_fetch_attr_t *fetch_attr) {
+  memset(fetch_attr, 0, sizeof(emscripten_fetch_attr_t));
+}
+
+emscripten_fetch_t *emscripten_fetch(emscripten_fetch_attr_t *fetch_attr, const char *url) {
+  auto nf = new native_fetch();
+  nf->fd = -1;
+  nf->content_length = -1;
+
+  emscripten_fetch_t *fetch = &nf->fetch;
+  fetch->id = ++fetch_id;
+  fetch->userData = fetch_attr->userData;
+  fetch->url = strdup(url);
+  fetch->__attributes = *fetch_attr;
+  fetch->__attributes.requestHeaders = nullptr;
+  fetch->__attributes.requestData = nullptr;
+  if (fetch->__attributes.requestMethod[0] == '\0') {
+    strcpy(fetch->__attributes.requestMethod, "GET");
+  }
+
+  // failures are reported asynchronously, like the browser does
+  ext::net::url parts;
+  if (!ext::net::parse_url(url, &parts) || strcmp(parts.scheme, "http") != 0 ||
+      (nf->fd = ext::net::connect(parts.host, parts.port)) == -1) {
+    free(parts.path);
+    nf->timer = ext::loop::set_timer(0, fetch_fail_handler, nf);
+    return fetch;
+  }
+
+  char line[512];
+  snprintf(line, sizeof(line), "%s ", fetch->__attributes.requestMethod);
+  nf->out.append(line);
+  nf->out.append(parts.path);
+  snprintf(line, sizeof(line), " HTTP/1.1\r\nHost: %s:%u\r\nConnection: close\r\n", parts.host, parts.port);
+  nf->out.append(line);
+  free(parts.path);
+
+  if (fetch_attr->requestHeaders != nullptr) {
+    for (const char *const *h = fetch_attr->requestHeaders; h[0] != nullptr && h[1] != nullptr; h += 2) {
+      nf->out.append(h[0]);
+      nf->out.append(": ", 2);
+      nf->out.append(h[1]);
+      nf->out.append("\r\n", 2);
+    }
+  }
+
+  if (fetch_attr->requestData != nullptr || (strcmp(fetch->__attributes.requestMethod, "GET") != 0 &&
+                                             strcmp(fetch->__attributes.requestMethod, "HEAD") != 0)) {
+    snprintf(line, sizeof(line), "Content-Length: %zu\r\n", fetch_attr->requestDataSize);
+    nf->out.append(line);
+  }
+  nf->out.append("\r\n", 2);
+  if (fetch_attr->requestData != nullptr) {
+    nf->out.append(fetch_attr->requestData, fetch_attr->requestDataSize);
+  }
+
+  fetch->readyState = 1;
+  nf->io = ext::loop::watch(nf->fd, EPOLLOUT | EPOLLIN, fetch_io_handler, nf);
+  if (fetch_attr->timeoutMSecs > 0) {
+    nf->timer = ext::loop::set_timer(fetch_attr->timeoutMSecs, fetch_timeout_handler, nf);
+  }
+  return fetch;
+}
+
+size_t emscripten_fetch_get_response_headers_length(emscripten_fetch_t *fetch) {
+  auto nf = (native_fetch *) fetch;
+  return nf == nullptr || nf->headers == nullptr ? 0 : strlen(nf->headers);
+}
+
+size_t emscripten_fetch_get_response_headers(emscripten_fetch_t *fetch, char *dst, size_t dstSizeBytes) {
+  auto nf = (native_fetch *) fetch;
+  if (nf == nullptr || nf->headers == nullptr || dstSizeBytes == 0) {
+    return 0;
+  }
+
+  size_t len = strlen(nf->headers);
+  if (len >= dstSizeBytes) {
+    len = dstSizeBytes - 1;
+  }
+  memcpy(dst, nf->headers, len);
+  dst[len] = '\0';
+  return len + 1;
+}
+
+EMSCRIPTEN_RESULT emscripten_fetch_close(emscripten_fetch_t *fetch) {
+  if (fetch == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_PARAM;
+  }
+
+  // closing an in-flight request aborts it without running callbacks
+  auto nf = (native_fetch *) fetch;
+  nf->done = true;
+  ext::loop::unwatch(nf->io);
+  ext::loop::clear_timer(nf->timer);
+  nf->io = nullptr;
+  nf->timer = nullptr;
+  if (nf->fd != -1) {
+    close(nf->fd);
+    nf->fd = -1;
+  }
+
+  if (nf->calling) {
+    nf->closed = true;
+  } else {
+    fetch_free(nf);
+  }
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+void native_fetch_pause(emscripten_fetch_t *fetch, EM_BOOL paused) {
+  auto nf = (native_fetch *) fetch;
+  if (nf->paused == (bool) paused) {
+    return;
+  }
+
+  nf->paused = (bool) paused;
+  if (!nf->done && nf->fd != -1) {
+    fetch_rewatch(nf);
+  }
+}
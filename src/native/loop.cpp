@@ -0,0 +1,185 @@
+#include "loop.hpp"
+#include <cerrno>
+#include <cmath>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#define LOOP_MAX_EVENTS 64
+
+struct ext::loop::watcher {
+  int fd;
+  bool is_timer;
+  bool dead;
+  timer_callback_t on_timer;
+  io_callback_t on_io;
+  void *user_data;
+  watcher *next;
+};
+
+thread_local int ext::loop::epfd = -1;
+thread_local bool ext::loop::stopped = false;
+thread_local uint32_t ext::loop::active = 0;
+thread_local ext::loop::watcher *ext::loop::graveyard = nullptr;
+
+int ext::loop::init() {
+  if (epfd == -1) {
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+  }
+  return epfd == -1 ? -1 : 0;
+}
+
+bool ext::loop::alive() {
+  return active > 0 && !stopped;
+}
+
+void ext::loop::stop() {
+  stopped = true;
+}
+
+void ext::loop::shutdown() {
+  while (graveyard != nullptr) {
+    watcher *next = graveyard->next;
+    delete graveyard;
+    graveyard = next;
+  }
+  if (epfd != -1) {
+    close(epfd);
+    epfd = -1;
+  }
+  active = 0;
+}
+
+int ext::loop::run() {
+  stopped = false;
+  while (alive()) {
+    if (run_once(-1) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int ext::loop::run_once(int timeout) {
+  if (init() != 0) {
+    return -1;
+  }
+
+  struct epoll_event events[LOOP_MAX_EVENTS];
+  int n = epoll_wait(epfd, events, LOOP_MAX_EVENTS, timeout);
+  if (n < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+
+  for (int i = 0; i < n; i++) {
+    auto w = (watcher *) events[i].data.ptr;
+    if (w->dead) {
+      continue;
+    }
+
+    if (w->is_timer) {
+      uint64_t expirations;
+      ssize_t r = read(w->fd, &expirations, sizeof(expirations));
+      (void) r;
+      timer_callback_t callback = w->on_timer;
+      void *user_data = w->user_data;
+      release(w);
+      callback(user_data);
+    } else {
+      w->on_io(w->fd, events[i].events, w->user_data);
+    }
+  }
+
+  // watchers released during dispatch may still be referenced by the batch
+  while (graveyard != nullptr) {
+    watcher *next = graveyard->next;
+    delete graveyard;
+    graveyard = next;
+  }
+
+  return n;
+}
+
+ext::loop::watcher *ext::loop::set_timer(double millis, timer_callback_t callback, void *user_data) {
+  if (init() != 0) {
+    return nullptr;
+  }
+
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd == -1) {
+    return nullptr;
+  }
+
+  // an all zero it_value disarms the timer, so fire "now" as 1ns
+  if (!(millis > 0)) {
+    millis = 0;
+  }
+  struct itimerspec spec = {};
+  auto nanos = (uint64_t) llround(millis * 1e6);
+  spec.it_value.tv_sec = (time_t) (nanos / 1000000000ull);
+  spec.it_value.tv_nsec = (long) (nanos % 1000000000ull);
+  if (nanos == 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(fd, 0, &spec, nullptr);
+
+  auto w = new watcher{fd, true, false, callback, nullptr, user_data, nullptr};
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.ptr = w;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    close(fd);
+    delete w;
+    return nullptr;
+  }
+
+  active += 1;
+  return w;
+}
+
+void ext::loop::clear_timer(watcher *w) {
+  if (w != nullptr && !w->dead) {
+    release(w);
+  }
+}
+
+ext::loop::watcher *ext::loop::watch(int fd, uint32_t events, io_callback_t callback, void *user_data) {
+  if (init() != 0) {
+    return nullptr;
+  }
+
+  auto w = new watcher{fd, false, false, nullptr, callback, user_data, nullptr};
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = w;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    delete w;
+    return nullptr;
+  }
+
+  active += 1;
+  return w;
+}
+
+int ext::loop::modify(watcher *w, uint32_t events) {
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.ptr = w;
+  return epoll_ctl(epfd, EPOLL_CTL_MOD, w->fd, &ev);
+}
+
+void ext::loop::unwatch(watcher *w) {
+  if (w != nullptr && !w->dead) {
+    release(w);
+  }
+}
+
+void ext::loop::release(watcher *w) {
+  epoll_ctl(epfd, EPOLL_CTL_DEL, w->fd, nullptr);
+  if (w->is_timer) {
+    close(w->fd);
+  }
+  w->dead = true;
+  w->next = graveyard;
+  graveyard = w;
+  active -= 1;
+}
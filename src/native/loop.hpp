@@ -0,0 +1,53 @@
+#ifndef JPROTECTOR_LOOP_HPP
+#define JPROTECTOR_LOOP_HPP
+
+#include <cstdint>
+#include <sys/epoll.h>
+
+namespace ext {
+  // epoll event loop, one per thread; timers are backed by timerfd so
+  // everything the native host waits on is a file descriptor
+  class loop {
+  public:
+    typedef void (*timer_callback_t)(void *user_data);
+
+    typedef void (*io_callback_t)(int fd, uint32_t events, void *user_data);
+
+    struct watcher;
+
+    static int init();
+
+    // run until no watcher is left or stop() is called
+    static int run();
+
+    // wait at most `timeout` milliseconds (-1 blocks) and dispatch one batch
+    static int run_once(int timeout);
+
+    static void stop();
+
+    // close the calling thread's loop, watchers left behind are abandoned
+    static void shutdown();
+
+    static bool alive();
+
+    static watcher *set_timer(double millis, timer_callback_t callback, void *user_data);
+
+    static void clear_timer(watcher *w);
+
+    static watcher *watch(int fd, uint32_t events, io_callback_t callback, void *user_data);
+
+    static int modify(watcher *w, uint32_t events);
+
+    static void unwatch(watcher *w);
+
+  private:
+    static void release(watcher *w);
+
+    static thread_local int epfd;
+    static thread_local bool stopped;
+    static thread_local uint32_t active;
+    static thread_local watcher *graveyard;
+  };
+}
+
+#endif //JPROTECTOR_LOOP_HPP
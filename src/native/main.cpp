@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "../core.hpp"
+#include "buffer.hpp"
+#include "loop.hpp"
+
+/*
+ * Native host for the worker:
+ *
+ *   core [-p] <file> [$$ code]
+ *   core -c <file>
+ *
+ * <file> is plain JavaScript, packed in memory exactly like the compiler does,
+ * or with -p an already compiled payload; -c only compiles it, printing the
+ * payload (an encrypted bytecode snapshot) to stdout. Every stdin line is one inbound
+ * message as JSON, postMessage() output goes to stdout as JSON, one message
+ * per line, and console output goes to stderr.
+ */
+
+static ext::buffer input;
+static security_worker_t *worker = nullptr;
+static ext::loop::watcher *stdin_watcher = nullptr;
+
+static void dispatch_lines() {
+  for (;;) {
+    auto data = (char *) input.data();
+    auto eol = (char *) memchr(data, '\n', input.size());
+    if (eol == nullptr) {
+      return;
+    }
+    *eol = '\0';
+    security_worker_onmessage_json(worker, data);
+    input.consume((size_t) (eol - data) + 1);
+  }
+}
+
+static void stdin_handler(int fd, uint32_t events, void *user_data) {
+  char chunk[16384];
+  ssize_t n = read(fd, chunk, sizeof(chunk));
+  if (n > 0) {
+    input.append(chunk, (size_t) n);
+    dispatch_lines();
+    return;
+  }
+
+  if (input.size()) {
+    input.append("\n", 1);
+    dispatch_lines();
+  }
+  ext::loop::unwatch(stdin_watcher);
+}
+
+static char *read_file(const char *path, size_t *len) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == nullptr) {
+    return nullptr;
+  }
+
+  ext::buffer content;
+  char chunk[16384];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+    content.append(chunk, n);
+  }
+  fclose(fp);
+
+  *len = content.size();
+  return content.release();
+}
+
+int main(int argc, char **argv) {
+  bool packed = argc > 1 && strcmp(argv[1], "-p") == 0;
+  bool compile = argc > 1 && strcmp(argv[1], "-c") == 0;
+  int argi = packed || compile ? 2 : 1;
+  if (argi >= argc) {
+    fprintf(stderr, "usage: %s [-p] <file> [$$ code]\n       %s -c <file>\n", argv[0], argv[0]);
+    return 1;
+  }
+
+  size_t len = 0;
+  char *content = read_file(argv[argi], &len);
+  if (content == nullptr) {
+    perror(argv[argi]);
+    return 1;
+  }
+
+  char *payload = content;
+  size_t en_len = 0;
+  if (packed) {
+    while (len && (content[len - 1] == '\n' || content[len - 1] == '\r' || content[len - 1] == ' ')) {
+      content[--len] = '\0';
+    }
+    // the payload is reversed, so base64 padding leads
+    size_t pad = 0;
+    while (pad < len && content[pad] == '=') {
+      pad++;
+    }
+    en_len = len / 4 * 3 - pad;
+  } else {
+    payload = security_worker_pack(content, len, &en_len);
+    free(content);
+    len = strlen(payload);
+  }
+
+  if (compile) {
+    puts(payload);
+    free(payload);
+    return 0;
+  }
+
+  char empty[] = "[]";
+  char *$$_code = argi + 1 < argc ? argv[argi + 1] : empty;
+
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  ext::loop::init();
+  worker = security_worker_new(payload, len, 0, en_len, $$_code);
+  free(payload);
+  if (worker == nullptr) {
+    fprintf(stderr, "%s: empty or undecryptable script\n", argv[argi]);
+    return 1;
+  }
+
+  // regular files can not be polled, drain them up front instead
+  stdin_watcher = ext::loop::watch(STDIN_FILENO, EPOLLIN, stdin_handler, nullptr);
+  if (stdin_watcher == nullptr) {
+    char chunk[16384];
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, chunk, sizeof(chunk))) > 0) {
+      input.append(chunk, (size_t) n);
+      dispatch_lines();
+    }
+    if (input.size()) {
+      input.append("\n", 1);
+      dispatch_lines();
+    }
+  }
+  ext::loop::run();
+
+  security_worker_exit(worker);
+  return 0;
+}
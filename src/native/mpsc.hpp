@@ -0,0 +1,69 @@
+#ifndef JPROTECTOR_MPSC_HPP
+#define JPROTECTOR_MPSC_HPP
+
+#include <atomic>
+
+namespace ext {
+  /*
+   * Unbounded multi-producer single-consumer queue (Vyukov). push() is
+   * wait-free and may be called from any thread, pop() only from the one
+   * consumer. pop() can miss an element whose push() is still in flight,
+   * so producers signal the consumer after pushing.
+   */
+  template<typename T>
+  class mpsc {
+    struct node {
+      std::atomic<node *> next;
+      T value;
+    };
+
+  public:
+    mpsc() : head(&stub), tail(&stub) {
+      stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    mpsc(const mpsc &) = delete;
+
+    mpsc &operator=(const mpsc &) = delete;
+
+    ~mpsc() {
+      T value;
+      while (pop(value)) {
+      }
+      if (tail != &stub) {
+        delete tail;
+      }
+    }
+
+    void push(const T &value) {
+      auto n = new node();
+      n->value = value;
+      n->next.store(nullptr, std::memory_order_relaxed);
+      node *prev = head.exchange(n, std::memory_order_acq_rel);
+      prev->next.store(n, std::memory_order_release);
+    }
+
+    bool pop(T &value) {
+      node *t = tail;
+      node *next = t->next.load(std::memory_order_acquire);
+      if (next == nullptr) {
+        return false;
+      }
+
+      // `next` becomes the new sentinel, its value is handed out
+      value = next->value;
+      tail = next;
+      if (t != &stub) {
+        delete t;
+      }
+      return true;
+    }
+
+  private:
+    std::atomic<node *> head;
+    node *tail;
+    node stub;
+  };
+}
+
+#endif //JPROTECTOR_MPSC_HPP
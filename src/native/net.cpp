@@ -0,0 +1,171 @@
+#include "net.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+bool ext::net::parse_url(const char *str, url *out) {
+  memset(out, 0, sizeof(url));
+  const char *sep = strstr(str, "://");
+  if (sep == nullptr || (size_t) (sep - str) >= sizeof(out->scheme)) {
+    return false;
+  }
+  memcpy(out->scheme, str, (size_t) (sep - str));
+
+  const char *host = sep + 3;
+  const char *path = strchr(host, '/');
+  if (path == nullptr) {
+    path = host + strlen(host);
+  }
+
+  const char *port = (const char *) memchr(host, ':', (size_t) (path - host));
+  const char *host_end = port != nullptr ? port : path;
+  if (host_end == host || (size_t) (host_end - host) >= sizeof(out->host)) {
+    return false;
+  }
+  memcpy(out->host, host, (size_t) (host_end - host));
+
+  if (port != nullptr) {
+    out->port = (uint16_t) strtoul(port + 1, nullptr, 10);
+  } else if (strcmp(out->scheme, "https") == 0 || strcmp(out->scheme, "wss") == 0) {
+    out->port = 443;
+  } else {
+    out->port = 80;
+  }
+
+  out->path = strdup(*path ? path : "/");
+  return true;
+}
+
+int ext::net::connect(const char *host, uint16_t port) {
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *res = nullptr;
+  if (getaddrinfo(host, service, &hints, &res) != 0) {
+    return -1;
+  }
+
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd == -1) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 || errno == EINPROGRESS) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(res);
+  return fd;
+}
+
+void ext::net::random_bytes(uint8_t *out, size_t len) {
+  int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  if (fd != -1) {
+    ssize_t n = read(fd, out, len);
+    close(fd);
+    if (n == (ssize_t) len) {
+      return;
+    }
+  }
+
+  static thread_local uint32_t seed = (uint32_t) time(nullptr);
+  for (size_t i = 0; i < len; i++) {
+    seed = seed * 1103515245u + 12345u;
+    out[i] = (uint8_t) (seed >> 16);
+  }
+}
+
+static inline uint32_t rol(uint32_t x, int n) {
+  return (x << n) | (x >> (32 - n));
+}
+
+static void sha1_block(uint32_t h[5], const uint8_t *p) {
+  uint32_t w[80];
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((uint32_t) p[i * 4] << 24) | ((uint32_t) p[i * 4 + 1] << 16) | ((uint32_t) p[i * 4 + 2] << 8) | p[i * 4 + 3];
+  }
+  for (int i = 16; i < 80; i++) {
+    w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+  for (int i = 0; i < 80; i++) {
+    uint32_t f, k;
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    uint32_t t = rol(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rol(b, 30);
+    b = a;
+    a = t;
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+void ext::net::sha1(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len, uint8_t out[20]) {
+  uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+  uint8_t block[64];
+  size_t fill = 0;
+  uint64_t total = a_len + b_len;
+  const uint8_t *parts[2] = {a, b};
+  size_t lens[2] = {a_len, b_len};
+  for (int i = 0; i < 2; i++) {
+    for (size_t j = 0; j < lens[i]; j++) {
+      block[fill++] = parts[i][j];
+      if (fill == 64) {
+        sha1_block(h, block);
+        fill = 0;
+      }
+    }
+  }
+
+  // 0x80, zeros, then the length in bits
+  block[fill++] = 0x80;
+  if (fill > 56) {
+    memset(block + fill, 0, 64 - fill);
+    sha1_block(h, block);
+    fill = 0;
+  }
+  memset(block + fill, 0, 56 - fill);
+  for (int i = 0; i < 8; i++) {
+    block[56 + i] = (uint8_t) ((total * 8) >> (56 - 8 * i));
+  }
+  sha1_block(h, block);
+
+  for (int i = 0; i < 20; i++) {
+    out[i] = (uint8_t) (h[i / 4] >> (24 - 8 * (i % 4)));
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef JPROTECTOR_NET_HPP
+#define JPROTECTOR_NET_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ext {
+  class net {
+  public:
+    struct url {
+      char scheme[8];
+      char host[256];
+      uint16_t port;
+      char *path;
+    };
+
+    // split `scheme://host[:port][/path]`, path must be free()d by the caller
+    static bool parse_url(const char *str, url *out);
+
+    // start a non-blocking TCP connect, -1 when the host can not be resolved
+    static int connect(const char *host, uint16_t port);
+
+    // fill `len` bytes from /dev/urandom, falling back to a time seeded PRNG
+    static void random_bytes(uint8_t *out, size_t len);
+
+    // SHA-1 of the concatenation of both inputs, for the websocket handshake
+    static void sha1(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len, uint8_t out[20]);
+  };
+}
+
+#endif //JPROTECTOR_NET_HPP
@@ -0,0 +1,203 @@
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "pool.hpp"
+
+struct security_worker_pool : public ext::pool {
+  explicit security_worker_pool(unsigned int threads) : ext::pool(threads) {};
+};
+
+static char *copy_bytes(const char *data, size_t len) {
+  auto copy = (char *) malloc(len + 1);
+  memcpy(copy, data, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+ext::pool::pool(unsigned int threads) : next_id(0) {
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  threads_len = threads == 0 ? 1 : threads;
+  messages_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  this->threads = new pool_thread[threads_len];
+  for (unsigned int i = 0; i < threads_len; i++) {
+    pool_thread *t = &this->threads[i];
+    t->owner = this;
+    t->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    t->watcher = nullptr;
+    t->handle = std::thread(thread_main, t);
+  }
+}
+
+ext::pool::~pool() {
+  for (unsigned int i = 0; i < threads_len; i++) {
+    pool_thread *t = &threads[i];
+    t->inbound.push(command{POOL_STOP, 0, nullptr, 0, 0, nullptr});
+    notify(t->event_fd);
+    t->handle.join();
+    close(t->event_fd);
+  }
+  delete[] threads;
+
+  message msg{};
+  while (messages.pop(msg)) {
+    free(msg.data);
+  }
+  close(messages_fd);
+}
+
+uint32_t ext::pool::spawn(const char *js_code, size_t b64_len, size_t en_len, const char *$$_code) {
+  uint32_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+  send(id, command{POOL_SPAWN, id, copy_bytes(js_code, b64_len), b64_len, en_len,
+                   copy_bytes($$_code, strlen($$_code))});
+  return id;
+}
+
+int ext::pool::post(uint32_t worker, const char *data, size_t len) {
+  return send(worker, command{POOL_MESSAGE, worker, copy_bytes(data, len), len, 0, nullptr});
+}
+
+int ext::pool::terminate(uint32_t worker) {
+  return send(worker, command{POOL_TERMINATE, worker, nullptr, 0, 0, nullptr});
+}
+
+bool ext::pool::receive(uint32_t *worker, char **data, size_t *len) {
+  message msg{};
+  if (!messages.pop(msg)) {
+    // reset the eventfd before looking again, so a message pushed in
+    // between leaves it readable instead of being missed
+    uint64_t count;
+    ssize_t r = read(messages_fd, &count, sizeof(count));
+    (void) r;
+    if (!messages.pop(msg)) {
+      return false;
+    }
+  }
+
+  *worker = msg.worker;
+  *data = msg.data;
+  *len = msg.len;
+  return true;
+}
+
+int ext::pool::fd() {
+  return messages_fd;
+}
+
+int ext::pool::send(uint32_t worker, const command &cmd) {
+  pool_thread *t = &threads[worker % threads_len];
+  t->inbound.push(cmd);
+  notify(t->event_fd);
+  return 0;
+}
+
+void ext::pool::notify(int fd) {
+  uint64_t one = 1;
+  ssize_t r = write(fd, &one, sizeof(one));
+  (void) r;
+}
+
+void ext::pool::thread_main(pool_thread *t) {
+  ext::loop::init();
+  t->watcher = ext::loop::watch(t->event_fd, EPOLLIN, inbound_handler, t);
+  ext::loop::run();
+
+  t->workers.foreach([](uint32_t id, slot *s, void *userData) -> void {
+    security_worker_exit(s->worker);
+    delete s;
+  }, nullptr);
+  ext::loop::shutdown();
+}
+
+void ext::pool::inbound_handler(int fd, uint32_t events, void *user_data) {
+  auto t = (pool_thread *) user_data;
+  uint64_t count;
+  ssize_t r = read(fd, &count, sizeof(count));
+  (void) r;
+
+  command cmd{};
+  while (t->inbound.pop(cmd)) {
+    slot **found = t->workers.get(cmd.worker);
+    switch (cmd.type) {
+      case POOL_SPAWN: {
+        auto s = new slot{t->owner, cmd.worker, nullptr};
+        s->worker = security_worker_create(cmd.data, cmd.len, cmd.en_len, cmd.$$_code, outbound, s);
+        free(cmd.data);
+        free(cmd.$$_code);
+        if (s->worker == nullptr) {
+          t->owner->messages.push(message{s->id, nullptr, 0});
+          notify(t->owner->messages_fd);
+          delete s;
+        } else {
+          t->workers.add(s->id, s);
+        }
+        break;
+      }
+      case POOL_MESSAGE:
+        if (found != nullptr) {
+          security_worker_onmessage((*found)->worker, cmd.data, cmd.len);
+        }
+        free(cmd.data);
+        break;
+      case POOL_TERMINATE:
+        if (found != nullptr) {
+          slot *s = *found;
+          t->workers.remove(cmd.worker);
+          security_worker_exit(s->worker);
+          delete s;
+        }
+        break;
+      case POOL_STOP:
+        ext::loop::unwatch(t->watcher);
+        ext::loop::stop();
+        return;
+    }
+  }
+}
+
+void ext::pool::outbound(security_worker_t *worker, const char *data, size_t len, void *user_data) {
+  // a batch carries length framed messages, the pool hands them out one by one
+  auto s = (slot *) user_data;
+  for (size_t pos = 0; pos + sizeof(uint32_t) <= len;) {
+    uint32_t frame;
+    memcpy(&frame, data + pos, sizeof(frame));
+    pos += sizeof(frame);
+    s->owner->messages.push(message{s->id, copy_bytes(data + pos, frame), frame});
+    pos += frame;
+  }
+  notify(s->owner->messages_fd);
+}
+
+extern "C" {
+security_worker_pool_t *security_worker_pool_new(unsigned int threads) {
+  return new security_worker_pool(threads);
+}
+
+uint32_t security_worker_pool_spawn(security_worker_pool_t *pool, const char *js_code, size_t b64_len,
+                                    size_t en_len, const char *$$_code) {
+  return pool->spawn(js_code, b64_len, en_len, $$_code);
+}
+
+int security_worker_pool_post(security_worker_pool_t *pool, uint32_t worker, const char *data, size_t len) {
+  return pool->post(worker, data, len);
+}
+
+int security_worker_pool_terminate(security_worker_pool_t *pool, uint32_t worker) {
+  return pool->terminate(worker);
+}
+
+int security_worker_pool_receive(security_worker_pool_t *pool, uint32_t *worker, char **data, size_t *len) {
+  return pool->receive(worker, data, len) ? 0 : -1;
+}
+
+int security_worker_pool_fd(security_worker_pool_t *pool) {
+  return pool->fd();
+}
+
+void security_worker_pool_exit(security_worker_pool_t *pool) {
+  delete pool;
+}
+}
@@ -0,0 +1,97 @@
+#ifndef JPROTECTOR_POOL_HPP
+#define JPROTECTOR_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include "../core.hpp"
+#include "../map.hpp"
+#include "loop.hpp"
+#include "mpsc.hpp"
+
+namespace ext {
+  /*
+   * Runs workers on a fixed set of threads. Each worker is pinned to one
+   * thread, which owns its engine context and the loop its timers, fetches
+   * and sockets live on. Threads are fed through lock-free inbound queues
+   * and everything the workers post lands in one outbound queue.
+   */
+  class pool {
+    enum command_type {
+      POOL_SPAWN = 0,
+      POOL_MESSAGE,
+      POOL_TERMINATE,
+      POOL_STOP,
+    };
+
+    struct command {
+      command_type type;
+      uint32_t worker;
+      char *data;
+      size_t len;  // of data, the base64 payload for POOL_SPAWN
+      size_t en_len;
+      char *$$_code;
+    };
+
+    struct message {
+      uint32_t worker;
+      char *data;
+      size_t len;
+    };
+
+    struct slot {
+      pool *owner;
+      uint32_t id;
+      security_worker_t *worker;
+    };
+
+    struct pool_thread {
+      pool *owner;
+      int event_fd;
+      std::thread handle;
+      mpsc<command> inbound;
+      ext::loop::watcher *watcher;
+      map<uint32_t, slot *> workers;
+    };
+
+  public:
+    explicit pool(unsigned int threads);
+
+    pool(const pool &) = delete;
+
+    pool &operator=(const pool &) = delete;
+
+    ~pool();
+
+    uint32_t spawn(const char *js_code, size_t b64_len, size_t en_len, const char *$$_code);
+
+    int post(uint32_t worker, const char *data, size_t len);
+
+    int terminate(uint32_t worker);
+
+    // next outbound message; a null `data` reports a worker that failed to start
+    bool receive(uint32_t *worker, char **data, size_t *len);
+
+    // becomes readable whenever receive() has something
+    int fd();
+
+  private:
+    int send(uint32_t worker, const command &cmd);
+
+    static void thread_main(pool_thread *t);
+
+    static void inbound_handler(int fd, uint32_t events, void *user_data);
+
+    static void outbound(security_worker_t *worker, const char *data, size_t len, void *user_data);
+
+    static void notify(int fd);
+
+    pool_thread *threads;
+    unsigned int threads_len;
+    std::atomic<uint32_t> next_id;
+    mpsc<message> messages;
+    int messages_fd;
+  };
+}
+
+#endif //JPROTECTOR_POOL_HPP
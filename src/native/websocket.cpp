@@ -0,0 +1,635 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "emscripten/websocket.h"
+#include "../map.hpp"
+#include "buffer.hpp"
+#include "loop.hpp"
+#include "net.hpp"
+#include "b64.h"
+
+#define WS_READ_SIZE 16384
+// frames and reassembled messages past this fail the socket with 1009
+#define WS_MAX_MESSAGE_SIZE (16 * 1024 * 1024)
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT 0x1
+#define WS_OP_BINARY 0x2
+#define WS_OP_CLOSE 0x8
+#define WS_OP_PING 0x9
+#define WS_OP_PONG 0xa
+
+// a text or binary frame in `out`, ending at that many bytes written
+struct ws_pending {
+  uint64_t end;
+  uint64_t payload;
+};
+
+typedef enum {
+  WS_CONNECTING = 0,
+  WS_OPEN,
+  WS_CLOSING,
+  WS_CLOSED,
+} ws_state_t;
+
+struct native_socket {
+  EMSCRIPTEN_WEBSOCKET_T id;
+  int fd;
+  ws_state_t state;
+  bool upgraded;
+  bool deleted;
+  uint32_t dispatching;
+  uint32_t mask_seed;
+  uint8_t message_op;
+  // Sec-WebSocket-Accept the server has to answer with
+  char accept[32];
+  // a close frame is queued, the connection drops once it is written
+  bool linger;
+  bool linger_clean;
+  unsigned short linger_code;
+  size_t linger_reason_len;
+  char linger_reason[123];
+  ext::loop::watcher *io;
+  ext::loop::watcher *timer;
+  ext::buffer out;
+  // bytes of `out` written so far, and the data frames not fully written,
+  // as ws_pending entries, so bufferedAmount counts payload bytes only
+  uint64_t out_sent;
+  size_t pending_payload;
+  ext::buffer pending;
+  ext::buffer in;
+  ext::buffer message;
+
+  em_websocket_open_callback_func onopen;
+  em_websocket_message_callback_func onmessage;
+  em_websocket_error_callback_func onerror;
+  em_websocket_close_callback_func onclose;
+  void *onopen_data;
+  void *onmessage_data;
+  void *onerror_data;
+  void *onclose_data;
+};
+
+// sockets belong to the loop of the thread that opened them
+static thread_local EMSCRIPTEN_WEBSOCKET_T socket_id = 0;
+static thread_local map<EMSCRIPTEN_WEBSOCKET_T, native_socket *> sockets;
+
+static native_socket *socket_get(EMSCRIPTEN_WEBSOCKET_T id) {
+  native_socket **ns = sockets.get(id);
+  return ns == nullptr || (*ns)->deleted ? nullptr : *ns;
+}
+
+static void socket_free(native_socket *ns) {
+  ext::loop::unwatch(ns->io);
+  ext::loop::clear_timer(ns->timer);
+  if (ns->fd != -1) {
+    close(ns->fd);
+  }
+  sockets.remove(ns->id);
+  delete ns;
+}
+
+// callbacks may emscripten_websocket_delete() the socket they run on
+static void socket_enter(native_socket *ns) {
+  ns->dispatching += 1;
+}
+
+static void socket_leave(native_socket *ns) {
+  ns->dispatching -= 1;
+  if (ns->deleted && ns->dispatching == 0) {
+    socket_free(ns);
+  }
+}
+
+static void socket_closed(native_socket *ns, bool clean, unsigned short code, const char *reason, size_t reason_len) {
+  if (ns->state == WS_CLOSED) {
+    return;
+  }
+  ns->state = WS_CLOSED;
+  ext::loop::unwatch(ns->io);
+  ns->io = nullptr;
+  if (ns->fd != -1) {
+    close(ns->fd);
+    ns->fd = -1;
+  }
+
+  if (ns->onclose != nullptr && !ns->deleted) {
+    EmscriptenWebSocketCloseEvent e = {};
+    e.socket = ns->id;
+    e.wasClean = clean;
+    e.code = code;
+    if (reason_len >= sizeof(e.reason)) {
+      reason_len = sizeof(e.reason) - 1;
+    }
+    memcpy(e.reason, reason, reason_len);
+    ns->onclose(EMSCRIPTEN_EVENT_WEB_SOCKET_CLOSE, &e, ns->onclose_data);
+  }
+}
+
+static void socket_failed(native_socket *ns) {
+  if (ns->state == WS_CLOSED) {
+    return;
+  }
+  if (ns->onerror != nullptr && !ns->deleted) {
+    EmscriptenWebSocketErrorEvent e = {ns->id};
+    ns->onerror(EMSCRIPTEN_EVENT_WEB_SOCKET_ERROR, &e, ns->onerror_data);
+  }
+  socket_closed(ns, false, 1006, "", 0);
+}
+
+static void socket_send_frame(native_socket *ns, uint8_t op, const void *data, uint64_t len) {
+  uint8_t head[14];
+  size_t head_len = 2;
+  head[0] = (uint8_t) (0x80 | op);
+  if (len < 126) {
+    head[1] = (uint8_t) (0x80 | len);
+  } else if (len <= 0xffff) {
+    head[1] = 0x80 | 126;
+    head[2] = (uint8_t) (len >> 8);
+    head[3] = (uint8_t) len;
+    head_len = 4;
+  } else {
+    head[1] = 0x80 | 127;
+    for (int i = 0; i < 8; i++) {
+      head[2 + i] = (uint8_t) (len >> (56 - 8 * i));
+    }
+    head_len = 10;
+  }
+
+  // client frames are masked, the key only has to be unpredictable to proxies
+  ns->mask_seed ^= ns->mask_seed << 13;
+  ns->mask_seed ^= ns->mask_seed >> 17;
+  ns->mask_seed ^= ns->mask_seed << 5;
+  uint8_t *mask = head + head_len;
+  memcpy(mask, &ns->mask_seed, 4);
+  head_len += 4;
+
+  ns->out.append(head, head_len);
+
+  // the payload is masked straight into the output, eight bytes at a time
+  auto src = (const uint8_t *) data;
+  uint8_t *dst = ns->out.extend((size_t) len);
+  uint64_t mask_word;
+  memcpy(&mask_word, mask, 4);
+  memcpy((uint8_t *) &mask_word + 4, mask, 4);
+  uint64_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, src + i, 8);
+    word ^= mask_word;
+    memcpy(dst + i, &word, 8);
+  }
+  for (; i < len; i++) {
+    dst[i] = src[i] ^ mask[i & 3];
+  }
+
+  if (op == WS_OP_TEXT || op == WS_OP_BINARY || op == WS_OP_CONTINUATION) {
+    ws_pending p = {ns->out_sent + ns->out.size(), len};
+    ns->pending.append(&p, sizeof(p));
+    ns->pending_payload += (size_t) len;
+  }
+
+  if (ns->io != nullptr) {
+    ext::loop::modify(ns->io, EPOLLIN | EPOLLOUT);
+  }
+}
+
+static void socket_written(native_socket *ns, size_t n) {
+  ns->out.consume(n);
+  ns->out_sent += n;
+  while (ns->pending.size() != 0) {
+    ws_pending p;
+    memcpy(&p, ns->pending.data(), sizeof(p));
+    if (p.end > ns->out_sent) {
+      break;
+    }
+    ns->pending_payload -= (size_t) p.payload;
+    ns->pending.consume(sizeof(p));
+  }
+}
+
+// queues a close frame if `send`, the close event fires once it is written
+static void socket_linger(native_socket *ns, bool send, bool clean, unsigned short code, const char *reason,
+                          size_t reason_len) {
+  if (reason_len > sizeof(ns->linger_reason)) {
+    reason_len = sizeof(ns->linger_reason);
+  }
+  ns->linger = true;
+  ns->linger_clean = clean;
+  ns->linger_code = code;
+  ns->linger_reason_len = reason_len;
+  memcpy(ns->linger_reason, reason, reason_len);
+
+  if (send) {
+    uint8_t payload[2] = {(uint8_t) (code >> 8), (uint8_t) code};
+    socket_send_frame(ns, WS_OP_CLOSE, payload, code == 1005 ? 0 : 2);
+  }
+  ns->state = WS_CLOSING;
+  if (ns->out.size() == 0) {
+    socket_closed(ns, clean, code, ns->linger_reason, reason_len);
+  }
+}
+
+static void socket_deliver(native_socket *ns, uint8_t op) {
+  // text payloads are handed out NUL terminated, as emscripten does
+  size_t len = ns->message.size();
+  ns->message.append("\0", 1);
+  if (ns->onmessage != nullptr) {
+    EmscriptenWebSocketMessageEvent e = {};
+    e.socket = ns->id;
+    e.data = ns->message.data();
+    e.numBytes = (uint32_t) len;
+    e.isText = op == WS_OP_TEXT;
+    ns->onmessage(EMSCRIPTEN_EVENT_WEB_SOCKET_MESSAGE, &e, ns->onmessage_data);
+  }
+  ns->message.consume(ns->message.size());
+}
+
+static void socket_frame(native_socket *ns, bool fin, uint8_t op, uint8_t *payload, uint64_t len) {
+  switch (op) {
+    case WS_OP_CONTINUATION:
+    case WS_OP_TEXT:
+    case WS_OP_BINARY:
+      if (op != WS_OP_CONTINUATION) {
+        ns->message_op = op;
+      }
+      if (ns->message.size() + len > WS_MAX_MESSAGE_SIZE) {
+        socket_linger(ns, true, false, 1009, "", 0);
+        break;
+      }
+      ns->message.append(payload, (size_t) len);
+      if (fin) {
+        socket_deliver(ns, ns->message_op);
+      }
+      break;
+    case WS_OP_PING:
+      socket_send_frame(ns, WS_OP_PONG, payload, len);
+      break;
+    case WS_OP_CLOSE: {
+      unsigned short code = 1005;
+      if (len >= 2) {
+        code = (unsigned short) ((payload[0] << 8) | payload[1]);
+      }
+      // echoed unless this end started the close
+      socket_linger(ns, ns->state == WS_OPEN, true, code, len > 2 ? (const char *) payload + 2 : "",
+                    len > 2 ? (size_t) len - 2 : 0);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// whether the response headers in [head, end) carry the expected Sec-WebSocket-Accept
+static bool socket_accepted(native_socket *ns, const char *head, const char *end) {
+  static const char name[] = "Sec-WebSocket-Accept:";
+  for (const char *line = head; line < end;) {
+    auto eol = (const char *) memmem(line, (size_t) (end - line), "\r\n", 2);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    if ((size_t) (eol - line) > sizeof(name) - 1 && strncasecmp(line, name, sizeof(name) - 1) == 0) {
+      const char *value = line + sizeof(name) - 1;
+      const char *value_end = eol;
+      while (value < value_end && (*value == ' ' || *value == '\t')) {
+        value++;
+      }
+      while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+        value_end--;
+      }
+      size_t len = (size_t) (value_end - value);
+      return len == strlen(ns->accept) && memcmp(value, ns->accept, len) == 0;
+    }
+    line = eol + 2;
+  }
+  return false;
+}
+
+static void socket_parse(native_socket *ns) {
+  if (ns->linger) {
+    ns->in.consume(ns->in.size());
+    return;
+  }
+
+  if (!ns->upgraded) {
+    auto head = (const char *) ns->in.data();
+    auto found = (const char *) memmem(head, ns->in.size(), "\r\n\r\n", 4);
+    if (found == nullptr) {
+      return;
+    }
+    const char *sp = (const char *) memchr(head, ' ', (size_t) (found - head));
+    if (sp == nullptr || strtoul(sp + 1, nullptr, 10) != 101 || !socket_accepted(ns, head, found)) {
+      socket_failed(ns);
+      return;
+    }
+
+    ns->in.consume((size_t) (found - head) + 4);
+    ns->upgraded = true;
+    ns->state = WS_OPEN;
+    if (ns->onopen != nullptr) {
+      EmscriptenWebSocketOpenEvent e = {ns->id};
+      ns->onopen(EMSCRIPTEN_EVENT_WEB_SOCKET_OPEN, &e, ns->onopen_data);
+    }
+  }
+
+  while (!ns->deleted && ns->state != WS_CLOSED && !ns->linger) {
+    uint8_t *d = ns->in.data();
+    size_t n = ns->in.size();
+    if (n < 2) {
+      return;
+    }
+
+    bool fin = (d[0] & 0x80) != 0;
+    uint8_t op = (uint8_t) (d[0] & 0x0f);
+    bool masked = (d[1] & 0x80) != 0;
+    uint64_t len = d[1] & 0x7fu;
+    size_t head_len = 2;
+    if (len == 126) {
+      if (n < 4) {
+        return;
+      }
+      len = ((uint64_t) d[2] << 8) | d[3];
+      head_len = 4;
+    } else if (len == 127) {
+      if (n < 10) {
+        return;
+      }
+      len = 0;
+      for (int i = 0; i < 8; i++) {
+        len = (len << 8) | d[2 + i];
+      }
+      head_len = 10;
+    }
+
+    if (len > WS_MAX_MESSAGE_SIZE) {
+      socket_linger(ns, true, false, 1009, "", 0);
+      return;
+    }
+
+    uint8_t *mask = d + head_len;
+    if (masked) {
+      head_len += 4;
+    }
+    if (n < head_len || len > n - head_len) {
+      return;
+    }
+
+    uint8_t *payload = d + head_len;
+    if (masked) {
+      for (uint64_t i = 0; i < len; i++) {
+        payload[i] ^= mask[i & 3];
+      }
+    }
+    socket_frame(ns, fin, op, payload, len);
+    if (ns->state != WS_CLOSED && !ns->linger) {
+      ns->in.consume(head_len + (size_t) len);
+    }
+  }
+}
+
+static void socket_io_handler(int fd, uint32_t events, void *user_data) {
+  auto ns = (native_socket *) user_data;
+  socket_enter(ns);
+
+  if ((events & EPOLLOUT) && ns->out.size()) {
+    ssize_t n = write(fd, ns->out.data(), ns->out.size());
+    if (n < 0 && errno != EAGAIN) {
+      socket_failed(ns);
+    } else {
+      if (n > 0) {
+        socket_written(ns, (size_t) n);
+      }
+      if (ns->out.size() == 0 && ns->linger) {
+        socket_closed(ns, ns->linger_clean, ns->linger_code, ns->linger_reason, ns->linger_reason_len);
+      } else if (ns->out.size() == 0 && ns->io != nullptr) {
+        ext::loop::modify(ns->io, EPOLLIN);
+      }
+    }
+  }
+
+  char chunk[WS_READ_SIZE];
+  while (ns->state != WS_CLOSED && !ns->deleted && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n > 0) {
+      ns->in.append(chunk, (size_t) n);
+      socket_parse(ns);
+    } else if (n == 0) {
+      if (ns->state == WS_CONNECTING) {
+        socket_failed(ns);
+      } else if (ns->linger) {
+        socket_closed(ns, ns->linger_clean, ns->linger_code, ns->linger_reason, ns->linger_reason_len);
+      } else {
+        socket_closed(ns, false, 1006, "", 0);
+      }
+    } else {
+      if (errno != EAGAIN) {
+        socket_failed(ns);
+      }
+      break;
+    }
+  }
+
+  socket_leave(ns);
+}
+
+static void socket_fail_handler(void *user_data) {
+  auto ns = (native_socket *) user_data;
+  ns->timer = nullptr;
+  socket_enter(ns);
+  socket_failed(ns);
+  socket_leave(ns);
+}
+
+void emscripten_websocket_init_create_attributes(EmscriptenWebSocketCreateAttributes *attributes) {
+  memset(attributes, 0, sizeof(EmscriptenWebSocketCreateAttributes));
+  attributes->createOnMainThread = EM_TRUE;
+}
+
+EM_BOOL emscripten_websocket_is_supported(void) {
+  return EM_TRUE;
+}
+
+EMSCRIPTEN_WEBSOCKET_T emscripten_websocket_new(EmscriptenWebSocketCreateAttributes *attributes) {
+  ext::net::url parts;
+  if (attributes == nullptr || attributes->url == nullptr || !ext::net::parse_url(attributes->url, &parts)) {
+    return EMSCRIPTEN_RESULT_INVALID_PARAM;
+  }
+  if (strcmp(parts.scheme, "ws") != 0) {
+    free(parts.path);
+    return EMSCRIPTEN_RESULT_NOT_SUPPORTED;
+  }
+
+  auto ns = new native_socket();
+  ns->id = ++socket_id;
+  ns->state = WS_CONNECTING;
+  ext::net::random_bytes((uint8_t *) &ns->mask_seed, sizeof(ns->mask_seed));
+  ns->mask_seed |= 1;
+  sockets.add(ns->id, ns);
+
+  uint8_t nonce[16];
+  ext::net::random_bytes(nonce, sizeof(nonce));
+  char *key = b64_encode(nonce, sizeof(nonce));
+  uint8_t digest[20];
+  ext::net::sha1((const uint8_t *) key, strlen(key), (const uint8_t *) WS_GUID, sizeof(WS_GUID) - 1, digest);
+  char *accept = b64_encode(digest, sizeof(digest));
+  snprintf(ns->accept, sizeof(ns->accept), "%s", accept);
+  free(accept);
+
+  char line[512];
+  snprintf(line, sizeof(line), "GET %s HTTP/1.1\r\nHost: %s:%u\r\n", parts.path, parts.host, parts.port);
+  ns->out.append(line);
+  snprintf(line, sizeof(line), "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                               "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n", key);
+  ns->out.append(line);
+  if (attributes->protocols != nullptr && *attributes->protocols) {
+    ns->out.append("Sec-WebSocket-Protocol: ");
+    ns->out.append(attributes->protocols);
+    ns->out.append("\r\n");
+  }
+  ns->out.append("\r\n");
+  free(key);
+
+  // connection failures surface as error + close events, like the browser
+  ns->fd = ext::net::connect(parts.host, parts.port);
+  free(parts.path);
+  if (ns->fd == -1) {
+    ns->timer = ext::loop::set_timer(0, socket_fail_handler, ns);
+  } else {
+    ns->io = ext::loop::watch(ns->fd, EPOLLIN | EPOLLOUT, socket_io_handler, ns);
+  }
+  return ns->id;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onopen_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                           em_websocket_open_callback_func callback) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+  ns->onopen = callback;
+  ns->onopen_data = userData;
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onmessage_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                              em_websocket_message_callback_func callback) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+  ns->onmessage = callback;
+  ns->onmessage_data = userData;
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onerror_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                            em_websocket_error_callback_func callback) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+  ns->onerror = callback;
+  ns->onerror_data = userData;
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_set_onclose_callback(EMSCRIPTEN_WEBSOCKET_T socket, void *userData,
+                                                            em_websocket_close_callback_func callback) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+  ns->onclose = callback;
+  ns->onclose_data = userData;
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_send_utf8_text(EMSCRIPTEN_WEBSOCKET_T socket, const char *textData) {
+  return native_websocket_send_utf8_text(socket, textData, (uint32_t) strlen(textData));
+}
+
+EMSCRIPTEN_RESULT native_websocket_send_utf8_text(EMSCRIPTEN_WEBSOCKET_T socket, const char *textData,
+                                                  uint32_t dataLength) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr || ns->state != WS_OPEN) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+  socket_send_frame(ns, WS_OP_TEXT, textData, dataLength);
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_send_binary(EMSCRIPTEN_WEBSOCKET_T socket, void *binaryData,
+                                                   uint32_t dataLength) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr || ns->state != WS_OPEN) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+  socket_send_frame(ns, WS_OP_BINARY, binaryData, dataLength);
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_get_buffered_amount(EMSCRIPTEN_WEBSOCKET_T socket, size_t *bufferedAmount) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr || bufferedAmount == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_PARAM;
+  }
+  // the frame being written counts with the part of its payload still unsent
+  size_t amount = ns->pending_payload;
+  if (ns->pending.size() != 0) {
+    ws_pending p;
+    memcpy(&p, ns->pending.data(), sizeof(p));
+    uint64_t unsent = p.end - ns->out_sent;
+    if (unsent < p.payload) {
+      amount -= (size_t) (p.payload - unsent);
+    }
+  }
+  *bufferedAmount = amount;
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_close(EMSCRIPTEN_WEBSOCKET_T socket, unsigned short code, const char *reason) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+
+  if (ns->state == WS_CONNECTING) {
+    ext::loop::clear_timer(ns->timer);
+    ns->timer = ext::loop::set_timer(0, socket_fail_handler, ns);
+  } else if (ns->state == WS_OPEN) {
+    // the close event fires once the server echoes the close frame
+    uint8_t payload[125];
+    size_t len = 0;
+    if (code != 0) {
+      payload[0] = (uint8_t) (code >> 8);
+      payload[1] = (uint8_t) code;
+      len = 2;
+      if (reason != nullptr) {
+        size_t reason_len = strlen(reason);
+        if (reason_len > sizeof(payload) - 2) {
+          reason_len = sizeof(payload) - 2;
+        }
+        memcpy(payload + 2, reason, reason_len);
+        len += reason_len;
+      }
+    }
+    socket_send_frame(ns, WS_OP_CLOSE, payload, len);
+    ns->state = WS_CLOSING;
+  }
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
+EMSCRIPTEN_RESULT emscripten_websocket_delete(EMSCRIPTEN_WEBSOCKET_T socket) {
+  native_socket *ns = socket_get(socket);
+  if (ns == nullptr) {
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  }
+
+  ns->deleted = true;
+  if (ns->dispatching == 0) {
+    socket_free(ns);
+  }
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
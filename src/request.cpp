@@ -1,68 +1,163 @@
+#include <cstdlib>
+#include <strings.h>
 #include "request.hpp"
+#include "helper.hpp"
+
+const jerry_object_native_info_t ext::request::native_info = {nullptr};
+
+ext::request::state::state() : waiting_head(nullptr),
+                               waiting_tail(nullptr),
+                               ready_head(nullptr),
+                               ready_tail(nullptr),
+                               lru_head(nullptr),
+                               lru_tail(nullptr),
+                               cache_bytes(0),
+                               stream_id(1),
+                               stream_proto(JERRY_UNDEFINED),
+                               host(host_ref::create()),
+                               config{REQUEST_MAX_ACTIVE, REQUEST_CACHE_ENTRIES, REQUEST_CACHE_BYTES},
+                               stats() {
+}
+
+void ext::request::state::release() {
+  active.foreach([](unsigned int id, job *j, void *user_data) -> void {
+    emscripten_fetch_close(j->fetch);
+    free_job(j);
+  }, nullptr);
 
-map<unsigned int, ext::request::request_item> ext::request::request_map;
+  while (waiting_head != nullptr) {
+    job *next = waiting_head->next;
+    free_job(waiting_head);
+    waiting_head = next;
+  }
+  while (ready_head != nullptr) {
+    job *next = ready_head->next;
+    free_job(ready_head);
+    ready_head = next;
+  }
+
+  while (lru_head != nullptr) {
+    cache_entry *next = lru_head->next;
+    release_response(lru_head->resp);
+    delete lru_head;
+    lru_head = next;
+  }
+  jerry_release_value(stream_proto);
+
+  host->orphan();
+  host = nullptr;
+}
 
 int ext::request::init() {
+  static constexpr binding bindings[] = {
+    {"request", request_wrap, nullptr, BINDING_METHOD},
+  };
+  static constexpr binding stream_bindings[] = {
+    {"pause", stream_pause, nullptr, BINDING_METHOD},
+    {"resume", stream_resume, nullptr, BINDING_METHOD},
+    {"abort", stream_abort, nullptr, BINDING_METHOD},
+  };
+
   jerry_value_t global_object = jerry_get_global_object();
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, request, request_wrap);
+  ext::names::install(global_object, bindings);
   jerry_release_value(global_object);
+
+  jerry_value_t stream_proto = jerry_create_object();
+  ext::names::install(stream_proto, stream_bindings);
+  context_data<state>::get()->stream_proto = stream_proto;
   return 0;
 }
 
+void ext::request::config(const security_worker_request_config_t *config) {
+  auto s = context_data<state>::get();
+  s->config = *config;
+  while (s->lru_tail != nullptr && (s->cache.size() > s->config.cache_entries ||
+                                    s->cache_bytes > s->config.cache_bytes)) {
+    cache_remove(s, s->lru_tail);
+  }
+
+  // a raised limit lets waiting fetches start
+  pump(s);
+}
+
+void ext::request::stats(security_worker_request_stats_t *out, security_worker_request_origin_t origin,
+                         void *user_data) {
+  struct origin_walk {
+    security_worker_request_origin_t func;
+    void *user_data;
+  };
+
+  auto s = context_data<state>::get();
+  *out = s->stats;
+  if (origin != nullptr) {
+    origin_walk walk{origin, user_data};
+    s->origins.foreach([](string name, security_worker_request_stats_t stats, void *user_data) -> void {
+      auto walk = (origin_walk *) user_data;
+      walk->func(name.c_str(), &stats, walk->user_data);
+    }, &walk);
+  }
+}
+
 JERRY_EXTERNAL_FUNC(ext::request::request_wrap) {
   if (args_cnt == 0 || !jerry_value_is_object(*args_p)) {
     return JERRY_UNDEFINED;
   }
 
-  ext::request::request_item item{0};
   jerry_value_t param = jerry_value_to_object(*args_p);
 
   // request uri
   string uri_str;
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, uri)
-  if (jerry_value_is_undefined(uri_prop)) {
-    return JERRY_UNDEFINED;
-  } else {
-    JERRY_CONV_STR_TO_CHAR_BUFFER(uri, uri_len, uri_chs, &uri_prop);
-    uri_str << (char *) uri_chs;
+  if (!jerry_value_is_undefined(uri_prop)) {
+    JERRY_VIEW_STR_CHARS(uri, uri_len, uri_chs, &uri_prop);
+    uri_str.append((const char *) uri_chs, uri_len);
   }
+  bool has_uri = !jerry_value_is_undefined(uri_prop);
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(uri)
+  if (!has_uri) {
+    jerry_release_value(param);
+    return JERRY_UNDEFINED;
+  }
 
   // callback retain
-  jerry_acquire_value(param);
-  item.this_val = param;
+  auto w = new waiter{jerry_acquire_value(param), JERRY_UNDEFINED, JERRY_UNDEFINED, JERRY_UNDEFINED, false, nullptr};
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, success)
   if (jerry_value_is_function(success_prop)) {
-    jerry_acquire_value(success_prop);
-    item.onsuccess = success_prop;
+    w->onsuccess = jerry_acquire_value(success_prop);
   }
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(success)
 
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, error)
   if (jerry_value_is_function(error_prop)) {
-    jerry_acquire_value(error_prop);
-    item.onerror = error_prop;
+    w->onerror = jerry_acquire_value(error_prop);
   }
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(error)
 
+  JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, onchunk)
+  if (jerry_value_is_function(onchunk_prop)) {
+    w->onchunk = jerry_acquire_value(onchunk_prop);
+  }
+  JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(onchunk)
+
+  auto j = new job();
+  j->url = uri_str;
+
   // request method: GET/POST/HEAD...
-  string method_str;
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, method)
   if (jerry_value_is_undefined(method_prop)) {
-    method_str << "GET";
+    j->method << "GET";
   } else {
-    JERRY_CONV_STR_TO_CHAR_BUFFER(method, method_len, method_chs, &method_prop);
-    method_str << (char *) method_chs;
+    JERRY_VIEW_STR_CHARS(method, method_len, method_chs, &method_prop);
+    j->method.append((const char *) method_chs, method_len);
   }
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(method)
 
   // request data
-  string data_str;
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, body)
   if (!jerry_value_is_undefined(body_prop)) {
-    if (!(method_str == string("GET") || method_str == string("HEAD"))) {
-      JERRY_CONV_STR_TO_CHAR_BUFFER(body, body_len, body_chs, &body_prop);
-      data_str << (char *) body_chs;
+    if (!(j->method == string("GET") || j->method == string("HEAD"))) {
+      JERRY_VIEW_STR_CHARS(body, body_len, body_chs, &body_prop);
+      j->body.append((const char *) body_chs, body_len);
     }
   }
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(body)
@@ -70,7 +165,7 @@ JERRY_EXTERNAL_FUNC(ext::request::request_wrap) {
   // request headers
   uint32_t headers_len = 0;
   string *headers[MAX_HEADERS_LEN];
-  memset(headers, NULL, MAX_HEADERS_LEN * sizeof(string *));
+  memset(headers, 0, MAX_HEADERS_LEN * sizeof(string *));
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, headers)
   if (!jerry_value_is_undefined(headers_prop)) {
     auto foreach_func = [](
@@ -80,9 +175,9 @@ JERRY_EXTERNAL_FUNC(ext::request::request_wrap) {
     ) -> bool {
       auto headers = (string **) user_data_p;
       int32_t index = -1;
-      JERRY_CONV_STR_TO_CHAR_BUFFER(name, name_len, name_buffer, &prop_name);
-      JERRY_CONV_STR_TO_CHAR_BUFFER(val, val_len, val_buffer, &prop_value);
-      for (uint32_t i = 0; i < MAX_HEADERS_LEN; i++) {
+      JERRY_VIEW_STR_CHARS(name, name_len, name_buffer, &prop_name);
+      JERRY_VIEW_STR_CHARS(val, val_len, val_buffer, &prop_value);
+      for (uint32_t i = 0; i + 1 < MAX_HEADERS_LEN; i++) {
         if (headers[i] == NULL) {
           index = i;
           break;
@@ -93,8 +188,8 @@ JERRY_EXTERNAL_FUNC(ext::request::request_wrap) {
         return false;
       }
 
-      headers[index] = new string((char *) name_buffer);
-      headers[index + 1] = new string((char *) val_buffer);
+      headers[index] = new string((const char *) name_buffer, name_len);
+      headers[index + 1] = new string((const char *) val_buffer, val_len);
       return true;
     };
 
@@ -109,142 +204,664 @@ JERRY_EXTERNAL_FUNC(ext::request::request_wrap) {
   }
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(headers)
 
+  j->headers = new string[headers_len];
+  j->headers_len = headers_len;
+  for (uint32_t i = 0; i < headers_len; i++) {
+    j->headers[i] = std::move(*headers[i]);
+    delete headers[i];
+  }
+
   // request timeout
-  uint32_t timeout = 20 * 1000;
+  j->timeout = 20 * 1000;
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, timeout)
   if (!jerry_value_is_undefined(timeout_prop)) {
     jerry_value_t conv_timeout_prop = jerry_value_to_number(timeout_prop);
-    timeout = (uint32_t) jerry_get_number_value(conv_timeout_prop);
+    j->timeout = (uint32_t) jerry_get_number_value(conv_timeout_prop);
     jerry_release_value(conv_timeout_prop);
   }
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(timeout)
 
+  // response body as text (default) or as an ArrayBuffer
+  JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, responseType)
+  if (jerry_value_is_string(responseType_prop)) {
+    JERRY_CONV_STR_TO_CHAR_BUFFER(response_type, response_type_len, response_type_chs, &responseType_prop);
+    w->binary = strcmp((char *) response_type_chs, "arraybuffer") == 0;
+  }
+  JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(responseType)
+
   // cors credentials
-  bool with_credentials = false;
   JERRY_SAFE_GET_OBJ_KEY_BLOCK(param, withCredentials)
   if (!jerry_value_is_undefined(withCredentials_prop)) {
-    with_credentials = jerry_value_to_boolean(withCredentials_prop);
+    j->with_credentials = jerry_value_to_boolean(withCredentials_prop);
   }
   JERRY_SAFE_GET_OBJ_KEY_BLOCK_END(withCredentials)
 
-#ifdef __EMSCRIPTEN__
+  jerry_release_value(param);
+
+  // scheme://host[:port], relative urls count as the page origin ""
+  const char *url = j->url.c_str();
+  const char *host = strstr(url, "://");
+  if (host != nullptr) {
+    j->origin = string(url, (host - url) + 3 + strcspn(host + 3, "/?#"));
+  }
+
+  auto s = context_data<state>::get();
+  jerry_value_t handle = JERRY_UNDEFINED;
+  if (jerry_value_is_function(w->onchunk)) {
+    // a stream is never shared or cached, its body is not kept
+    j->stream = s->stream_id++;
+    s->streams.add(j->stream, j);
+    handle = jerry_create_object();
+    jerry_release_value(jerry_set_prototype(handle, s->stream_proto));
+    jerry_set_object_native_pointer(handle, j, &native_info);
+    j->handle = jerry_acquire_value(handle);
+  } else if (j->method == string("GET")) {
+    j->key << j->url;
+    for (uint32_t i = 0; i + 1 < j->headers_len; i += 2) {
+      j->key << '\n' << j->headers[i] << ':' << j->headers[i + 1];
+    }
+  }
+
+  submit(s, j, w);
+  return handle;
+}
+
+JERRY_EXTERNAL_FUNC(ext::request::stream_pause) {
+  job *j = stream_job(this_value);
+  if (j != nullptr) {
+    set_paused(j, true);
+  }
+  return JERRY_UNDEFINED;
+}
+
+JERRY_EXTERNAL_FUNC(ext::request::stream_resume) {
+  job *j = stream_job(this_value);
+  if (j != nullptr) {
+    set_paused(j, false);
+  }
+  return JERRY_UNDEFINED;
+}
+
+JERRY_EXTERNAL_FUNC(ext::request::stream_abort) {
+  job *j = stream_job(this_value);
+  if (j == nullptr) {
+    return JERRY_UNDEFINED;
+  }
+
+  // no callback runs, like closing the fetch
+  auto s = context_data<state>::get();
+  s->streams.remove(j->stream);
+  if (j->fetch != nullptr) {
+    s->active.remove(j->fetch->id);
+    s->stats.active -= 1;
+    origin_stats(s, j->origin)->active -= 1;
+    emscripten_fetch_close(j->fetch);
+    pump(s);
+  } else {
+    job *prev = nullptr;
+    for (job *it = s->waiting_head; it != j; it = it->next) {
+      prev = it;
+    }
+    if (prev != nullptr) {
+      prev->next = j->next;
+    } else {
+      s->waiting_head = j->next;
+    }
+    if (s->waiting_tail == j) {
+      s->waiting_tail = prev;
+    }
+    s->stats.waiting -= 1;
+    origin_stats(s, j->origin)->waiting -= 1;
+  }
+  free_job(j);
+  return JERRY_UNDEFINED;
+}
+
+ext::request::job *ext::request::stream_job(jerry_value_t this_value) {
+  void *j = nullptr;
+  const jerry_object_native_info_t *info = nullptr;
+  if (!jerry_get_object_native_pointer(this_value, &j, &info) || info != &native_info) {
+    return nullptr;
+  }
+  return (job *) j;
+}
+
+void ext::request::set_paused(job *j, bool paused) {
+  j->paused = paused;
+#ifndef __EMSCRIPTEN__
+  if (j->fetch != nullptr) {
+    native_fetch_pause(j->fetch, (EM_BOOL) paused);
+  }
+#endif
+}
+
+void ext::request::submit(state *s, job *j, waiter *w) {
+  s->stats.requests += 1;
+  origin_stats(s, j->origin)->requests += 1;
+
+  if (j->key.size() == 0) {
+    // like any shared cache, unsafe methods drop what is kept for the url
+    if (!(j->method == string("HEAD") || j->method == string("OPTIONS"))) {
+      cache_invalidate(s, j->url);
+    }
+  } else {
+    cache_entry *e = s->config.cache_entries != 0 ? cache_get(s, j->key) : nullptr;
+    if (e != nullptr && e->expires > emscripten_get_now()) {
+      s->stats.cache_hits += 1;
+      origin_stats(s, j->origin)->cache_hits += 1;
+      j->resp = e->resp;
+      j->resp->refs += 1;
+      j->waiters = j->waiters_tail = w;
+      if (s->ready_head == nullptr) {
+        s->host->async_call(async_call_handler, 0);
+        s->ready_head = j;
+      } else {
+        s->ready_tail->next = j;
+      }
+      s->ready_tail = j;
+      return;
+    }
+
+    job **joined = s->shared.get(j->key);
+    if (joined != nullptr) {
+      s->stats.coalesced += 1;
+      origin_stats(s, j->origin)->coalesced += 1;
+      (*joined)->waiters_tail->next = w;
+      (*joined)->waiters_tail = w;
+      free_job(j);
+      return;
+    }
+    s->shared.add(j->key, j);
+  }
+
+  j->waiters = j->waiters_tail = w;
+  if (s->waiting_head == nullptr) {
+    s->waiting_head = j;
+  } else {
+    s->waiting_tail->next = j;
+  }
+  s->waiting_tail = j;
+  s->stats.waiting += 1;
+  origin_stats(s, j->origin)->waiting += 1;
+  pump(s);
+}
+
+void ext::request::pump(state *s) {
+  while (s->waiting_head != nullptr && (s->config.max_active == 0 || s->stats.active < s->config.max_active)) {
+    job *j = s->waiting_head;
+    s->waiting_head = j->next;
+    if (s->waiting_head == nullptr) {
+      s->waiting_tail = nullptr;
+    }
+    j->next = nullptr;
+    s->stats.waiting -= 1;
+    origin_stats(s, j->origin)->waiting -= 1;
+    start(s, j);
+  }
+}
+
+void ext::request::start(state *s, job *j) {
   emscripten_fetch_attr_t attr;
   emscripten_fetch_attr_init(&attr);
-  strcpy(attr.requestMethod, method_str.c_str());
+  strncpy(attr.requestMethod, j->method.c_str(), sizeof(attr.requestMethod) - 1);
 
-  if(data_str.size()){
-    char *requestData = new char[data_str.size() + 1];
-    memset(requestData, '\0', data_str.size() + 1);
-    strcpy(requestData, data_str.c_str());
-    attr.requestDataSize = data_str.size();
-    attr.requestData = requestData;
-    attr.userData = (void *)requestData;
+  // the request body is copied by emscripten_fetch
+  if (j->body.size()) {
+    attr.requestDataSize = j->body.size();
+    attr.requestData = j->body.c_str();
   }
+  attr.userData = (void *) ext::context::current();
 
-  attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_REPLACE;
-  attr.timeoutMSecs = (unsigned long)timeout;
-  attr.withCredentials = (EM_BOOL)with_credentials;
+  attr.attributes = (j->stream ? EMSCRIPTEN_FETCH_STREAM_DATA : EMSCRIPTEN_FETCH_LOAD_TO_MEMORY) |
+                    EMSCRIPTEN_FETCH_REPLACE;
+  attr.timeoutMSecs = (unsigned long) j->timeout;
+  attr.withCredentials = (EM_BOOL) j->with_credentials;
 
-  char **headers_chs = new char *[headers_len + 1];
-  headers_chs[headers_len] = nullptr;
-  for(uint32_t i = 0; i < headers_len; i++){
-    headers_chs[i] = new char[headers[i]->size() + 1];
-    memset(headers_chs[i], '\0', headers[i]->size() + 1);
-    memcpy(headers_chs[i], headers[i]->c_str(), headers[i]->size());
-    delete headers[i];
-    headers[i] = nullptr;
+  // a stale entry is asked for again only if it changed
+  auto headers_chs = new const char *[j->headers_len + 5];
+  uint32_t headers_len = 0;
+  for (uint32_t i = 0; i + 1 < j->headers_len; i += 2) {
+    headers_chs[headers_len++] = j->headers[i].c_str();
+    headers_chs[headers_len++] = j->headers[i + 1].c_str();
   }
+  cache_entry **stale = j->key.size() ? s->cache.get(j->key) : nullptr;
+  if (stale != nullptr && (*stale)->etag.size()) {
+    headers_chs[headers_len++] = "If-None-Match";
+    headers_chs[headers_len++] = (*stale)->etag.c_str();
+  }
+  if (stale != nullptr && (*stale)->last_modified.size()) {
+    headers_chs[headers_len++] = "If-Modified-Since";
+    headers_chs[headers_len++] = (*stale)->last_modified.c_str();
+  }
+  headers_chs[headers_len] = nullptr;
   attr.requestHeaders = headers_chs;
 
   attr.onsuccess = ext::request::onsuccess;
   attr.onerror = ext::request::onerror;
+  if (j->stream) {
+    attr.onprogress = ext::request::onprogress;
+  }
 
-  auto fetch = emscripten_fetch(&attr, uri_str.c_str());
-  request_map.add(fetch->id, item);
+  j->fetch = emscripten_fetch(&attr, j->url.c_str());
+  if (j->paused) {
+    set_paused(j, true);
+  }
+  s->active.add(j->fetch->id, j);
+  s->stats.active += 1;
+  s->stats.fetches += 1;
+  security_worker_request_stats_t *origin = origin_stats(s, j->origin);
+  origin->active += 1;
+  origin->fetches += 1;
 
-  memset(&attr, 0, sizeof(attr));
   delete[] headers_chs;
-  headers_chs = nullptr;
-#endif
+}
 
-  jerry_release_value(param);
+void ext::request::complete(emscripten_fetch_t *fetch, bool ok) {
+  ext::context::scope scope((jerry_context_t *) fetch->userData);
+  auto s = context_data<state>::get();
+  job **found = s->active.get(fetch->id);
+  if (found == nullptr) {
+    return;
+  }
 
-  return JERRY_UNDEFINED;
+  job *j = *found;
+  s->active.remove(fetch->id);
+  s->stats.active -= 1;
+  origin_stats(s, j->origin)->active -= 1;
+  job **shared = j->key.size() ? s->shared.get(j->key) : nullptr;
+  if (shared != nullptr && *shared == j) {
+    s->shared.remove(j->key);
+  }
+  if (j->stream) {
+    s->streams.remove(j->stream);
+  }
+
+  size_t headers_len = emscripten_fetch_get_response_headers_length(fetch);
+  auto headers = (char *) malloc(headers_len + 1);
+  headers[emscripten_fetch_get_response_headers(fetch, headers, headers_len + 1) ? headers_len : 0] = '\0';
+
+  response *resp;
+  cache_entry *e = fetch->status == 304 && j->key.size() ? cache_get(s, j->key) : nullptr;
+  if (e != nullptr) {
+    // the kept body is still current, the 304 only renews its lifetime
+    s->stats.revalidated += 1;
+    origin_stats(s, j->origin)->revalidated += 1;
+    resp = e->resp;
+    resp->refs += 1;
+    if (!cache_freshness(headers, &e->expires)) {
+      cache_remove(s, e);
+    } else {
+      header_value(headers, "ETag", e->etag);
+    }
+    ok = true;
+  } else {
+    // a streamed body was handed out already, only its length is left
+    resp = new response{1, fetch->status, {0}, nullptr, (size_t) fetch->totalBytes};
+    strncpy(resp->status_text, fetch->statusText, sizeof(resp->status_text) - 1);
+    if (fetch->data != nullptr) {
+      // the body is taken over, emscripten_fetch_close leaves it alone
+      resp->data = (uint8_t *) fetch->data;
+      fetch->data = nullptr;
+    }
+
+    s->stats.bytes += resp->len;
+    security_worker_request_stats_t *origin = origin_stats(s, j->origin);
+    origin->bytes += resp->len;
+    if (!ok) {
+      s->stats.failed += 1;
+      origin->failed += 1;
+    } else if (j->key.size() && resp->status == 200 && s->config.cache_entries != 0) {
+      cache_put(s, j->key, resp, headers);
+    }
+  }
+
+  free(headers);
+  emscripten_fetch_close(fetch);
+  j->fetch = nullptr;
+  if (j->stream) {
+    // the stream is over, abort() from the callbacks below finds nothing to stop
+    jerry_set_object_native_pointer(j->handle, nullptr, &native_info);
+  }
+
+  // the freed slot goes to the next waiting fetch before the callbacks run
+  pump(s);
+  deliver(j, resp, ok);
+  release_response(resp);
+  free_job(j);
+  ext::helper::flush();
+}
+
+void ext::request::deliver(job *j, response *resp, bool ok) {
+  for (waiter *w = j->waiters; w != nullptr; w = w->next) {
+    jerry_value_t callback = ok ? w->onsuccess : w->onerror;
+    if (!jerry_value_is_function(callback)) {
+      continue;
+    }
+
+    // only the last caller of a body nobody else holds gets it without a copy
+    jerry_value_t resp_val = conv_response_data(resp, w->binary, w->next == nullptr && resp->refs == 1);
+    jerry_value_t retval = jerry_call_function(callback, w->this_val, &resp_val, 1);
+    ext::error::log_runtime_error(retval);
+    jerry_release_value(retval);
+    jerry_release_value(resp_val);
+  }
+}
+
+void ext::request::async_call_handler(void *user_data) {
+  jerry_context_t *context = host_ref::resolve(user_data);
+  if (context == nullptr) {
+    return;
+  }
+
+  ext::context::scope scope(context);
+  auto s = context_data<state>::get();
+
+  // hits added by the callbacks below wait for the next turn
+  job *j = s->ready_head;
+  s->ready_head = s->ready_tail = nullptr;
+  while (j != nullptr) {
+    job *next = j->next;
+    deliver(j, j->resp, true);
+    free_job(j);
+    j = next;
+  }
+
+  ext::helper::flush();
+}
+
+void ext::request::free_job(job *j) {
+  for (waiter *w = j->waiters, *next; w != nullptr; w = next) {
+    next = w->next;
+    jerry_release_value(w->this_val);
+    jerry_release_value(w->onsuccess);
+    jerry_release_value(w->onerror);
+    jerry_release_value(w->onchunk);
+    delete w;
+  }
+
+  if (j->stream != 0) {
+    // the handle outlives the job, its methods turn into no-ops
+    jerry_set_object_native_pointer(j->handle, nullptr, &native_info);
+    jerry_release_value(j->handle);
+  }
+  if (j->resp != nullptr) {
+    release_response(j->resp);
+  }
+  delete[] j->headers;
+  delete j;
 }
 
-#ifdef __EMSCRIPTEN__
-jerry_value_t ext::request::conv_response_data(emscripten_fetch_t *fetch) {
-  jerry_value_t resp = jerry_create_object();
+void ext::request::release_response(response *resp) {
+  if (--resp->refs == 0) {
+    free(resp->data);
+    delete resp;
+  }
+}
+
+ext::request::cache_entry *ext::request::cache_get(state *s, const string &key) {
+  cache_entry **found = s->cache.get(key);
+  if (found == nullptr) {
+    return nullptr;
+  }
+
+  cache_entry *e = *found;
+  if (e != s->lru_head) {
+    e->prev->next = e->next;
+    if (e->next != nullptr) {
+      e->next->prev = e->prev;
+    } else {
+      s->lru_tail = e->prev;
+    }
+    e->prev = nullptr;
+    e->next = s->lru_head;
+    s->lru_head->prev = e;
+    s->lru_head = e;
+  }
+  return e;
+}
+
+void ext::request::cache_put(state *s, const string &key, response *resp, const char *headers) {
+  double expires;
+  if (resp->len > s->config.cache_bytes || !cache_freshness(headers, &expires)) {
+    return;
+  }
+
+  // a response that is already stale is only worth keeping if it can be revalidated
+  auto e = new cache_entry{key, resp, string(), string(), expires, nullptr, nullptr};
+  header_value(headers, "ETag", e->etag);
+  header_value(headers, "Last-Modified", e->last_modified);
+  if (expires <= emscripten_get_now() && e->etag.size() == 0 && e->last_modified.size() == 0) {
+    delete e;
+    return;
+  }
+
+  cache_entry **found = s->cache.get(key);
+  if (found != nullptr) {
+    cache_remove(s, *found);
+  }
 
-  jerry_value_t status_val = jerry_create_number((double)fetch->status);
-  JERRY_SET_PROPERTY(resp, status, status_val);
+  resp->refs += 1;
+  e->next = s->lru_head;
+  if (s->lru_head != nullptr) {
+    s->lru_head->prev = e;
+  } else {
+    s->lru_tail = e;
+  }
+  s->lru_head = e;
+  s->cache.add(key, e);
+  s->cache_bytes += resp->len;
+
+  while (s->cache.size() > s->config.cache_entries || s->cache_bytes > s->config.cache_bytes) {
+    cache_remove(s, s->lru_tail);
+  }
+}
+
+void ext::request::cache_remove(state *s, cache_entry *e) {
+  if (e->prev != nullptr) {
+    e->prev->next = e->next;
+  } else {
+    s->lru_head = e->next;
+  }
+  if (e->next != nullptr) {
+    e->next->prev = e->prev;
+  } else {
+    s->lru_tail = e->prev;
+  }
+
+  s->cache.remove(e->key);
+  s->cache_bytes -= e->resp->len;
+  release_response(e->resp);
+  delete e;
+}
+
+void ext::request::cache_invalidate(state *s, const string &url) {
+  for (cache_entry *e = s->lru_head, *next; e != nullptr; e = next) {
+    next = e->next;
+    // keys are the url, then one line per request header
+    if (e->key.size() >= url.size() && memcmp(e->key.c_str(), url.c_str(), url.size()) == 0 &&
+        (e->key.size() == url.size() || e->key.c_str()[url.size()] == '\n')) {
+      cache_remove(s, e);
+    }
+  }
+}
+
+bool ext::request::cache_freshness(const char *headers, double *expires) {
+  string cache_control;
+  header_value(headers, "Cache-Control", cache_control);
+
+  // Expires is not read, without max-age a response is stale right away
+  double lifetime = 0;
+  const char *directive = cache_control.c_str();
+  while (*directive != '\0') {
+    directive += strspn(directive, " ,");
+    size_t len = strcspn(directive, " ,");
+    if (len == 8 && strncasecmp(directive, "no-store", len) == 0) {
+      return false;
+    } else if (len == 8 && strncasecmp(directive, "no-cache", len) == 0) {
+      lifetime = -1;
+    } else if (strncasecmp(directive, "max-age=", 8) == 0 && lifetime >= 0) {
+      lifetime = strtod(directive + 8, nullptr);
+    }
+    directive += len;
+  }
+
+  string age;
+  if (lifetime > 0 && header_value(headers, "Age", age)) {
+    lifetime -= strtod(age.c_str(), nullptr);
+  }
+
+  *expires = emscripten_get_now() + (lifetime > 0 ? lifetime * 1000 : 0);
+  return true;
+}
+
+bool ext::request::header_value(const char *headers, const char *name, string &out) {
+  // header lines are `name: value`, a repeated header joins its values with commas
+  bool found = false;
+  size_t name_len = strlen(name);
+  for (const char *line = headers; *line != '\0';) {
+    size_t line_len = strcspn(line, "\r\n");
+    if (line_len > name_len && line[name_len] == ':' && strncasecmp(line, name, name_len) == 0) {
+      const char *value = line + name_len + 1;
+      value += strspn(value, " \t");
+      if (found) {
+        out << ", ";
+      } else {
+        out.clear();
+      }
+      out.append(value, (size_t) (line + line_len - value));
+      found = true;
+    }
+    line += line_len;
+    line += strspn(line, "\r\n");
+  }
+  return found;
+}
+
+security_worker_request_stats_t *ext::request::origin_stats(state *s, const string &origin) {
+  security_worker_request_stats_t *stats = s->origins.get(origin);
+  if (stats == nullptr) {
+    s->origins.add(origin, security_worker_request_stats_t());
+    stats = s->origins.get(origin);
+  }
+  return stats;
+}
+
+jerry_value_t ext::request::conv_response_data(response *resp, bool binary, bool take) {
+  jerry_value_t resp_val = jerry_create_object();
+
+  jerry_value_t status_val = jerry_create_number((double) resp->status);
+  JERRY_SET_NAMED_PROPERTY(resp_val, status, status_val);
   jerry_release_value(status_val);
 
-  jerry_value_t status_text_val = JERRY_STRING(fetch->statusText);
-  JERRY_SET_PROPERTY(resp, statusText, status_val);
+  jerry_value_t status_text_val = JERRY_STRING(resp->status_text);
+  JERRY_SET_NAMED_PROPERTY(resp_val, statusText, status_text_val);
   jerry_release_value(status_text_val);
 
-  jerry_value_t total_bytes_val = jerry_create_number((double) fetch->totalBytes);
-  JERRY_SET_PROPERTY(resp, totalBytes, total_bytes_val);
+  jerry_value_t total_bytes_val = jerry_create_number((double) resp->len);
+  JERRY_SET_NAMED_PROPERTY(resp_val, totalBytes, total_bytes_val);
   jerry_release_value(total_bytes_val);
 
-  char *data = new char[fetch->totalBytes + 1];
-  memset(data, '\0', fetch->totalBytes + 1);
-  memcpy(data, fetch->data, fetch->totalBytes);
-  jerry_value_t data_val = JERRY_STRING(data);
-  JERRY_SET_PROPERTY(resp, text, data_val);
-  jerry_release_value(data_val);
-  delete[] data;
-  data = nullptr;
+  if (binary) {
+    // a body taken over is freed by the ArrayBuffer once collected, a shared
+    // one is copied so the caller can not change what the others see
+    jerry_value_t buffer_val;
+    if (resp->data != nullptr && resp->len != 0 && take) {
+      buffer_val = jerry_create_arraybuffer_external((jerry_length_t) resp->len, resp->data, free);
+      resp->data = nullptr;
+    } else {
+      buffer_val = jerry_create_arraybuffer((jerry_length_t) (resp->data != nullptr ? resp->len : 0));
+      if (resp->data != nullptr && resp->len != 0) {
+        jerry_arraybuffer_write(buffer_val, 0, resp->data, (jerry_length_t) resp->len);
+      }
+    }
+    JERRY_SET_NAMED_PROPERTY(resp_val, response, buffer_val);
+    jerry_release_value(buffer_val);
+  } else {
+    jerry_value_t data_val = conv_response_text(resp->data, resp->data == nullptr ? 0 : resp->len);
+    JERRY_SET_NAMED_PROPERTY(resp_val, text, data_val);
+    jerry_release_value(data_val);
+  }
 
-  return resp;
+  return resp_val;
 }
-#endif
 
-#ifdef __EMSCRIPTEN__
-void ext::request::onsuccess(emscripten_fetch_t *fetch) {
-  uint32_t index = request_map.find(fetch->id);
-  if(index == -1){
-    return;
+jerry_value_t ext::request::conv_response_text(const uint8_t *data, size_t len) {
+  if (jerry_is_valid_utf8_string(data, (jerry_size_t) len)) {
+    return jerry_create_string_sz_from_utf8(data, (jerry_size_t) len);
   }
 
-  request_item *item = request_map.get(fetch->id);
-  if(jerry_value_is_function(item->onsuccess)){
-    jerry_value_t resp = ext::request::conv_response_data(fetch);
-    jerry_value_t retval = jerry_call_function(item->onsuccess, item->this_val, &resp, 1);
-    ext::error::log_runtime_error(retval);
-    jerry_release_value(retval);
-    jerry_release_value(resp);
+  // like TextDecoder, each byte that does not start a valid sequence turns
+  // into U+FFFD; only bodies that need it pay for the copy
+  auto text = (uint8_t *) malloc(len * 3);
+  size_t text_len = 0;
+  for (size_t i = 0; i < len;) {
+    uint8_t b = data[i];
+    size_t n = b < 0x80 ? 1 : (b & 0xe0) == 0xc0 ? 2 : (b & 0xf0) == 0xe0 ? 3 : (b & 0xf8) == 0xf0 ? 4 : 0;
+    if (n != 0 && n <= len - i && jerry_is_valid_utf8_string(data + i, (jerry_size_t) n)) {
+      memcpy(text + text_len, data + i, n);
+      text_len += n;
+      i += n;
+    } else {
+      memcpy(text + text_len, "\xef\xbf\xbd", 3);
+      text_len += 3;
+      i += 1;
+    }
   }
 
-  jerry_release_value(item->this_val);
-  jerry_release_value(item->onsuccess);
-  jerry_release_value(item->onerror);
-  request_map.remove(fetch->id);
-  emscripten_fetch_close(fetch);
+  jerry_value_t retval = jerry_create_string_sz_from_utf8(text, (jerry_size_t) text_len);
+  free(text);
+  return retval;
 }
-#endif
 
-#ifdef __EMSCRIPTEN__
-void ext::request::onerror(emscripten_fetch_t *fetch) {
-  uint32_t index = request_map.find(fetch->id);
-  if(index == -1){
+void ext::request::onprogress(emscripten_fetch_t *fetch) {
+  // browsers also report progress without handing data over
+  if (fetch->data == nullptr || fetch->numBytes == 0) {
     return;
   }
 
-  request_item item = *request_map.get(fetch->id);
-  if(jerry_value_is_function(item.onerror)){
-    jerry_value_t resp = ext::request::conv_response_data(fetch);
-    jerry_value_t retval = jerry_call_function(item.onerror, item.this_val, &resp, 1);
-    ext::error::log_runtime_error(retval);
-    jerry_release_value(retval);
-    jerry_release_value(resp);
+  ext::context::scope scope((jerry_context_t *) fetch->userData);
+  job **found = context_data<state>::get()->active.get(fetch->id);
+  if (found == nullptr) {
+    return;
   }
 
-  jerry_release_value(item.this_val);
-  jerry_release_value(item.onsuccess);
-  jerry_release_value(item.onerror);
-  request_map.remove(fetch->id);
-  emscripten_fetch_close(fetch);
+  // the slice is copied out of the engine heap, the fetch reuses its buffer;
+  // the callback may abort the stream, so the job is not touched afterwards
+  job *j = *found;
+  auto len = (jerry_length_t) fetch->numBytes;
+  auto data = (uint8_t *) malloc(len);
+  memcpy(data, fetch->data, len);
+  jerry_value_t buffer_val = jerry_create_arraybuffer_external(len, data, free);
+  jerry_value_t args[2] = {
+          jerry_create_typedarray_for_arraybuffer(JERRY_TYPEDARRAY_UINT8, buffer_val),
+          jerry_create_number((double) fetch->dataOffset)
+  };
+  jerry_value_t onchunk = jerry_acquire_value(j->waiters->onchunk);
+  jerry_value_t this_val = jerry_acquire_value(j->waiters->this_val);
+  uint32_t stream = j->stream;
+
+  jerry_value_t retval = jerry_call_function(onchunk, this_val, args, 2);
+  ext::error::log_runtime_error(retval);
+  if (jerry_value_is_boolean(retval) && !jerry_get_boolean_value(retval)) {
+    job **paused = context_data<state>::get()->streams.get(stream);
+    if (paused != nullptr) {
+      set_paused(*paused, true);
+    }
+  }
+
+  jerry_release_value(retval);
+  jerry_release_value(this_val);
+  jerry_release_value(onchunk);
+  jerry_release_value(args[1]);
+  jerry_release_value(args[0]);
+  jerry_release_value(buffer_val);
+  ext::helper::flush();
+}
+
+void ext::request::onsuccess(emscripten_fetch_t *fetch) {
+  complete(fetch, true);
+}
+
+void ext::request::onerror(emscripten_fetch_t *fetch) {
+  complete(fetch, false);
 }
-#endif
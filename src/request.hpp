@@ -6,39 +6,184 @@
 #include "string.hpp"
 #include "map.hpp"
 #include "error.hpp"
+#include "context.hpp"
+#include "names.hpp"
+#include "core.hpp"
 
 extern "C" {
 #include "jerryscript.h"
 
-#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
 #include "emscripten/fetch.h"
-#endif
 };
 
 #define MAX_HEADERS_LEN 128
+// browsers keep about this many connections per host
+#define REQUEST_MAX_ACTIVE 6
+#define REQUEST_CACHE_ENTRIES 64
+#define REQUEST_CACHE_BYTES (4 * 1024 * 1024)
 
 namespace ext {
+  /*
+   * request() calls become jobs. A job is one fetch, shared by every
+   * identical GET issued while it waits or runs, and at most max_active
+   * jobs are in flight; the rest wait in order. Successful GETs are kept
+   * in an LRU cache for as long as their Cache-Control max-age allows, a
+   * stale entry with an ETag or Last-Modified is revalidated with a
+   * conditional request. Fresh cache hits are answered on the next turn.
+   *
+   * A request with `onchunk` is streamed instead: the body is handed over
+   * in Uint8Array slices as it arrives and never kept whole. Such requests
+   * return a handle to pause(), resume() or abort() them, and onchunk
+   * returning false pauses too. Only the native host can hold a response
+   * back, in the browser a paused stream keeps receiving.
+   */
   class request {
-    struct request_item {
+    // a received body, shared by the cache and the jobs answered with it
+    struct response {
+      uint32_t refs;
+      unsigned short status;
+      char status_text[64];
+      uint8_t *data;
+      size_t len;
+    };
+
+    // one request() call
+    struct waiter {
       jerry_value_t this_val;
       jerry_value_t onsuccess;
       jerry_value_t onerror;
+      jerry_value_t onchunk;
+      // responseType 'arraybuffer', the body is handed over as is
+      bool binary;
+      waiter *next;
+    };
+
+    struct job {
+      // method, url and headers of a GET that can be shared and cached, else empty
+      string key;
+      string method;
+      string url;
+      string origin;
+      string body;
+      string *headers;
+      uint32_t headers_len;
+      uint32_t timeout;
+      bool with_credentials;
+      // handle id and handle of a streamed request, else 0
+      uint32_t stream;
+      jerry_value_t handle;
+      bool paused;
+      emscripten_fetch_t *fetch;
+      // set for cache hits waiting for the next turn
+      response *resp;
+      waiter *waiters;
+      waiter *waiters_tail;
+      // waiting for a slot, or for the next turn
+      job *next;
+    };
+
+    struct cache_entry {
+      string key;
+      response *resp;
+      string etag;
+      string last_modified;
+      // emscripten_get_now() time the entry turns stale
+      double expires;
+      // least recently used list, most recent first
+      cache_entry *prev;
+      cache_entry *next;
+    };
+
+    struct state {
+      state();
+
+      void release();
+
+      // in flight, by fetch id
+      map<unsigned int, job *> active;
+      // jobs that identical GETs join, by key
+      map<string, job *> shared;
+      job *waiting_head;
+      job *waiting_tail;
+      job *ready_head;
+      job *ready_tail;
+
+      map<string, cache_entry *> cache;
+      cache_entry *lru_head;
+      cache_entry *lru_tail;
+      size_t cache_bytes;
+
+      // streamed requests by handle id, prototype of their handles
+      map<uint32_t, job *> streams;
+      uint32_t stream_id;
+      jerry_value_t stream_proto;
+
+      host_ref *host;
+      security_worker_request_config_t config;
+      security_worker_request_stats_t stats;
+      map<string, security_worker_request_stats_t> origins;
     };
 
   public:
     static int init();
 
+    static void config(const security_worker_request_config_t *config);
+
+    static void stats(security_worker_request_stats_t *out, security_worker_request_origin_t origin, void *user_data);
+
   private:
     static JERRY_EXTERNAL_FUNC(request_wrap);
 
-#ifdef __EMSCRIPTEN__
-    static jerry_value_t conv_response_data(emscripten_fetch_t *fetch);
+    static JERRY_EXTERNAL_FUNC(stream_pause);
+
+    static JERRY_EXTERNAL_FUNC(stream_resume);
+
+    static JERRY_EXTERNAL_FUNC(stream_abort);
+
+    static job *stream_job(jerry_value_t this_value);
+
+    static const jerry_object_native_info_t native_info;
+
+    static void set_paused(job *j, bool paused);
+
+    static void submit(state *s, job *j, waiter *w);
+
+    static void pump(state *s);
+
+    static void start(state *s, job *j);
+
+    static void complete(emscripten_fetch_t *fetch, bool ok);
+
+    static void deliver(job *j, response *resp, bool ok);
+
+    static void async_call_handler(void *user_data);
+
+    static void free_job(job *j);
+
+    static void release_response(response *resp);
+
+    static cache_entry *cache_get(state *s, const string &key);
+
+    static void cache_put(state *s, const string &key, response *resp, const char *headers);
+
+    static void cache_remove(state *s, cache_entry *e);
+
+    static void cache_invalidate(state *s, const string &url);
+
+    static bool cache_freshness(const char *headers, double *expires);
+
+    static bool header_value(const char *headers, const char *name, string &out);
+
+    static security_worker_request_stats_t *origin_stats(state *s, const string &origin);
+
+    static jerry_value_t conv_response_data(response *resp, bool binary, bool take);
+
+    static jerry_value_t conv_response_text(const uint8_t *data, size_t len);
+
+    static void onprogress(emscripten_fetch_t *fetch);
     static void onsuccess(emscripten_fetch_t *fetch);
     static void onerror(emscripten_fetch_t *fetch);
-#endif
-
-    static map<unsigned int, request_item> request_map;
   };
 }
 
@@ -0,0 +1,52 @@
+#include <cstdlib>
+#include "scratch.hpp"
+
+ext::scratch::state::state() : arena(nullptr), top(0) {
+}
+
+ext::scratch::state::~state() {
+  free(arena);
+}
+
+void ext::scratch::state::release() {
+}
+
+ext::scratch::buffer::buffer(size_t size) : data(inline_data), owner(nullptr), top(0) {
+  if (size <= SCRATCH_INLINE_SIZE) {
+    return;
+  }
+
+  auto s = context_data<state>::get();
+  if (s->top + size <= SCRATCH_ARENA_SIZE) {
+    if (s->arena == nullptr) {
+      s->arena = (uint8_t *) malloc(SCRATCH_ARENA_SIZE);
+    }
+    owner = s;
+    top = s->top;
+    data = s->arena + s->top;
+    s->top += size;
+  } else {
+    data = (jerry_char_t *) malloc(size);
+  }
+}
+
+ext::scratch::buffer::~buffer() {
+  if (owner != nullptr) {
+    owner->top = top;
+  } else if (data != inline_data) {
+    free(data);
+  }
+}
+
+ext::scratch::view::view(jerry_value_t value) : data(digits), size(0), str(jerry_value_to_string(value)) {
+  const jerry_char_t *chars = jerry_get_string_chars(str, &size);
+  if (chars != nullptr) {
+    data = chars;
+  } else {
+    size = jerry_string_to_char_buffer(str, digits, sizeof(digits));
+  }
+}
+
+ext::scratch::view::~view() {
+  jerry_release_value(str);
+}
@@ -0,0 +1,78 @@
+#ifndef JPROTECTOR_SCRATCH_HPP
+#define JPROTECTOR_SCRATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "context.hpp"
+
+extern "C" {
+#include "jerryscript.h"
+};
+
+// strings this short are copied to the stack
+#define SCRATCH_INLINE_SIZE 256
+// longer ones to a per context arena of this many bytes, past that to the heap
+#define SCRATCH_ARENA_SIZE (64 * 1024)
+
+namespace ext {
+  /*
+   * Room for the bytes of JS strings while a binding works on them. A
+   * buffer takes its bytes from the arena on construction and gives them
+   * back on destruction, so buffers nest like the scopes that hold them and
+   * the arena is empty again whenever control leaves the bindings.
+   */
+  class scratch {
+    struct state {
+      state();
+
+      ~state();
+
+      void release();
+
+      uint8_t *arena;
+      size_t top;
+    };
+
+  public:
+    class buffer {
+    public:
+      explicit buffer(size_t size);
+
+      ~buffer();
+
+      jerry_char_t *data;
+
+    private:
+      buffer(const buffer &);
+
+      buffer &operator=(const buffer &);
+
+      state *owner;
+      size_t top;
+      jerry_char_t inline_data[SCRATCH_INLINE_SIZE];
+    };
+
+    // the string form of a value, read in place when the engine allows it,
+    // not zero terminated
+    class view {
+    public:
+      explicit view(jerry_value_t value);
+
+      ~view();
+
+      const jerry_char_t *data;
+      jerry_size_t size;
+
+    private:
+      view(const view &);
+
+      view &operator=(const view &);
+
+      jerry_value_t str;
+      // numeric strings are printed on demand, into here
+      jerry_char_t digits[16];
+    };
+  };
+}
+
+#endif //JPROTECTOR_SCRATCH_HPP
@@ -3,6 +3,7 @@
 
 #include "string.hpp"
 #include "error.hpp"
+#include "names.hpp"
 
 extern "C" {
 #include "jerryscript.h"
@@ -0,0 +1,161 @@
+#include <cstdlib>
+#include <cstring>
+#include "slice.hpp"
+#include "helper.hpp"
+#include "clone.hpp"
+
+ext::slice::state::state() : open(false),
+                             stopped(false),
+                             yielded(false),
+                             start(0),
+                             head(nullptr),
+                             tail(nullptr),
+                             host(host_ref::create()),
+                             config(),
+                             stats() {
+}
+
+void ext::slice::state::release() {
+  while (head != nullptr) {
+    message *m = head;
+    head = m->next;
+    free(m);
+  }
+  tail = nullptr;
+
+  host->orphan();
+  host = nullptr;
+}
+
+void ext::slice::config(const security_worker_slice_config_t *config) {
+  auto s = context_data<state>::get();
+  s->config = *config;
+  // the engine only pays for the checks while there is a limit to enforce
+  if (config->limit_us != 0) {
+    jerry_set_vm_exec_stop_callback(stop, s, SLICE_CHECK_FREQUENCY);
+  } else {
+    jerry_set_vm_exec_stop_callback(nullptr, nullptr, 0);
+  }
+}
+
+void ext::slice::stats(security_worker_slice_stats_t *out) {
+  auto s = context_data<state>::get();
+  *out = s->stats;
+  out->waiting = 0;
+  for (message *m = s->head; m != nullptr; m = m->next) {
+    out->waiting += 1;
+  }
+}
+
+void ext::slice::enter() {
+  auto s = context_data<state>::get();
+  if (!s->open && (s->config.budget_us != 0 || s->config.limit_us != 0)) {
+    begin(s);
+  }
+}
+
+bool ext::slice::exhausted() {
+  auto s = context_data<state>::get();
+  if (!s->open) {
+    return false;
+  }
+  if (!s->stopped && (s->config.budget_us == 0 || (emscripten_get_now() - s->start) * 1000 < s->config.budget_us)) {
+    return false;
+  }
+
+  // only asked with work at hand, so that work waits for the next turn
+  if (!s->yielded) {
+    s->yielded = true;
+    s->stats.yields += 1;
+  }
+  return true;
+}
+
+bool ext::slice::defer(const char *data, size_t len, bool json) {
+  auto s = context_data<state>::get();
+  if (s->head == nullptr) {
+    enter();
+    if (!exhausted()) {
+      return false;
+    }
+  }
+
+  auto m = (message *) malloc(sizeof(message) + len);
+  m->next = nullptr;
+  m->len = len;
+  m->json = json;
+  memcpy(m->data, data, len);
+  m->data[len] = '\0';
+  if (s->tail != nullptr) {
+    s->tail->next = m;
+  } else {
+    s->head = m;
+  }
+  s->tail = m;
+  s->stats.deferred += 1;
+  return true;
+}
+
+void ext::slice::begin(state *s) {
+  s->open = true;
+  s->stopped = false;
+  s->yielded = false;
+  s->start = emscripten_get_now();
+  s->stats.turns += 1;
+
+  // runs once the host loop has had its go, which ends the turn
+  s->host->async_call(async_call_handler, 0);
+}
+
+jerry_value_t ext::slice::stop(void *user_p) {
+  auto s = (state *) user_p;
+  // script the host calls without going through enter(), like fetch and
+  // websocket callbacks, starts its turn here
+  if (!s->open) {
+    begin(s);
+    return JERRY_UNDEFINED;
+  }
+
+  if ((emscripten_get_now() - s->start) * 1000 < s->config.limit_us) {
+    return JERRY_UNDEFINED;
+  }
+
+  if (!s->stopped) {
+    s->stopped = true;
+    s->stats.stopped += 1;
+  }
+  return jerry_create_error(JERRY_ERROR_RANGE, (const jerry_char_t *) "Script ran past its time slice");
+}
+
+void ext::slice::async_call_handler(void *user_data) {
+  jerry_context_t *context = host_ref::resolve(user_data);
+  if (context == nullptr) {
+    return;
+  }
+
+  ext::context::scope scope(context);
+  auto s = context_data<state>::get();
+  s->open = false;
+  if (s->head == nullptr) {
+    return;
+  }
+
+  // what waited gets a fresh turn, whatever does not fit waits again
+  begin(s);
+  while (s->head != nullptr && !exhausted()) {
+    message *m = s->head;
+    s->head = m->next;
+    if (s->head == nullptr) {
+      s->tail = nullptr;
+    }
+
+    if (m->json) {
+      ext::helper::dispatch(jerry_json_parse((const jerry_char_t *) m->data, (jerry_size_t) m->len));
+    } else {
+      ext::helper::dispatch(ext::clone::read((const uint8_t *) m->data, m->len));
+    }
+    free(m);
+  }
+
+  ext::helper::flush();
+}
@@ -0,0 +1,75 @@
+#ifndef JPROTECTOR_SLICE_HPP
+#define JPROTECTOR_SLICE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "context.hpp"
+#include "core.hpp"
+
+extern "C" {
+#include "jerryscript.h"
+
+#include "emscripten.h"
+};
+
+// backward branches the engine takes between two looks at the clock
+#define SLICE_CHECK_FREQUENCY 1024
+
+namespace ext {
+  /*
+   * Time slices. A turn starts when the host first calls into the worker
+   * and lasts until the host loop comes around again. Once a turn has run
+   * script for budget_us, inbound messages and due timers wait for the next
+   * turn instead of running. The engine can not suspend a script, so one
+   * that is still running at limit_us is stopped with an uncatchable error
+   * at its next loop iteration; the next turn starts afresh.
+   */
+  class slice {
+    // an inbound message waiting for a turn with budget left
+    struct message {
+      message *next;
+      size_t len;
+      bool json;
+      char data[1];
+    };
+
+    struct state {
+      state();
+
+      void release();
+
+      bool open;
+      bool stopped;
+      bool yielded;
+      double start;
+      message *head;
+      message *tail;
+      host_ref *host;
+      security_worker_slice_config_t config;
+      security_worker_slice_stats_t stats;
+    };
+
+  public:
+    static void config(const security_worker_slice_config_t *config);
+
+    static void stats(security_worker_slice_stats_t *out);
+
+    // starts a turn unless one is running, called when the host calls in
+    static void enter();
+
+    // whether the current turn has used up its budget
+    static bool exhausted();
+
+    // queues an inbound message when it has to wait, behind any already waiting
+    static bool defer(const char *data, size_t len, bool json);
+
+  private:
+    static void begin(state *s);
+
+    static jerry_value_t stop(void *user_p);
+
+    static void async_call_handler(void *user_data);
+  };
+}
+
+#endif //JPROTECTOR_SLICE_HPP
@@ -1,124 +1,273 @@
 #ifndef JPROTECTOR_STRING_HPP
 #define JPROTECTOR_STRING_HPP
 
-#include <memory.h>
-#include <memory>
-#include <string.h>
-#include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
 
 #define CHAR_SIZE(LEN) ((LEN) * sizeof(char))
+// strings up to this many chars (without the terminator) never touch the heap
+#define STRING_INLINE_CAPACITY 23
 
+/*
+ * Growable byte string. Short strings live in an inline buffer, longer ones
+ * in a heap buffer whose capacity doubles, so appending n bytes costs O(n)
+ * in total. The content is always NUL terminated.
+ */
 class string {
 public:
   string();
 
   explicit string(const char *c_str);
 
+  string(const char *data, size_t size);
+
   string(const string &str);
 
+  string(string &&str) noexcept;
+
   string &operator=(const string &str);
 
+  string &operator=(string &&str) noexcept;
+
   ~string();
 
-  string &operator<<(string &str);
+  string &append(const char *data, size_t size);
+
+  string &operator<<(const string &str);
 
   string &operator<<(const char *c_str);
 
-  bool operator==(const string &str);
+  string &operator<<(char c);
+
+  string &operator<<(int value);
+
+  string &operator<<(unsigned int value);
+
+  string &operator<<(long value);
+
+  string &operator<<(unsigned long value);
+
+  string &operator<<(long long value);
+
+  string &operator<<(unsigned long long value);
 
-  const char *c_str();
+  string &operator<<(double value);
 
-  size_t size();
+  bool operator==(const string &str) const;
+
+  void reserve(size_t size);
+
+  void clear();
+
+  const char *c_str() const;
+
+  size_t size() const;
+
+  size_t capacity() const;
 
 private:
+  bool is_inline() const;
+
+  void grow(size_t size);
+
+  string &append_unsigned(unsigned long long value, bool negative);
+
   char *ptr;
   size_t len;
+  size_t cap;
+  char buf[STRING_INLINE_CAPACITY + 1];
 };
 
-inline string::string() {
-  len = 0;
-  ptr = (char *) malloc(CHAR_SIZE(1));
-  ptr[0] = '\0';
+inline string::string() : ptr(buf), len(0), cap(STRING_INLINE_CAPACITY) {
+  buf[0] = '\0';
 }
 
-inline string::string(const char *c_str) {
-  if (c_str == nullptr) {
-    len = 0;
-    ptr = (char *) malloc(CHAR_SIZE(1));
-    ptr[0] = '\0';
-  } else {
-    len = strlen(c_str);
-    ptr = (char *) malloc(CHAR_SIZE(len + 1));
-    memset(ptr, '\0', CHAR_SIZE(len + 1));
-    memcpy(ptr, c_str, CHAR_SIZE(len));
+inline string::string(const char *c_str) : string() {
+  if (c_str != nullptr) {
+    append(c_str, strlen(c_str));
   }
 }
 
-inline string::string(const string &str) {
-  this->len = str.len;
-  this->ptr = (char *) malloc(CHAR_SIZE(str.len + 1));
-  memset(this->ptr, '\0', CHAR_SIZE(this->len + 1));
-  memcpy(this->ptr, str.ptr, CHAR_SIZE(this->len));
+inline string::string(const char *data, size_t size) : string() {
+  append(data, size);
+}
+
+inline string::string(const string &str) : string() {
+  append(str.ptr, str.len);
+}
+
+inline string::string(string &&str) noexcept : string() {
+  *this = std::move(str);
 }
 
 inline string &string::operator=(const string &str) {
+  if (this != &str) {
+    clear();
+    append(str.ptr, str.len);
+  }
+  return *this;
+}
+
+inline string &string::operator=(string &&str) noexcept {
   if (this == &str) {
     return *this;
   }
 
-  this->len = str.len;
-  this->ptr = (char *) malloc(CHAR_SIZE(str.len + 1));
-  memset(this->ptr, '\0', CHAR_SIZE(this->len + 1));
-  memcpy(this->ptr, str.ptr, CHAR_SIZE(this->len));
+  if (str.is_inline()) {
+    clear();
+    memcpy(ptr, str.ptr, CHAR_SIZE(str.len + 1));
+    len = str.len;
+  } else {
+    if (!is_inline()) {
+      free(ptr);
+    }
+    ptr = str.ptr;
+    len = str.len;
+    cap = str.cap;
+    str.ptr = str.buf;
+    str.cap = STRING_INLINE_CAPACITY;
+  }
+
+  str.len = 0;
+  str.ptr[0] = '\0';
   return *this;
 }
 
 inline string::~string() {
-  delete ptr;
-  ptr = nullptr;
-}
-
-inline string &string::operator<<(string &str) {
-  size_t totalLen = this->len + str.len;
-  char *constr = (char *) malloc(CHAR_SIZE(totalLen + 1));
-  memset(constr, '\0', CHAR_SIZE(totalLen + 1));
-  memcpy(constr, this->ptr, CHAR_SIZE(this->len));
-  memcpy(constr + this->len, str.ptr, CHAR_SIZE(str.len));
-  delete this->ptr;
-  this->ptr = constr;
-  this->len = totalLen;
-  return *this;
+  if (!is_inline()) {
+    free(ptr);
+  }
 }
 
-inline string &string::operator<<(const char *c_str) {
-  if (c_str == nullptr) {
+inline string &string::append(const char *data, size_t size) {
+  if (size == 0) {
     return *this;
   }
 
-  size_t totalLen = strlen(c_str) + this->len;
-  char *constr = (char *) malloc(CHAR_SIZE(totalLen + 1));
-  memset(constr, '\0', CHAR_SIZE(totalLen + 1));
-  memcpy(constr, this->ptr, CHAR_SIZE(this->len));
-  memcpy(constr + this->len, c_str, CHAR_SIZE(strlen(c_str)));
-  delete this->ptr;
-  this->ptr = constr;
-  this->len = totalLen;
+  if (len + size > cap) {
+    grow(len + size);
+  }
+  memcpy(ptr + len, data, CHAR_SIZE(size));
+  len += size;
+  ptr[len] = '\0';
   return *this;
 }
 
-inline bool string::operator==(const string &str) {
+inline string &string::operator<<(const string &str) {
+  return append(str.ptr, str.len);
+}
+
+inline string &string::operator<<(const char *c_str) {
+  return c_str == nullptr ? *this : append(c_str, strlen(c_str));
+}
+
+inline string &string::operator<<(char c) {
+  return append(&c, 1);
+}
+
+inline string &string::operator<<(int value) {
+  return *this << (long long) value;
+}
+
+inline string &string::operator<<(unsigned int value) {
+  return append_unsigned(value, false);
+}
+
+inline string &string::operator<<(long value) {
+  return *this << (long long) value;
+}
+
+inline string &string::operator<<(unsigned long value) {
+  return append_unsigned(value, false);
+}
+
+inline string &string::operator<<(long long value) {
+  return value < 0 ? append_unsigned(0ULL - (unsigned long long) value, true)
+                   : append_unsigned((unsigned long long) value, false);
+}
+
+inline string &string::operator<<(unsigned long long value) {
+  return append_unsigned(value, false);
+}
+
+inline string &string::operator<<(double value) {
+  // shortest precision that reads back as the same double
+  char digits[32];
+  int n = 0;
+  for (int precision = 15; precision <= 17; precision++) {
+    n = snprintf(digits, sizeof(digits), "%.*g", precision, value);
+    if (precision == 17 || strtod(digits, nullptr) == value) {
+      break;
+    }
+  }
+  return append(digits, (size_t) n);
+}
+
+inline bool string::operator==(const string &str) const {
   return this == &str ||
          (this->len == str.len &&
           memcmp(this->ptr, str.ptr, str.len) == 0);
 }
 
-inline const char *string::c_str() {
+inline void string::reserve(size_t size) {
+  if (size > cap) {
+    grow(size);
+  }
+}
+
+inline void string::clear() {
+  len = 0;
+  ptr[0] = '\0';
+}
+
+inline const char *string::c_str() const {
   return ptr;
 }
 
-inline size_t string::size() {
+inline size_t string::size() const {
   return len;
 }
 
+inline size_t string::capacity() const {
+  return cap;
+}
+
+inline bool string::is_inline() const {
+  return ptr == buf;
+}
+
+inline void string::grow(size_t size) {
+  size_t next = cap * 2;
+  if (next < size) {
+    next = size;
+  }
+
+  if (is_inline()) {
+    auto heap = (char *) malloc(CHAR_SIZE(next + 1));
+    memcpy(heap, buf, CHAR_SIZE(len + 1));
+    ptr = heap;
+  } else {
+    ptr = (char *) realloc(ptr, CHAR_SIZE(next + 1));
+  }
+  cap = next;
+}
+
+inline string &string::append_unsigned(unsigned long long value, bool negative) {
+  char digits[24];
+  char *end = digits + sizeof(digits);
+  char *p = end;
+  do {
+    *--p = (char) ('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  if (negative) {
+    *--p = '-';
+  }
+  return append(p, (size_t) (end - p));
+}
+
 
 #endif //JPROTECTOR_STRING_HPP
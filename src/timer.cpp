@@ -1,114 +1,307 @@
+#include <cmath>
+#include <cstdlib>
 #include "timer.hpp"
+#include "helper.hpp"
+#include "slice.hpp"
 
-uint32_t ext::timer::tid = 0;
-map<int, ext::timer::timer_pair> ext::timer::async_call_map;
+#define TIMER_NO_SLOT 0xffffffffu
+// largest integer a double holds exactly
+#define TIMER_MAX_ID 9007199254740991.0
 
-void ext::timer::async_call_handler(void *tid) {
-  auto id = (uint32_t *) tid;
-  int32_t index = async_call_map.find(*id);
-  if (index > -1) {
-    const timer_pair pair = *async_call_map.get(*id);
-    JERRY_GET_PROPERTY(pair.func, is_repeat, boolean, bool);
-    jerry_value_t retval = jerry_call_function(pair.func, jerry_create_undefined(), nullptr, 0);
-    ext::error::log_runtime_error(retval);
-    jerry_release_value(retval);
+static inline bool heap_less(const double a_deadline, const uint64_t a_seq,
+                             const double b_deadline, const uint64_t b_seq) {
+  return a_deadline < b_deadline || (a_deadline == b_deadline && a_seq < b_seq);
+}
 
-    if (!is_repeat_value) {
-      jerry_release_value(pair.func);
-      async_call_map.remove(*id);
-      delete id;
-      id = nullptr;
-    } else {
-      JERRY_GET_PROPERTY(pair.func, timeout, number, double);
-#ifdef __EMSCRIPTEN__
-      emscripten_async_call(async_call_handler, tid, int(timeout_value));
-#endif
+template<typename N>
+static void sift_up(N *heap, uint32_t i) {
+  N node = heap[i];
+  while (i > 0) {
+    uint32_t parent = (i - 1) / 2;
+    if (!heap_less(node.deadline, node.seq, heap[parent].deadline, heap[parent].seq)) {
+      break;
+    }
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = node;
+}
+
+template<typename N>
+static void sift_down(N *heap, uint32_t len, uint32_t i) {
+  N node = heap[i];
+  for (;;) {
+    uint32_t child = i * 2 + 1;
+    if (child >= len) {
+      break;
+    }
+    if (child + 1 < len && heap_less(heap[child + 1].deadline, heap[child + 1].seq,
+                                     heap[child].deadline, heap[child].seq)) {
+      child += 1;
+    }
+    if (!heap_less(heap[child].deadline, heap[child].seq, node.deadline, node.seq)) {
+      break;
     }
+    heap[i] = heap[child];
+    i = child;
   }
+  heap[i] = node;
+}
+
+ext::timer::state::state() : entries(nullptr),
+                             entries_len(0),
+                             entries_cap(0),
+                             free_head(TIMER_NO_SLOT),
+                             heap(nullptr),
+                             heap_len(0),
+                             heap_cap(0),
+                             stale(0),
+                             seq(0),
+                             armed(INFINITY),
+                             host(host_ref::create()),
+                             stats() {
+}
+
+ext::timer::state::~state() {
+  free(entries);
+  free(heap);
+}
+
+void ext::timer::state::release() {
+  for (uint32_t i = 0; i < entries_len; i++) {
+    if (entries[i].active) {
+      jerry_release_value(entries[i].func);
+      entries[i].active = false;
+    }
+  }
+
+  host->orphan();
+  host = nullptr;
 }
 
 int ext::timer::init() {
+  static constexpr binding bindings[] = {
+    {"setTimeout", set_timeout, nullptr, BINDING_METHOD},
+    {"setInterval", set_interval, nullptr, BINDING_METHOD},
+    {"clearTimeout", clear_timer_async, nullptr, BINDING_METHOD},
+    {"clearInterval", clear_timer_async, nullptr, BINDING_METHOD},
+  };
+
   jerry_value_t global_object = jerry_get_global_object();
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, setTimeout, ext::timer::set_timeout);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, setInterval, ext::timer::set_interval);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, clearTimeout, ext::timer::clear_timer_async);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(global_object, clearInterval, ext::timer::clear_timer_async);
+  ext::names::install(global_object, bindings);
   jerry_release_value(global_object);
   return 0;
 }
 
+void ext::timer::stats(security_worker_timer_stats_t *out) {
+  *out = context_data<state>::get()->stats;
+}
+
 JERRY_EXTERNAL_FUNC(ext::timer::set_timeout) {
-  double timeout = 0;
-  if (args_cnt == 0) {
-    return jerry_create_number(tid++);
+  return add(args_p, args_cnt, false);
+}
+
+JERRY_EXTERNAL_FUNC(ext::timer::set_interval) {
+  return add(args_p, args_cnt, true);
+}
+
+JERRY_EXTERNAL_FUNC(ext::timer::clear_timer_async) {
+  if (args_cnt == 0 || !jerry_value_is_number(*args_p)) {
+    return JERRY_UNDEFINED;
+  }
+
+  // only ids add() could have handed out, anything else would decode to one
+  double id = jerry_get_number_value(*args_p);
+  if (!(id >= 1 && id <= TIMER_MAX_ID) || id != floor(id)) {
+    return JERRY_UNDEFINED;
+  }
+
+  auto s = context_data<state>::get();
+  double generation = floor((id - 1) / TIMER_SLOT_LIMIT);
+  auto slot = (uint32_t) (id - 1 - generation * TIMER_SLOT_LIMIT);
+  if (slot >= s->entries_len || !s->entries[slot].active || s->entries[slot].generation != generation) {
+    return JERRY_UNDEFINED;
+  }
+
+  // its heap node turns stale and is dropped when it surfaces
+  free_slot(s, slot);
+  s->stale += 1;
+  s->stats.cancelled += 1;
+  if (s->stale > 32 && s->stale > s->heap_len / 2) {
+    compact(s);
   }
 
-  if (jerry_value_is_function(*args_p)) {
-    jerry_value_t func = jerry_acquire_value(args_p[0]);
-    jerry_value_t is_repeat = jerry_create_boolean(false);
-    JERRY_SET_PROPERTY(func, is_repeat, is_repeat);
-    jerry_release_value(is_repeat);
+  return JERRY_UNDEFINED;
+}
+
+jerry_value_t ext::timer::add(const jerry_value_t *args_p, jerry_length_t args_cnt, bool repeat) {
+  if (args_cnt == 0 || !jerry_value_is_function(*args_p)) {
+    return jerry_create_number(0);
+  }
+
+  double timeout = 0;
+  if (args_cnt >= 2 && jerry_value_is_number(args_p[1])) {
+    timeout = jerry_get_number_value(args_p[1]);
+  }
+  if (!(timeout > 0)) {
+    timeout = 0;
+  }
 
-    if (args_cnt >= 2 && jerry_value_is_number(args_p[1])) {
-      timeout = jerry_get_number_value(args_p[1]);
+  auto s = context_data<state>::get();
+  uint32_t slot = s->free_head;
+  if (slot != TIMER_NO_SLOT) {
+    s->free_head = s->entries[slot].next_free;
+  } else {
+    if (s->entries_len >= (uint32_t) TIMER_SLOT_LIMIT - 1) {
+      return jerry_create_number(0);
     }
+    if (s->entries_len == s->entries_cap) {
+      s->entries_cap = s->entries_cap ? s->entries_cap * 2 : 16;
+      s->entries = (timer_entry *) realloc(s->entries, s->entries_cap * sizeof(timer_entry));
+    }
+    slot = s->entries_len++;
+    s->entries[slot].generation = 0;
+  }
 
-#ifdef __EMSCRIPTEN__
-    emscripten_async_call(async_call_handler, (void *)new uint32_t(tid), int(timeout));
-#endif
+  timer_entry *e = &s->entries[slot];
+  e->func = jerry_acquire_value(*args_p);
+  e->interval = timeout;
+  e->repeat = repeat;
+  e->active = true;
 
-    async_call_map.add(tid, timer_pair{func, tid});
+  double now = emscripten_get_now();
+  push(s, slot, now + timeout);
+  s->stats.scheduled += 1;
+  s->stats.active += 1;
+  arm(s, now);
+
+  return jerry_create_number(e->generation * TIMER_SLOT_LIMIT + slot + 1);
+}
+
+void ext::timer::free_slot(state *s, uint32_t slot) {
+  timer_entry *e = &s->entries[slot];
+  jerry_release_value(e->func);
+  e->active = false;
+  e->generation += 1;
+  e->next_free = s->free_head;
+  s->free_head = slot;
+  s->stats.active -= 1;
+}
+
+void ext::timer::push(state *s, uint32_t slot, double deadline) {
+  if (s->heap_len == s->heap_cap) {
+    s->heap_cap = s->heap_cap ? s->heap_cap * 2 : 16;
+    s->heap = (heap_node *) realloc(s->heap, s->heap_cap * sizeof(heap_node));
   }
 
-  return jerry_create_number(tid++);
+  s->entries[slot].seq = s->seq;
+  s->heap[s->heap_len] = heap_node{deadline, s->seq, slot};
+  s->seq += 1;
+  sift_up(s->heap, s->heap_len++);
 }
 
-JERRY_EXTERNAL_FUNC(ext::timer::set_interval) {
-  double timeout = 0;
-  if (args_cnt == 0) {
-    return jerry_create_number(tid++);
+bool ext::timer::top(state *s, heap_node *out) {
+  while (s->heap_len > 0) {
+    heap_node node = s->heap[0];
+    timer_entry *e = &s->entries[node.slot];
+    if (e->active && e->seq == node.seq) {
+      *out = node;
+      return true;
+    }
+    remove_top(s);
+    if (s->stale > 0) {
+      s->stale -= 1;
+    }
   }
+  return false;
+}
 
-  if (jerry_value_is_function(*args_p)) {
-    jerry_value_t func = jerry_acquire_value(args_p[0]);
-    jerry_value_t is_repeat = jerry_create_boolean(true);
-    JERRY_SET_PROPERTY(func, is_repeat, is_repeat);
-    jerry_release_value(is_repeat);
+void ext::timer::remove_top(state *s) {
+  s->heap_len -= 1;
+  if (s->heap_len > 0) {
+    s->heap[0] = s->heap[s->heap_len];
+    sift_down(s->heap, s->heap_len, 0);
+  }
+}
 
-    if (args_cnt >= 2 && jerry_value_is_number(args_p[1])) {
-      timeout = jerry_get_number_value(args_p[1]);
+void ext::timer::compact(state *s) {
+  uint32_t len = 0;
+  for (uint32_t i = 0; i < s->heap_len; i++) {
+    heap_node node = s->heap[i];
+    timer_entry *e = &s->entries[node.slot];
+    if (e->active && e->seq == node.seq) {
+      s->heap[len++] = node;
     }
+  }
 
-    jerry_value_t timeout_prop = jerry_create_number(timeout);
-    JERRY_SET_PROPERTY(func, timeout, timeout_prop);
-    jerry_release_value(timeout_prop);
+  s->heap_len = len;
+  s->stale = 0;
+  for (uint32_t i = len / 2; i-- > 0;) {
+    sift_down(s->heap, len, i);
+  }
+}
 
-#ifdef __EMSCRIPTEN__
-    emscripten_async_call(async_call_handler, (void *)new uint32_t(tid), int(timeout));
-#endif
+void ext::timer::arm(state *s, double now) {
+  heap_node next{};
+  if (s->host == nullptr || !top(s, &next)) {
+    return;
+  }
 
-    async_call_map.add(tid, timer_pair{func, tid});
+  // a wakeup already armed within a tick of this deadline picks it up
+  if (next.deadline >= s->armed - TIMER_TICK_MS) {
+    return;
   }
 
-  return jerry_create_number(tid++);
+  double delay = ceil(next.deadline - now);
+  s->armed = next.deadline;
+  s->host->async_call(async_call_handler, delay > 0 ? (int) delay : 0);
 }
 
-JERRY_EXTERNAL_FUNC(ext::timer::clear_timer_async) {
-  if (args_cnt == 0) {
-    return JERRY_UNDEFINED;
+void ext::timer::async_call_handler(void *user_data) {
+  jerry_context_t *context = host_ref::resolve(user_data);
+  if (context == nullptr) {
+    return;
   }
 
-  if (jerry_value_is_number(*args_p)) {
-    auto id = (uint32_t) jerry_get_number_value(*args_p);
-    int32_t index = async_call_map.find(id);
-    if (index == -1) {
-      return JERRY_UNDEFINED;
+  ext::context::scope scope(context);
+  ext::slice::enter();
+  auto s = context_data<state>::get();
+  double now = emscripten_get_now();
+  if (s->armed <= now + TIMER_TICK_MS) {
+    s->armed = INFINITY;
+  }
+  s->stats.wakeups += 1;
+
+  // timers scheduled by the callbacks below wait for the next wakeup, and
+  // those still due once the time slice is used up are armed again for it
+  uint64_t last_seq = s->seq;
+  heap_node node{};
+  while (top(s, &node) && node.deadline <= now + TIMER_TICK_MS && node.seq < last_seq && !ext::slice::exhausted()) {
+    remove_top(s);
+
+    double fired_at = emscripten_get_now();
+    double lateness = fired_at > node.deadline ? fired_at - node.deadline : 0;
+    s->stats.fired += 1;
+    s->stats.lateness_total_ms += lateness;
+    if (lateness > s->stats.lateness_max_ms) {
+      s->stats.lateness_max_ms = lateness;
+    }
+
+    // settle the entry first, the callback may clear or add timers
+    timer_entry *e = &s->entries[node.slot];
+    jerry_value_t func = jerry_acquire_value(e->func);
+    if (e->repeat) {
+      push(s, node.slot, fired_at + e->interval);
+    } else {
+      free_slot(s, node.slot);
     }
 
-    const timer_pair pair = *async_call_map.get(id);
-    jerry_release_value(pair.func);
-    async_call_map.remove(id);
+    jerry_value_t retval = jerry_call_function(func, jerry_create_undefined(), nullptr, 0);
+    ext::error::log_runtime_error(retval);
+    jerry_release_value(retval);
+    jerry_release_value(func);
   }
 
-  return JERRY_UNDEFINED;
-}
\ No newline at end of file
+  arm(s, emscripten_get_now());
+  ext::helper::flush();
+}
@@ -3,27 +3,74 @@
 
 #include <cstdint>
 #include "marco.hpp"
-#include "map.hpp"
 #include "error.hpp"
+#include "context.hpp"
+#include "core.hpp"
+#include "names.hpp"
 
 extern "C" {
 #include "jerryscript.h"
 
-#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
-#endif
 };
 
+// timers due within one tick of each other share a host wakeup
+#define TIMER_TICK_MS 1.0
+// a timer id is generation * TIMER_SLOT_LIMIT + slot + 1
+#define TIMER_SLOT_LIMIT 1048576.0
+
 namespace ext {
+  /*
+   * Timers live in a slab indexed by the id they hand out, so clearTimeout
+   * is O(1). Deadlines sit in a binary min-heap; cancelled timers leave
+   * stale heap nodes behind that are skipped when they surface. Only the
+   * earliest deadline is armed with the host.
+   */
   class timer {
-    struct timer_pair {
+    struct timer_entry {
       jerry_value_t func;
-      uint32_t id;
+      double interval;
+      uint64_t seq;
+      uint32_t generation;
+      uint32_t next_free;
+      bool active;
+      bool repeat;
+    };
+
+    struct heap_node {
+      double deadline;
+      uint64_t seq;
+      uint32_t slot;
+    };
+
+    struct state {
+      state();
+
+      ~state();
+
+      void release();
+
+      timer_entry *entries;
+      uint32_t entries_len;
+      uint32_t entries_cap;
+      uint32_t free_head;
+
+      heap_node *heap;
+      uint32_t heap_len;
+      uint32_t heap_cap;
+      uint32_t stale;
+
+      uint64_t seq;
+      double armed;
+      host_ref *host;
+      security_worker_timer_stats_t stats;
     };
 
   public:
     static int init();
 
+    static void stats(security_worker_timer_stats_t *out);
+
   private:
     static JERRY_EXTERNAL_FUNC(set_timeout);
 
@@ -31,10 +78,21 @@ namespace ext {
 
     static JERRY_EXTERNAL_FUNC(clear_timer_async);
 
-    static void async_call_handler(void *);
+    static jerry_value_t add(const jerry_value_t *args_p, jerry_length_t args_cnt, bool repeat);
+
+    static void free_slot(state *s, uint32_t slot);
+
+    static void push(state *s, uint32_t slot, double deadline);
+
+    static bool top(state *s, heap_node *out);
 
-    static uint32_t tid;
-    static map<int, ext::timer::timer_pair> async_call_map;
+    static void remove_top(state *s);
+
+    static void compact(state *s);
+
+    static void arm(state *s, double now);
+
+    static void async_call_handler(void *);
   };
 }
 
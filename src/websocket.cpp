@@ -1,21 +1,33 @@
 #include "websocket.hpp"
+#include "helper.hpp"
 #include <iostream>
 
-uint32_t ext::websocket::id = 0;
-map<uint32_t, ext::websocket_item> ext::websocket::websocket_item_map;
+const jerry_object_native_info_t ext::websocket::native_info = {nullptr};
+
+void ext::websocket::state::release() {
+  websocket_item_map.foreach([](uint32_t id, websocket_item *item, void *userData) -> void {
+    emscripten_websocket_close(item->socket, 1001, "");
+    emscripten_websocket_delete(item->socket);
+    release_item(item);
+  }, nullptr);
+}
 
 int ext::websocket::init() {
+  static constexpr binding bindings[] = {
+    {"addEventListener", add_event_listener, nullptr, BINDING_METHOD},
+    {"removeEventListener", remove_event_listener, nullptr, BINDING_METHOD},
+    {"close", close, nullptr, BINDING_METHOD},
+    {"send", send, nullptr, BINDING_METHOD},
+    {"bufferedAmount", get_buffered_amount, nullptr, BINDING_ACCESSOR},
+    {"highWaterMark", get_high_water_mark, set_high_water_mark, BINDING_ACCESSOR},
+  };
+
   jerry_value_t global_object = jerry_get_global_object();
-#ifdef __EMSCRIPTEN__
   if(emscripten_websocket_is_supported()) {
-#endif
   jerry_value_t websocket_constructor = jerry_create_external_function(ext::websocket::constructor);
 
   jerry_value_t websocket_proto = jerry_create_object();
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(websocket_proto, addEventListener, add_event_listener);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(websocket_proto, removeEventListener, remove_event_listener);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(websocket_proto, close, close);
-  JERRY_SET_EXTERNAL_FUNC_PROPERTY(websocket_proto, send, send);
+  ext::names::install(websocket_proto, bindings);
 
   JERRY_SET_PROPERTY(websocket_constructor, prototype, websocket_proto);
   jerry_release_value(websocket_proto);
@@ -23,9 +35,7 @@ int ext::websocket::init() {
   JERRY_SET_PROPERTY(global_object, WebSocket, websocket_constructor);
   jerry_release_value(websocket_constructor);
 
-#ifdef __EMSCRIPTEN__
   }
-#endif
   jerry_release_value(global_object);
   return 0;
 }
@@ -33,9 +43,7 @@ int ext::websocket::init() {
 JERRY_EXTERNAL_FUNC(ext::websocket::constructor) {
   if (args_cnt == 0) {
     string constr("[ERROR] Failed to construct 'WebSocket': 1 argument required, but only 0 present.");
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_ERROR, constr.c_str());
-#endif
+    ext::log::text(SECURITY_WORKER_LOG_ERROR, constr.c_str(), constr.size());
     return JERRY_UNDEFINED;
   }
 
@@ -45,49 +53,45 @@ JERRY_EXTERNAL_FUNC(ext::websocket::constructor) {
   if (is_ws == nullptr && is_wss == nullptr) {
     string constr("Failed to construct 'WebSocket': The URL's scheme must be either 'ws' or 'wss'. ");
     constr << (char *) url_buffer << " is not allowed.";
-#ifdef __EMSCRIPTEN__
-    emscripten_log(EM_LOG_ERROR, constr.c_str());
-#endif
+    ext::log::text(SECURITY_WORKER_LOG_ERROR, constr.c_str(), constr.size());
     return JERRY_UNDEFINED;
   }
 
-  JERRY_CONV_STR_TO_CHAR_BUFFER(protocol, protocol_len, protocol_buffer, (args_p + 1));
-
-  JERRY_SET_PROPERTY(this_value, url, *args_p);
-  JERRY_SET_PROPERTY(this_value, protocol, *(args_p + 1));
+  jerry_value_t protocol_arg = args_cnt > 1 ? jerry_acquire_value(*(args_p + 1)) : JERRY_STRING("");
+  JERRY_CONV_STR_TO_CHAR_BUFFER(protocol, protocol_len, protocol_buffer, &protocol_arg);
 
-  jerry_value_t id = jerry_create_number(ext::websocket::id);
-  JERRY_SET_PROPERTY(this_value, id, id);
-  jerry_release_value(id);
+  JERRY_SET_NAMED_PROPERTY(this_value, url, *args_p);
+  JERRY_SET_NAMED_PROPERTY(this_value, protocol, protocol_arg);
+  jerry_release_value(protocol_arg);
 
-  ext::websocket_item item;
-  item.id = ext::websocket::id;
-  item.url << (char *) url_buffer;
-  item.protocol << (char *) protocol_buffer;
-  item.this_val = this_value;
-  jerry_acquire_value(this_value);
+  auto state = context_data<ext::websocket::state>::get();
+  auto item = new ext::websocket_item();
+  item->id = state->id;
+  item->context = ext::context::current();
+  item->url << (char *) url_buffer;
+  item->protocol << (char *) protocol_buffer;
+  item->this_val = jerry_acquire_value(this_value);
 
-  ext::websocket::websocket_item_map.add(ext::websocket::id, item);
-  auto item_ptr = ext::websocket::websocket_item_map.get(ext::websocket::id);
-
-#ifdef __EMSCRIPTEN__
   EmscriptenWebSocketCreateAttributes attr;
   emscripten_websocket_init_create_attributes(&attr);
-  attr.url = item_ptr->url.c_str();
+  attr.url = item->url.c_str();
 
-  item_ptr->socket = emscripten_websocket_new(&attr);
-  if (item_ptr->socket <= 0) {
-    emscripten_log(EM_LOG_ERROR, "WebSocket creation failed");
+  item->socket = emscripten_websocket_new(&attr);
+  if (item->socket <= 0) {
+    string constr("WebSocket creation failed");
+    ext::log::text(SECURITY_WORKER_LOG_ERROR, constr.c_str(), constr.size());
+    release_item(item);
     return JERRY_UNDEFINED;
   }
 
-  emscripten_websocket_set_onopen_callback(item_ptr->socket, (void*)item_ptr, open_callback);
-  emscripten_websocket_set_onclose_callback(item_ptr->socket, (void*)item_ptr, close_callback);
-  emscripten_websocket_set_onerror_callback(item_ptr->socket, (void*)item_ptr, error_callback);
-  emscripten_websocket_set_onmessage_callback(item_ptr->socket, (void*)item_ptr, message_callback);
-#endif
+  jerry_set_object_native_pointer(this_value, item, &native_info);
+  emscripten_websocket_set_onopen_callback(item->socket, (void*)item, open_callback);
+  emscripten_websocket_set_onclose_callback(item->socket, (void*)item, close_callback);
+  emscripten_websocket_set_onerror_callback(item->socket, (void*)item, error_callback);
+  emscripten_websocket_set_onmessage_callback(item->socket, (void*)item, message_callback);
+  state->websocket_item_map.add(state->id, item);
 
-  ext::websocket::id += 1;
+  state->id += 1;
   return JERRY_UNDEFINED;
 }
 
@@ -100,24 +104,25 @@ JERRY_EXTERNAL_FUNC(ext::websocket::add_event_listener) {
     return JERRY_UNDEFINED;
   }
 
-  JERRY_PROPERTY_BLOCK(this_value, id);
-  auto _id = (uint32_t) jerry_get_number_value(id_prop);
-  int32_t index = websocket_item_map.find(_id);
-  if (index > -1) {
-    auto item = websocket_item_map.get(_id);
-    JERRY_CONV_STR_TO_CHAR_BUFFER(func_name, func_name_len, func_name_buffer, args_p);
-    string func_name_str((char *) func_name_buffer);
-    int32_t index = item->events.find(func_name_str);
-    if (index == -1) {
-      item->events.add(func_name_str, map<jerry_value_t, uint32_t>());
+  auto item = find_item(this_value);
+  websocket_event_t type = event_type(*args_p);
+  if (item == nullptr || type == WEBSOCKET_EVENTS) {
+    return JERRY_UNDEFINED;
+  }
+
+  websocket_listeners &listeners = item->listeners[type];
+  jerry_value_t func = *(args_p + 1);
+  for (uint32_t i = 0; i < listeners.len; i++) {
+    if (listeners.funcs[i] == func) {
+      return JERRY_UNDEFINED;
     }
+  }
 
-    auto funcs = item->events.get(func_name_str);
-    jerry_value_t func = *(args_p + 1);
-    jerry_acquire_value(func);
-    funcs->add(func, 0);
+  if (listeners.len == listeners.cap) {
+    listeners.cap = listeners.cap == 0 ? 4 : listeners.cap * 2;
+    listeners.funcs = (jerry_value_t *) realloc(listeners.funcs, listeners.cap * sizeof(jerry_value_t));
   }
-  JERRY_PROPERTY_BLOCK_END(id);
+  listeners.funcs[listeners.len++] = jerry_acquire_value(func);
 
   return JERRY_UNDEFINED;
 }
@@ -131,241 +136,305 @@ JERRY_EXTERNAL_FUNC(ext::websocket::remove_event_listener) {
     return JERRY_UNDEFINED;
   }
 
-  JERRY_PROPERTY_BLOCK(this_value, id);
-  auto _id = (uint32_t) jerry_get_number_value(id_prop);
-  int32_t index = websocket_item_map.find(_id);
-  if (index > -1) {
-    auto item = websocket_item_map.get(_id);
-    JERRY_CONV_STR_TO_CHAR_BUFFER(func_name, func_name_len, func_name_buffer, args_p);
-    string func_name_str((char *) func_name_buffer);
-    int32_t index = item->events.find(func_name_str);
-    if (index == -1) {
-      return JERRY_UNDEFINED;
-    }
+  auto item = find_item(this_value);
+  websocket_event_t type = event_type(*args_p);
+  if (item == nullptr || type == WEBSOCKET_EVENTS) {
+    return JERRY_UNDEFINED;
+  }
 
-    auto funcs = item->events.get(func_name_str);
-    jerry_value_t func = *(args_p + 1);
-    while (funcs->find(func) > -1) {
-      jerry_release_value(func);
-      funcs->remove(func);
+  websocket_listeners &listeners = item->listeners[type];
+  jerry_value_t func = *(args_p + 1);
+  for (uint32_t i = 0; i < listeners.len; i++) {
+    if (listeners.funcs[i] == func) {
+      jerry_release_value(listeners.funcs[i]);
+      memmove(listeners.funcs + i, listeners.funcs + i + 1, (listeners.len - i - 1) * sizeof(jerry_value_t));
+      listeners.len -= 1;
+      break;
     }
   }
-  JERRY_PROPERTY_BLOCK_END(id);
 
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::websocket::close) {
-  JERRY_PROPERTY_BLOCK(this_value, id);
-  auto _id = (uint32_t) jerry_get_number_value(id_prop);
-  int32_t index = websocket_item_map.find(_id);
-  if (index > -1) {
-    auto item = websocket_item_map.get(_id);
-#ifdef __EMSCRIPTEN__
+  auto item = find_item(this_value);
+  if (item != nullptr) {
     emscripten_websocket_close(item->socket, 0, 0);
-#endif
   }
-  JERRY_PROPERTY_BLOCK_END(id);
 
   return JERRY_UNDEFINED;
 }
 
 JERRY_EXTERNAL_FUNC(ext::websocket::send) {
-  if (args_cnt == 0) {
-    return JERRY_UNDEFINED;
+  auto item = find_item(this_value);
+  if (item == nullptr || args_cnt == 0 || item->status == WEBSOCKET_CLOSE_STATUS) {
+    return jerry_create_boolean(false);
   }
 
-  JERRY_PROPERTY_BLOCK(this_value, id);
-  auto _id = jerry_get_number_value(id_prop);
-  int32_t index = websocket_item_map.find(_id);
-  if (index == -1) {
-    return JERRY_UNDEFINED;
+  bool binary = true;
+  const uint8_t *data = nullptr;
+  size_t len = 0;
+  if (jerry_value_is_typedarray(*args_p) || jerry_value_is_arraybuffer(*args_p)) {
+    jerry_length_t offset = 0;
+    jerry_length_t length = 0;
+    jerry_value_t buffer = jerry_value_is_arraybuffer(*args_p)
+                           ? jerry_acquire_value(*args_p)
+                           : jerry_get_typedarray_buffer(*args_p, &offset, &length);
+    if (jerry_value_is_arraybuffer(*args_p)) {
+      length = jerry_get_arraybuffer_byte_length(buffer);
+    }
+
+    // external buffers (fetch bodies, received chunks) are sent from in
+    // place; the engine only exposes those, the rest is read into scratch
+    uint8_t *external = jerry_get_arraybuffer_pointer(buffer);
+    if (external != nullptr) {
+      data = external + offset;
+      jerry_release_value(buffer);
+    } else {
+      uint8_t *copy = scratch(length);
+      jerry_arraybuffer_read(buffer, offset, copy, length);
+      data = copy;
+    }
+    len = length;
+    jerry_release_value(buffer);
+  } else {
+    // anything else goes out as text, the frame has to be UTF-8
+    jerry_value_t text = jerry_value_to_string(*args_p);
+    len = jerry_get_utf8_string_size(text);
+    uint8_t *copy = scratch(len + 1);
+    len = jerry_string_to_utf8_char_buffer(text, copy, (jerry_size_t) len);
+    copy[len] = '\0';
+#ifdef __EMSCRIPTEN__
+    // the browser call takes a C string, so only the text up to a NUL goes out and counts
+    len = strlen((const char *) copy);
+#endif
+    data = copy;
+    binary = false;
+    jerry_release_value(text);
   }
 
-  auto item = websocket_item_map.get(_id);
-  if (item->status != WEBSOCKET_OPEN_STATUS) {
-    return JERRY_UNDEFINED;
+  bool accepted = item->high_water_mark == 0 || buffered_amount(item) + len <= item->high_water_mark;
+  if (!accepted) {
+    // refused rather than queued without bound, the caller backs off until bufferedAmount drops
+  } else if (item->status == WEBSOCKET_OPEN_STATUS) {
+    send_frame(item, data, len, binary);
+  } else {
+    // kept until open, the browser would throw instead
+    auto frame = (websocket_frame *) malloc(sizeof(websocket_frame) + len + 1);
+    frame->next = nullptr;
+    frame->len = len;
+    frame->binary = binary;
+    memcpy(frame + 1, data, len);
+    ((uint8_t *) (frame + 1))[len] = '\0';
+    if (item->queue_tail != nullptr) {
+      item->queue_tail->next = frame;
+    } else {
+      item->queue_head = frame;
+    }
+    item->queue_tail = frame;
+    item->queued += len;
   }
 
-  if (jerry_value_is_string(*args_p)) {
-    JERRY_CONV_STR_TO_CHAR_BUFFER(content, content_len, content_buffer, args_p);
-#ifdef __EMSCRIPTEN__
-    emscripten_websocket_send_utf8_text(item->socket, (char *)content_buffer);
-#endif
-  } else if (jerry_value_is_typedarray(*args_p)) {
-    jerry_length_t len = jerry_get_typedarray_length(*args_p);
-    jerry_value_t buffer = jerry_get_typedarray_buffer(*args_p, nullptr, &len);
-    jerry_length_t bytes_len = jerry_get_arraybuffer_byte_length(buffer);
-    uint8_t content[bytes_len];
-    jerry_arraybuffer_read(buffer, 0, content, bytes_len);
+  return jerry_create_boolean(accepted);
+}
+
+JERRY_EXTERNAL_FUNC(ext::websocket::get_buffered_amount) {
+  auto item = find_item(this_value);
+  return jerry_create_number(item != nullptr ? (double) buffered_amount(item) : 0);
+}
+
+JERRY_EXTERNAL_FUNC(ext::websocket::get_high_water_mark) {
+  auto item = find_item(this_value);
+  return jerry_create_number(item != nullptr ? (double) item->high_water_mark : 0);
+}
+
+JERRY_EXTERNAL_FUNC(ext::websocket::set_high_water_mark) {
+  auto item = find_item(this_value);
+  if (item != nullptr && args_cnt > 0 && jerry_value_is_number(*args_p)) {
+    double value = jerry_get_number_value(*args_p);
+    item->high_water_mark = value > 0 ? (size_t) value : 0;
+  }
+  return JERRY_UNDEFINED;
+}
+
+ext::websocket_item *ext::websocket::find_item(jerry_value_t this_value) {
+  void *item = nullptr;
+  const jerry_object_native_info_t *info = nullptr;
+  if (!jerry_get_object_native_pointer(this_value, &item, &info) || info != &native_info) {
+    return nullptr;
+  }
+  // cleared once the socket is gone
+  return (websocket_item *) item;
+}
+
+ext::websocket_event_t ext::websocket::event_type(jerry_value_t name) {
+  static const char *names[WEBSOCKET_EVENTS] = {"open", "message", "error", "close"};
+  jerry_char_t buffer[8];
+  jerry_size_t size = jerry_get_string_size(name);
+  if (size >= sizeof(buffer)) {
+    return WEBSOCKET_EVENTS;
+  }
+
+  jerry_string_to_char_buffer(name, buffer, size);
+  buffer[size] = '\0';
+  for (int i = 0; i < WEBSOCKET_EVENTS; i++) {
+    if (strcmp((const char *) buffer, names[i]) == 0) {
+      return (websocket_event_t) i;
+    }
+  }
+  return WEBSOCKET_EVENTS;
+}
+
+uint8_t *ext::websocket::scratch(size_t size) {
+  auto s = context_data<state>::get();
+  if (size > s->scratch_cap) {
+    s->scratch_cap = size > 256 ? size : 256;
+    s->scratch = (uint8_t *) realloc(s->scratch, s->scratch_cap);
+  }
+  return s->scratch;
+}
+
+size_t ext::websocket::buffered_amount(websocket_item *item) {
+  size_t amount = 0;
+  if (item->status == WEBSOCKET_OPEN_STATUS) {
+    emscripten_websocket_get_buffered_amount(item->socket, &amount);
+  }
+  return amount + item->queued;
+}
+
+void ext::websocket::send_frame(websocket_item *item, const uint8_t *data, size_t len, bool binary) {
+  if (binary) {
+    emscripten_websocket_send_binary(item->socket, (void *) data, (uint32_t) len);
+  } else {
 #ifdef __EMSCRIPTEN__
-    emscripten_websocket_send_binary(item->socket, content, bytes_len);
+    // zero terminated by send(), `len` already stops at the first NUL
+    emscripten_websocket_send_utf8_text(item->socket, (const char *) data);
+#else
+    native_websocket_send_utf8_text(item->socket, (const char *) data, (uint32_t) len);
 #endif
-    jerry_release_value(buffer);
   }
-  JERRY_PROPERTY_BLOCK_END(id);
+}
 
-  return JERRY_UNDEFINED;
+void ext::websocket::flush_queue(websocket_item *item) {
+  for (websocket_frame *frame = item->queue_head, *next; frame != nullptr; frame = next) {
+    next = frame->next;
+    send_frame(item, (const uint8_t *) (frame + 1), frame->len, frame->binary);
+    free(frame);
+  }
+  item->queue_head = item->queue_tail = nullptr;
+  item->queued = 0;
 }
 
-void ext::websocket::define_property_get_set_func(jerry_value_t obj,
-                                                  const char *func_name,
-                                                  jerry_external_handler_t getter,
-                                                  jerry_external_handler_t setter) {
-
-  jerry_property_descriptor_t desc;
-  jerry_init_property_descriptor_fields(&desc);
-  desc.is_value_defined = false;
-  desc.is_configurable_defined = true;
-  desc.is_configurable = true;
-  desc.is_enumerable_defined = true;
-  desc.is_enumerable = true;
-  desc.is_get_defined = true;
-  desc.is_set_defined = true;
-  desc.getter = jerry_create_external_function(getter);
-  desc.setter = jerry_create_external_function(setter);
-
-  jerry_value_t prop_name = JERRY_STRING(func_name);
-  jerry_value_t prop = jerry_define_own_property(obj, prop_name, &desc);
-  ext::error::log_runtime_error(prop);
-  jerry_release_value(prop);
-  jerry_release_value(prop_name);
-
-  jerry_free_property_descriptor_fields(&desc);
+void ext::websocket::drop_queue(websocket_item *item) {
+  for (websocket_frame *frame = item->queue_head, *next; frame != nullptr; frame = next) {
+    next = frame->next;
+    free(frame);
+  }
+  item->queue_head = item->queue_tail = nullptr;
+  item->queued = 0;
 }
 
-#ifdef __EMSCRIPTEN__
-EM_BOOL ext::websocket::open_callback(int eventType, const EmscriptenWebSocketOpenEvent *e, void *userData) {
-  auto item = (ext::websocket_item *)userData;
-  auto _id = item->id;
-  int32_t index = websocket_item_map.find(_id);
-  if(index > -1) {
-    auto item = websocket_item_map.get(_id);
-    auto events = item->events.get(string("open"));
-    item->status = WEBSOCKET_OPEN_STATUS;
-
-    if(events != nullptr) {
-      events->foreach([](jerry_value_t k, uint32_t z, void *userData) -> void {
-        auto this_val = (jerry_value_t *)userData;
-        if(jerry_value_is_function(k)) {
-          jerry_value_t retval = jerry_call_function(k, *this_val, nullptr, 0);
-          ext::error::log_runtime_error(retval);
-          jerry_release_value(retval);
-        }
-      }, &item->this_val);
+void ext::websocket::emit(websocket_item *item, websocket_event_t type, const jerry_value_t *args, jerry_length_t args_cnt) {
+  websocket_listeners &listeners = item->listeners[type];
+  uint32_t len = listeners.len;
+  if (len == 0) {
+    return;
+  }
+
+  // listeners may add or remove listeners, which moves the array, so call
+  // a snapshot of it
+  jerry_value_t inline_funcs[WEBSOCKET_INLINE_LISTENERS];
+  jerry_value_t *funcs = len <= WEBSOCKET_INLINE_LISTENERS
+                         ? inline_funcs
+                         : (jerry_value_t *) malloc(len * sizeof(jerry_value_t));
+  for (uint32_t i = 0; i < len; i++) {
+    funcs[i] = jerry_acquire_value(listeners.funcs[i]);
+  }
+  jerry_value_t this_val = jerry_acquire_value(item->this_val);
+
+  for (uint32_t i = 0; i < len; i++) {
+    jerry_value_t retval = jerry_call_function(funcs[i], this_val, args, args_cnt);
+    ext::error::log_runtime_error(retval);
+    jerry_release_value(retval);
+    jerry_release_value(funcs[i]);
+  }
+
+  jerry_release_value(this_val);
+  if (funcs != inline_funcs) {
+    free(funcs);
+  }
+}
+
+void ext::websocket::release_item(websocket_item *item) {
+  for (int i = 0; i < WEBSOCKET_EVENTS; i++) {
+    websocket_listeners &listeners = item->listeners[i];
+    for (uint32_t j = 0; j < listeners.len; j++) {
+      jerry_release_value(listeners.funcs[j]);
     }
+    free(listeners.funcs);
   }
+  jerry_set_object_native_pointer(item->this_val, nullptr, &native_info);
+  jerry_release_value(item->this_val);
+  drop_queue(item);
+  delete item;
+}
+
+EM_BOOL ext::websocket::open_callback(int eventType, const EmscriptenWebSocketOpenEvent *e, void *userData) {
+  auto item = (ext::websocket_item *) userData;
+  ext::context::scope scope(item->context);
+  item->status = WEBSOCKET_OPEN_STATUS;
+  // sends made while connecting go out first, in order
+  flush_queue(item);
+  emit(item, WEBSOCKET_EVENT_OPEN, nullptr, 0);
+  ext::helper::flush();
   return 0;
 }
-#endif
 
-#ifdef __EMSCRIPTEN__
 EM_BOOL ext::websocket::close_callback(int eventType, const EmscriptenWebSocketCloseEvent *e, void *userData) {
-  auto item = (ext::websocket_item *)userData;
-  auto _id = item->id;
-  int32_t index = websocket_item_map.find(_id);
-  if(index > -1) {
-    auto item = websocket_item_map.get(_id);
-    item->status = WEBSOCKET_CLOSE_STATUS;
-
-    item->events.foreach([](string key, map<jerry_value_t, uint32_t> value, void *this_val) -> void {
-      bool emitted = key == string("close");
-      if (emitted) {
-        value.foreach([](jerry_value_t k, uint32_t z, void *userData) -> void {
-          auto tiv = (jerry_value_t *) userData;
-          if(jerry_value_is_function(k)) {
-            jerry_value_t retval = jerry_call_function(k, *tiv, nullptr, 0);
-            ext::error::log_runtime_error(retval);
-            jerry_release_value(retval);
-            jerry_release_value(k);
-          }
-        }, this_val);
-      } else {
-        value.foreach([](jerry_value_t k, uint32_t zero, void *userData) -> void {
-          jerry_release_value(k);
-        }, nullptr);
-      }
-    }, &item->this_val);
-
-    jerry_release_value(item->this_val);
-    emscripten_websocket_delete(item->socket);
-    websocket_item_map.remove(_id);
-  }
-
+  auto item = (ext::websocket_item *) userData;
+  ext::context::scope scope(item->context);
+  item->status = WEBSOCKET_CLOSE_STATUS;
+  drop_queue(item);
+  emit(item, WEBSOCKET_EVENT_CLOSE, nullptr, 0);
+
+  EMSCRIPTEN_WEBSOCKET_T socket = item->socket;
+  context_data<state>::get()->websocket_item_map.remove(item->id);
+  release_item(item);
+  emscripten_websocket_delete(socket);
+
+  ext::helper::flush();
   return 0;
 }
-#endif
 
-#ifdef __EMSCRIPTEN__
 EM_BOOL ext::websocket::error_callback(int eventType, const EmscriptenWebSocketErrorEvent *e, void *userData) {
-  auto item = (ext::websocket_item *)userData;
-  auto _id = item->id;
-  int32_t index = websocket_item_map.find(_id);
-  if(index > -1) {
-    auto item = websocket_item_map.get(_id);
-    auto events = item->events.get(string("error"));
-    item->userData = (void *)eventType;
-
-    if(events != nullptr) {
-      events->foreach([](jerry_value_t k, uint32_t z, void *userData) -> void {
-        auto item = (websocket_item *)userData;
-        jerry_value_t args[1];
-        args[0] = jerry_create_number(*((int *)item->userData));
-        if(jerry_value_is_function(k)) {
-          jerry_value_t retval = jerry_call_function(k, item->this_val, args, 1);
-          ext::error::log_runtime_error(retval);
-          jerry_release_value(retval);
-        }
-        jerry_release_value(args[0]);
-      }, item);
-    }
-  }
+  auto item = (ext::websocket_item *) userData;
+  ext::context::scope scope(item->context);
+  jerry_value_t arg = jerry_create_number(eventType);
+  emit(item, WEBSOCKET_EVENT_ERROR, &arg, 1);
+  jerry_release_value(arg);
+  ext::helper::flush();
   return 0;
 }
-#endif
 
-#ifdef __EMSCRIPTEN__
 EM_BOOL ext::websocket::message_callback(int eventType, const EmscriptenWebSocketMessageEvent *e, void *userData) {
-  if(e->numBytes <= 0){
+  auto item = (ext::websocket_item *) userData;
+  if(e->numBytes <= 0 || item->status != WEBSOCKET_OPEN_STATUS){
     return 0;
   }
 
-  auto item = (ext::websocket_item *)userData;
-  auto _id = item->id;
-  int32_t index = websocket_item_map.find(_id);
-  if(index > -1){
-    auto item = websocket_item_map.get(_id);
-    if(item->status != WEBSOCKET_OPEN_STATUS){
-      return 0;
-    }
-
-    jerry_value_t arg;
-    if(e->isText){
-      arg = JERRY_STRING((char *)e->data);
-    }else{
-      jerry_value_t arraybuf = jerry_create_arraybuffer(e->numBytes);
-      jerry_arraybuffer_write(arraybuf, 0, e->data, e->numBytes);
-      arg = jerry_create_typedarray_for_arraybuffer(JERRY_TYPEDARRAY_UINT8, arraybuf);
-      jerry_release_value(arraybuf);
-    }
-
-    auto events = item->events.get(string("message"));
-    item->userData = (void *)&arg;
-    if(events != nullptr) {
-      events->foreach([](jerry_value_t k, uint32_t z, void *userData) -> void {
-        auto item = (websocket_item *)userData;
-        jerry_value_t args[1];
-        args[0] = *((jerry_value_t *)item->userData);
-        if(jerry_value_is_function(k)) {
-          jerry_value_t retval = jerry_call_function(k, item->this_val, args, 1);
-          ext::error::log_runtime_error(retval);
-          jerry_release_value(retval);
-        }
-      }, item);
-    }
-
-    jerry_release_value(arg);
+  ext::context::scope scope(item->context);
+  jerry_value_t arg;
+  if(e->isText){
+    arg = jerry_create_string_sz_from_utf8(e->data, e->numBytes);
+  }else{
+    jerry_value_t arraybuf = jerry_create_arraybuffer(e->numBytes);
+    jerry_arraybuffer_write(arraybuf, 0, e->data, e->numBytes);
+    arg = jerry_create_typedarray_for_arraybuffer(JERRY_TYPEDARRAY_UINT8, arraybuf);
+    jerry_release_value(arraybuf);
   }
+
+  emit(item, WEBSOCKET_EVENT_MESSAGE, &arg, 1);
+  jerry_release_value(arg);
+  ext::helper::flush();
   return 0;
 }
-#endif
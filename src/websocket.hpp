@@ -1,21 +1,27 @@
 #ifndef JPROTECTOR_WEBSOCKET_HPP
 #define JPROTECTOR_WEBSOCKET_HPP
 
+#include <cstdlib>
 #include <cstring>
 #include "error.hpp"
 #include "marco.hpp"
 #include "string.hpp"
 #include "map.hpp"
+#include "context.hpp"
+#include "names.hpp"
 
 extern "C" {
 #include "jerryscript.h"
 
-#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
 #include "emscripten/websocket.h"
-#endif
 };
 
+// default cap on bufferedAmount, a send that would pass it is refused
+#define WEBSOCKET_HIGH_WATER_MARK (16 * 1024 * 1024)
+// listeners of one event dispatched without a heap copy
+#define WEBSOCKET_INLINE_LISTENERS 8
+
 namespace ext {
   typedef enum {
     WEBSOCKET_INIT_STATUS = 0,
@@ -23,48 +29,78 @@ namespace ext {
     WEBSOCKET_CLOSE_STATUS,
   } websocket_status_t;
 
+  // index of each event's listeners, the names only matter to add/removeEventListener
+  typedef enum {
+    WEBSOCKET_EVENT_OPEN = 0,
+    WEBSOCKET_EVENT_MESSAGE,
+    WEBSOCKET_EVENT_ERROR,
+    WEBSOCKET_EVENT_CLOSE,
+    WEBSOCKET_EVENTS,
+  } websocket_event_t;
+
+  // a send made before the socket opened, the payload follows it
+  struct websocket_frame {
+    websocket_frame *next;
+    size_t len;
+    bool binary;
+  };
+
+  // listeners of one event, in the order they were added
+  struct websocket_listeners {
+    jerry_value_t *funcs;
+    uint32_t len;
+    uint32_t cap;
+  };
+
+  // one socket, attached to its JS object and handed to the emscripten
+  // callbacks, so it stays where it was allocated until the socket closes
   struct websocket_item {
     websocket_item() : id(0),
+                       context(nullptr),
                        url(string("")),
                        protocol(string("")),
                        status(WEBSOCKET_INIT_STATUS),
                        this_val(0),
-                       events(map<string, map<jerry_value_t, uint32_t>>()),
-                       userData(nullptr) {
+                       listeners(),
+                       socket(0),
+                       queue_head(nullptr),
+                       queue_tail(nullptr),
+                       queued(0),
+                       high_water_mark(WEBSOCKET_HIGH_WATER_MARK) {
     };
 
-    websocket_item(const websocket_item &item) : id(item.id),
-                                                 url(item.url),
-                                                 protocol(item.protocol),
-                                                 status(item.status),
-                                                 this_val(item.this_val),
-                                                 events(item.events),
-                                                 userData(item.userData) {};
-
-    websocket_item &operator=(const websocket_item &item) {
-      id = item.id;
-      url = item.url;
-      protocol = item.protocol;
-      status = item.status;
-      this_val = item.this_val;
-      events = item.events;
-      userData = item.userData;
-      return *this;
-    }
-
     uint32_t id;
+    jerry_context_t *context;
     string url;
     string protocol;
     uint32_t status;
-    void *userData;
     jerry_value_t this_val;
-    map<string, map<jerry_value_t, uint32_t>> events;
-#ifdef __EMSCRIPTEN__
+    websocket_listeners listeners[WEBSOCKET_EVENTS];
     EMSCRIPTEN_WEBSOCKET_T socket;
-#endif
+    // sends waiting for the socket to open, and their bytes
+    websocket_frame *queue_head;
+    websocket_frame *queue_tail;
+    size_t queued;
+    size_t high_water_mark;
   };
 
   class websocket {
+    struct state {
+      state() : id(0), scratch(nullptr), scratch_cap(0) {};
+
+      ~state() {
+        free(scratch);
+      }
+
+      void release();
+
+      uint32_t id;
+      map<uint32_t, ext::websocket_item *> websocket_item_map;
+      // reused for text frames and binary ones the engine keeps in its heap
+      uint8_t *scratch;
+      size_t scratch_cap;
+    };
+
   public:
     static int init();
 
@@ -79,19 +115,36 @@ namespace ext {
 
     static JERRY_EXTERNAL_FUNC(send);
 
-    static void define_property_get_set_func(jerry_value_t obj,
-                                             const char *,
-                                             jerry_external_handler_t,
-                                             jerry_external_handler_t);
+    static JERRY_EXTERNAL_FUNC(get_buffered_amount);
+
+    static JERRY_EXTERNAL_FUNC(get_high_water_mark);
+
+    static JERRY_EXTERNAL_FUNC(set_high_water_mark);
+
+    static websocket_item *find_item(jerry_value_t this_value);
+
+    static websocket_event_t event_type(jerry_value_t name);
+
+    static uint8_t *scratch(size_t size);
+
+    static size_t buffered_amount(websocket_item *item);
+
+    static void send_frame(websocket_item *item, const uint8_t *data, size_t len, bool binary);
+
+    static void flush_queue(websocket_item *item);
+
+    static void drop_queue(websocket_item *item);
+
+    static void emit(websocket_item *item, websocket_event_t type, const jerry_value_t *args, jerry_length_t args_cnt);
+
+    static void release_item(websocket_item *item);
+
+    static const jerry_object_native_info_t native_info;
 
-#ifdef __EMSCRIPTEN__
     static EM_BOOL open_callback(int eventType, const EmscriptenWebSocketOpenEvent *e, void *userData);
     static EM_BOOL close_callback(int eventType, const EmscriptenWebSocketCloseEvent *e, void *userData);
     static EM_BOOL error_callback(int eventType, const EmscriptenWebSocketErrorEvent *e, void *userData);
     static EM_BOOL message_callback(int eventType, const EmscriptenWebSocketMessageEvent *e, void *userData);
-#endif
-    static uint32_t id;
-    static map<uint32_t, ext::websocket_item> websocket_item_map;
   };
 
 }
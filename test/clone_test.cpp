@@ -0,0 +1,248 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "core.hpp"
+#include "clone.hpp"
+#include "loop.hpp"
+
+#define MESSAGE_MAX 4096
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += ok ? 0 : 1;
+}
+
+/*
+ * Messages are written by hand in the format of clone.hpp and handed to a
+ * worker that posts every message straight back. A value read correctly is
+ * written out again byte for byte, references included.
+ */
+struct message {
+  uint8_t data[MESSAGE_MAX];
+  size_t len;
+
+  message() : len(0) {
+    put(CLONE_VERSION);
+  }
+
+  message &put(uint8_t byte) {
+    data[len++] = byte;
+    return *this;
+  }
+
+  message &varint(uint64_t value) {
+    while (value >= 0x80) {
+      put((uint8_t) (value | 0x80));
+      value >>= 7;
+    }
+    return put((uint8_t) value);
+  }
+
+  message &bytes(const void *p, size_t n) {
+    memcpy(data + len, p, n);
+    len += n;
+    return *this;
+  }
+
+  message &int32(int32_t value) {
+    return put(ext::CLONE_INT32).bytes(&value, sizeof(value));
+  }
+
+  message &number(double value) {
+    return put(ext::CLONE_DOUBLE).bytes(&value, sizeof(value));
+  }
+
+  // a string value, or with `tag` false an object key
+  message &str(const char *s, bool tag = true) {
+    if (tag) {
+      put(ext::CLONE_STRING);
+    }
+    return varint(strlen(s)).bytes(s, strlen(s));
+  }
+};
+
+static uint8_t echoed[MESSAGE_MAX];
+static size_t echoed_len = 0;
+static uint32_t echoes = 0;
+
+static void post(security_worker_t *worker, const char *data, size_t len, void *user_data) {
+  for (size_t pos = 0; pos + sizeof(uint32_t) <= len;) {
+    uint32_t frame;
+    memcpy(&frame, data + pos, sizeof(frame));
+    pos += sizeof(frame);
+    echoed_len = frame < MESSAGE_MAX ? frame : 0;
+    memcpy(echoed, data + pos, echoed_len);
+    echoes += 1;
+    pos += frame;
+  }
+}
+
+// refused messages are logged by dispatch, counted here instead
+static uint32_t errors = 0;
+
+static void sink(security_worker_t *worker, security_worker_log_level_t level, double time_ms, const char *text,
+                 size_t len, void *user_data) {
+  errors += level == SECURITY_WORKER_LOG_ERROR ? 1 : 0;
+}
+
+static void round_trip(security_worker_t *worker, const char *name, const message &m) {
+  echoes = 0;
+  int ret = security_worker_onmessage(worker, (const char *) m.data, m.len);
+  check(ret == 0 && echoes == 1 && echoed_len == m.len && memcmp(echoed, m.data, m.len) == 0, name);
+}
+
+static void rejected(security_worker_t *worker, const char *name, const uint8_t *data, size_t len) {
+  echoes = 0;
+  errors = 0;
+  int ret = security_worker_onmessage(worker, (const char *) data, len);
+  check(ret == -1 && echoes == 0 && errors == 1, name);
+}
+
+static void rejected(security_worker_t *worker, const char *name, const message &m) {
+  rejected(worker, name, m.data, m.len);
+}
+
+// every proper prefix of a valid message is refused
+static void truncated(security_worker_t *worker, const char *name, const message &m) {
+  bool ok = true;
+  for (size_t len = 0; len < m.len; len++) {
+    echoes = 0;
+    errors = 0;
+    ok = ok && security_worker_onmessage(worker, (const char *) m.data, len) == -1 && echoes == 0 && errors == 1;
+  }
+  check(ok, name);
+}
+
+static void nested(message &m, uint32_t depth) {
+  for (uint32_t i = 0; i < depth; i++) {
+    m.put(ext::CLONE_ARRAY).varint(1);
+  }
+  m.put(ext::CLONE_NULL);
+}
+
+int main() {
+  ext::loop::init();
+
+  const char *source = "onmessage = function (m) { postMessage(m); };";
+  size_t en_len = 0;
+  char *payload = security_worker_pack(source, strlen(source), &en_len);
+  security_worker_t *worker = security_worker_create(payload, strlen(payload), en_len, (char *) "[]", post, nullptr);
+  free(payload);
+  if (worker == nullptr) {
+    check(false, "worker");
+    return 1;
+  }
+  security_worker_log_config_t log_config = {};
+  log_config.sink = sink;
+  security_worker_log_config(worker, &log_config);
+
+  round_trip(worker, "undefined", message().put(ext::CLONE_UNDEFINED));
+  round_trip(worker, "null", message().put(ext::CLONE_NULL));
+  round_trip(worker, "false", message().put(ext::CLONE_FALSE));
+  round_trip(worker, "true", message().put(ext::CLONE_TRUE));
+  round_trip(worker, "int32", message().int32(-123456));
+  round_trip(worker, "int32 limits", message().put(ext::CLONE_ARRAY).varint(2).int32(INT32_MIN).int32(INT32_MAX));
+  round_trip(worker, "double", message().number(1.5));
+  round_trip(worker, "negative zero", message().number(-0.0));
+  round_trip(worker, "infinity", message().number(-1.0 / 0.0));
+  round_trip(worker, "empty string", message().str(""));
+  round_trip(worker, "UTF-8 string", message().str("h\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"));
+  round_trip(worker, "string with a NUL", message().put(ext::CLONE_STRING).varint(3).bytes("a\0b", 3));
+
+  message long_string;
+  char chars[300];
+  memset(chars, 'x', sizeof(chars) - 1);
+  chars[sizeof(chars) - 1] = '\0';
+  round_trip(worker, "string with a two byte length", long_string.str(chars));
+
+  round_trip(worker, "array", message().put(ext::CLONE_ARRAY).varint(3).int32(1).str("two").put(ext::CLONE_NULL));
+  round_trip(worker, "empty object", message().put(ext::CLONE_OBJECT).varint(0));
+  round_trip(worker, "object", message().put(ext::CLONE_OBJECT).varint(1).str("k\xc3\xa9y", false).number(2.5));
+  round_trip(worker, "__proto__ key", message().put(ext::CLONE_OBJECT).varint(1).str("__proto__", false).int32(7));
+
+  uint8_t raw[16];
+  for (uint8_t i = 0; i < sizeof(raw); i++) {
+    raw[i] = (uint8_t) (i * 17);
+  }
+  round_trip(worker, "arraybuffer", message().put(ext::CLONE_ARRAYBUFFER).varint(sizeof(raw))
+                                             .bytes(raw, sizeof(raw)));
+  round_trip(worker, "empty arraybuffer", message().put(ext::CLONE_ARRAYBUFFER).varint(0));
+  for (uint8_t type = JERRY_TYPEDARRAY_UINT8; type <= JERRY_TYPEDARRAY_FLOAT64; type++) {
+    char name[32];
+    snprintf(name, sizeof(name), "typed array type %u", type);
+    round_trip(worker, name, message().put(ext::CLONE_TYPEDARRAY).put(type).varint(8).bytes(raw, 8));
+  }
+
+  // [o, o] with o = {}: the second is the first again
+  message shared;
+  shared.put(ext::CLONE_ARRAY).varint(2).put(ext::CLONE_OBJECT).varint(0).put(ext::CLONE_REFERENCE).varint(1);
+  round_trip(worker, "shared reference", shared);
+
+  // a = [a], o = {self: o, buf: b, view: t, again: b}
+  round_trip(worker, "cyclic array", message().put(ext::CLONE_ARRAY).varint(1).put(ext::CLONE_REFERENCE).varint(0));
+  message cyclic;
+  cyclic.put(ext::CLONE_OBJECT).varint(4)
+        .str("self", false).put(ext::CLONE_REFERENCE).varint(0)
+        .str("buf", false).put(ext::CLONE_ARRAYBUFFER).varint(4).bytes(raw, 4)
+        .str("view", false).put(ext::CLONE_TYPEDARRAY).put(JERRY_TYPEDARRAY_UINT16).varint(4).bytes(raw, 4)
+        .str("again", false).put(ext::CLONE_REFERENCE).varint(1);
+  round_trip(worker, "cyclic object with buffers", cyclic);
+
+  message deepest;
+  nested(deepest, CLONE_MAX_DEPTH);
+  round_trip(worker, "nesting at the depth limit", deepest);
+
+  rejected(worker, "empty message", message().data, 0);
+  const uint8_t next_version[] = {CLONE_VERSION + 1, ext::CLONE_NULL};
+  rejected(worker, "unknown version", next_version, sizeof(next_version));
+  rejected(worker, "unknown tag", message().put(ext::CLONE_REFERENCE + 1));
+  rejected(worker, "trailing bytes", message().put(ext::CLONE_NULL).put(ext::CLONE_NULL));
+
+  truncated(worker, "truncated int32", message().int32(1));
+  truncated(worker, "truncated double", message().number(1.5));
+  truncated(worker, "truncated string", long_string);
+  truncated(worker, "truncated object", cyclic);
+  truncated(worker, "truncated typed array", message().put(ext::CLONE_TYPEDARRAY).put(JERRY_TYPEDARRAY_FLOAT64)
+                                                     .varint(8).bytes(raw, 8));
+  truncated(worker, "truncated nesting", deepest);
+
+  rejected(worker, "reference to nothing", message().put(ext::CLONE_REFERENCE).varint(0));
+  rejected(worker, "reference past the last object",
+           message().put(ext::CLONE_ARRAY).varint(2).put(ext::CLONE_OBJECT).varint(0)
+                    .put(ext::CLONE_REFERENCE).varint(2));
+  rejected(worker, "reference past uint32", message().put(ext::CLONE_ARRAY).varint(1)
+                                                     .put(ext::CLONE_REFERENCE).varint(1ull << 32));
+  rejected(worker, "varint longer than five bytes",
+           message().put(ext::CLONE_STRING).put(0x81).put(0x80).put(0x80).put(0x80).put(0x80).put(0x00));
+  rejected(worker, "array longer than its message", message().put(ext::CLONE_ARRAY).varint(1000000)
+                                                             .put(ext::CLONE_NULL));
+  rejected(worker, "arraybuffer longer than its message", message().put(ext::CLONE_ARRAYBUFFER).varint(17)
+                                                                   .bytes(raw, sizeof(raw)));
+  rejected(worker, "typed array of no type", message().put(ext::CLONE_TYPEDARRAY).put(JERRY_TYPEDARRAY_INVALID)
+                                                      .varint(0));
+  rejected(worker, "typed array of an unknown type", message().put(ext::CLONE_TYPEDARRAY).put(0x7f).varint(0));
+  rejected(worker, "typed array of a partial element", message().put(ext::CLONE_TYPEDARRAY)
+                                                                .put(JERRY_TYPEDARRAY_UINT32).varint(6).bytes(raw, 6));
+
+  message too_deep;
+  nested(too_deep, CLONE_MAX_DEPTH + 1);
+  rejected(worker, "nesting past the depth limit", too_deep);
+  message far_too_deep;
+  nested(far_too_deep, 1000);
+  rejected(worker, "nesting far past the depth limit", far_too_deep);
+
+  rejected(worker, "invalid UTF-8", message().put(ext::CLONE_STRING).varint(2).bytes("\xc3\x28", 2));
+  rejected(worker, "overlong UTF-8", message().put(ext::CLONE_STRING).varint(2).bytes("\xc0\xaf", 2));
+  rejected(worker, "UTF-8 cut short", message().put(ext::CLONE_STRING).varint(2).bytes("\xe2\x82", 2));
+  rejected(worker, "invalid UTF-8 key", message().put(ext::CLONE_OBJECT).varint(1).put(1).put(0xff)
+                                                 .put(ext::CLONE_NULL));
+
+  // still answering after all of the above
+  round_trip(worker, "intact after bad input", shared);
+
+  security_worker_exit(worker);
+  ext::loop::shutdown();
+  return failures == 0 ? 0 : 1;
+}
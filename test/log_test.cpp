@@ -0,0 +1,164 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "core.hpp"
+#include "log.hpp"
+#include "loop.hpp"
+
+// lines logged by the first message, enough to fill the ring many times over
+#define LINES 2000
+// the second logs lines this long, around a line of the sink that logs more
+#define NESTED_OUTER 100
+#define NESTED_INNER 200
+#define NESTED_CHARS 600
+#define NESTED_AT 50
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += ok ? 0 : 1;
+}
+
+static const char *source = R"(
+  var chars = ['x', 'é', '€'];
+  function filler(i) { return new Array((i * 7919) % 1700 + 1).join(chars[i % 3]); }
+  onmessage = function (m) {
+    var i;
+    if (m == 0) {
+      for (i = 0; i < 2000; i++) console.log(i, filler(i));
+    } else if (m == 1) {
+      for (i = 0; i < 100; i++) console.log(i == 50 ? 'nest' : i, new Array(601).join('o'));
+    } else {
+      for (i = 0; i < 200; i++) console.log('inner', i, new Array(601).join('i'));
+    }
+  };
+)";
+
+static const char *chars[] = {"x", "\xc3\xa9", "\xe2\x82\xac"};
+
+static char expected[LOG_MAX_RECORD * 2];
+static uint32_t next_line = 0;
+static uint32_t next_inner = 0;
+static uint32_t bad_lines = 0;
+static uint32_t notices = 0;
+static uint64_t noticed = 0;
+
+// the line console.log(i, filler(i)) leaves in the ring, cut at
+// LOG_MAX_RECORD on a character boundary like log::write does
+static size_t expected_line(uint32_t i, bool *truncated) {
+  const char *c = chars[i % 3];
+  size_t c_len = strlen(c);
+  size_t count = (i * 7919) % 1700;
+  size_t len = (size_t) snprintf(expected, sizeof(expected), "[LOG] %u ", i);
+  size_t avail = LOG_MAX_RECORD - len;
+  *truncated = count * c_len + 1 > avail;
+  size_t fits = *truncated ? avail / c_len : count;
+  for (size_t k = 0; k < fits; k++) {
+    memcpy(expected + len, c, c_len);
+    len += c_len;
+  }
+  if (len < LOG_MAX_RECORD) {
+    expected[len++] = ' ';
+  }
+  return len;
+}
+
+static bool is_line(const char *text, size_t len, const char *want, size_t want_len) {
+  return len == want_len && memcmp(text, want, len) == 0;
+}
+
+static void sink(security_worker_t *w, security_worker_log_level_t level, double time_ms, const char *text,
+                 size_t len, void *user_data) {
+  auto phase = (int *) user_data;
+  if (*phase == 0) {
+    bool truncated;
+    size_t want = expected_line(next_line++, &truncated);
+    bad_lines += is_line(text, len, expected, want) ? 0 : 1;
+    return;
+  }
+
+  if (level == SECURITY_WORKER_LOG_WARN) {
+    notices += 1;
+    noticed = strtoull(text + strlen("[WARN] "), nullptr, 10);
+    return;
+  }
+
+  char want[NESTED_CHARS + 32];
+  size_t want_len;
+  if (next_line < NESTED_OUTER) {
+    want_len = next_line == NESTED_AT ? (size_t) snprintf(want, sizeof(want), "[LOG] nest ")
+                                      : (size_t) snprintf(want, sizeof(want), "[LOG] %u ", next_line);
+    memset(want + want_len, 'o', NESTED_CHARS);
+    want_len += NESTED_CHARS;
+    want[want_len++] = ' ';
+    bad_lines += is_line(text, len, want, want_len) ? 0 : 1;
+
+    // the ring still holds this line and the rest of the message while
+    // the sink has the worker log more
+    if (next_line++ == NESTED_AT) {
+      security_worker_onmessage_json(w, "2");
+    }
+    return;
+  }
+
+  want_len = (size_t) snprintf(want, sizeof(want), "[LOG] inner %u ", next_inner++);
+  memset(want + want_len, 'i', NESTED_CHARS);
+  want_len += NESTED_CHARS;
+  want[want_len++] = ' ';
+  bad_lines += is_line(text, len, want, want_len) ? 0 : 1;
+}
+
+int main() {
+  ext::loop::init();
+
+  size_t en_len = 0;
+  char *payload = security_worker_pack(source, strlen(source), &en_len);
+  security_worker_t *worker = security_worker_create(payload, strlen(payload), en_len, (char *) "[]", nullptr, nullptr);
+  free(payload);
+  if (worker == nullptr) {
+    check(false, "worker");
+    return 1;
+  }
+
+  int phase = 0;
+  security_worker_log_config_t config = {};
+  config.sink = sink;
+  config.sink_data = &phase;
+  security_worker_log_config(worker, &config);
+
+  // one turn that logs far more than the ring holds, handed over early each time it fills
+  security_worker_log_stats_t stats;
+  security_worker_onmessage_json(worker, "0");
+  security_worker_log_stats(worker, &stats);
+  uint64_t truncated = 0;
+  size_t ring_bytes = 0;
+  for (uint32_t i = 0; i < LINES; i++) {
+    bool cut;
+    ring_bytes += expected_line(i, &cut) + 16;
+    truncated += cut ? 1 : 0;
+  }
+  check(next_line == LINES && bad_lines == 0, "every line arrives whole and in order");
+  check(stats.written[SECURITY_WORKER_LOG_LOG] == LINES && stats.overflowed == 0, "nothing dropped");
+  check(stats.truncated > 0 && stats.truncated == truncated, "lines past LOG_MAX_RECORD count as truncated");
+  check(stats.flushes > ring_bytes / LOG_RING_SIZE, "the ring is handed over each time it fills");
+
+  // lines the sink causes while the ring is held wrap around to its start,
+  // and once it is full they are dropped and counted
+  phase = 1;
+  next_line = 0;
+  bad_lines = 0;
+  security_worker_log_stats_t before = stats;
+  security_worker_onmessage_json(worker, "1");
+  security_worker_log_stats(worker, &stats);
+  uint64_t overflowed = stats.overflowed - before.overflowed;
+  check(next_line == NESTED_OUTER && bad_lines == 0, "lines around the nested ones arrive in order");
+  // a few fit after the outer lines, the rest only past the wrap marker
+  check(next_inner > NESTED_AT / 2, "nested lines wrap around to the space before the held line");
+  check(overflowed > 0 && next_inner + overflowed == NESTED_INNER, "lines that find the ring full are counted");
+  check(notices == 1 && noticed == overflowed, "one notice reports the dropped lines");
+
+  security_worker_exit(worker);
+  ext::loop::shutdown();
+  return failures == 0 ? 0 : 1;
+}
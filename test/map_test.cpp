@@ -0,0 +1,277 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "map.hpp"
+
+#define REFERENCE_MAX 4096
+#define RANDOM_OPS 200000
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += ok ? 0 : 1;
+}
+
+/*
+ * The reference keeps entries in insertion order in a plain array and
+ * looks them up one by one; the map has to agree with it on every lookup,
+ * on its size and on the order foreach visits.
+ */
+struct reference {
+  uint32_t keys[REFERENCE_MAX];
+  uint32_t values[REFERENCE_MAX];
+  uint32_t len;
+
+  reference() : len(0) {}
+
+  int32_t find(uint32_t key) {
+    for (uint32_t i = 0; i < len; i++) {
+      if (keys[i] == key) {
+        return (int32_t) i;
+      }
+    }
+    return -1;
+  }
+
+  // like map::add, a key that is already there keeps its value
+  void add(uint32_t key, uint32_t value) {
+    if (find(key) == -1) {
+      keys[len] = key;
+      values[len++] = value;
+    }
+  }
+
+  void remove(uint32_t key) {
+    int32_t i = find(key);
+    if (i != -1) {
+      memmove(keys + i, keys + i + 1, (len - i - 1) * sizeof(uint32_t));
+      memmove(values + i, values + i + 1, (len - i - 1) * sizeof(uint32_t));
+      len -= 1;
+    }
+  }
+};
+
+struct visit {
+  uint32_t keys[REFERENCE_MAX];
+  uint32_t values[REFERENCE_MAX];
+  uint32_t len;
+};
+
+static void collect(uint32_t key, uint32_t value, void *user_data) {
+  auto v = (visit *) user_data;
+  if (v->len < REFERENCE_MAX) {
+    v->keys[v->len] = key;
+    v->values[v->len++] = value;
+  }
+}
+
+static bool same(map<uint32_t, uint32_t> &m, reference &r) {
+  if (m.size() != r.len) {
+    return false;
+  }
+  for (uint32_t i = 0; i < r.len; i++) {
+    uint32_t *value = m.get(r.keys[i]);
+    if (value == nullptr || *value != r.values[i]) {
+      return false;
+    }
+  }
+
+  visit v;
+  v.len = 0;
+  m.foreach(collect, &v);
+  return v.len == r.len && memcmp(v.keys, r.keys, r.len * sizeof(uint32_t)) == 0 &&
+         memcmp(v.values, r.values, r.len * sizeof(uint32_t)) == 0;
+}
+
+static uint32_t random_state = 2463534242u;
+
+static uint32_t next_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 17;
+  random_state ^= random_state << 5;
+  return random_state;
+}
+
+// keys whose home slot in a map of MAP_MIN_CAPACITY entries is `home`
+static uint32_t colliding(uint32_t home, uint32_t nth) {
+  uint32_t mask = MAP_MIN_CAPACITY * 2 - 1;
+  for (uint32_t key = 0;; key++) {
+    if ((map_hash<uint32_t>::hash(key) & mask) == home && nth-- == 0) {
+      return key;
+    }
+  }
+}
+
+static void random_ops() {
+  // few distinct keys, so adds hit existing keys and removes hit live ones
+  map<uint32_t, uint32_t> m;
+  reference r;
+  bool ok = true;
+  uint32_t checked = 0;
+  for (uint32_t op = 0; op < RANDOM_OPS && ok; op++) {
+    uint32_t key = next_random() % (op < RANDOM_OPS / 2 ? 64 : 1024);
+    if (next_random() % 3 != 0) {
+      m.add(key, op);
+      r.add(key, op);
+    } else {
+      m.remove(key);
+      r.remove(key);
+    }
+
+    uint32_t probe = next_random() % 1024;
+    ok = (m.get(probe) == nullptr) == (r.find(probe) == -1);
+    if (op % 97 == 0) {
+      ok = ok && same(m, r);
+      checked += 1;
+    }
+  }
+  char what[64];
+  snprintf(what, sizeof(what), "%u random adds and removes, %u full comparisons", RANDOM_OPS, checked);
+  check(ok && same(m, r), what);
+}
+
+static void backward_shift() {
+  map<uint32_t, uint32_t> m;
+  reference r;
+  // one chain that starts at slot 3 and runs into the keys homed at 4, and
+  // one that wraps around from the last slot to the first
+  uint32_t keys[] = {colliding(3, 0), colliding(3, 1), colliding(4, 0), colliding(3, 2), colliding(4, 1),
+                     colliding(15, 0), colliding(15, 1), colliding(0, 0)};
+  for (uint32_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+    m.add(keys[i], i);
+    r.add(keys[i], i);
+  }
+  // still at its first capacity, so the index is the one the keys were picked for
+  check(same(m, r) && m.max_size() == MAP_MIN_CAPACITY, "colliding keys share their probe chains");
+
+  bool ok = true;
+  uint32_t order[] = {0, 2, 7, 5, 3, 1, 4, 6};
+  for (uint32_t i = 0; i < sizeof(order) / sizeof(order[0]) && ok; i++) {
+    ok = m.remove(keys[order[i]]) != -1 && m.remove(keys[order[i]]) == -1;
+    r.remove(keys[order[i]]);
+    ok = ok && same(m, r);
+  }
+  check(ok && m.size() == 0, "removing from the head, middle and wrapped end of a chain");
+}
+
+static void growth() {
+  // a zero sized map allocates on the first add
+  map<uint32_t, uint32_t> m(0);
+  bool ok = m.max_size() == 0 && m.get(1) == nullptr && m.remove(1) == -1;
+  for (uint32_t i = 0; i < 10000; i++) {
+    ok = ok && m.add(i * 7, i) == i;
+  }
+  for (uint32_t i = 0; i < 10000; i++) {
+    uint32_t *value = m.get(i * 7);
+    ok = ok && value != nullptr && *value == i && m.get(i * 7 + 1) == nullptr;
+  }
+  check(ok && m.size() == 10000 && m.max_size() >= 10000, "growing from empty to 10000 entries");
+}
+
+static void insertion_order() {
+  map<uint32_t, uint32_t> m;
+  reference r;
+  for (uint32_t i = 0; i < 100; i++) {
+    m.add(i, i);
+    r.add(i, i);
+  }
+  // holes past half of the entries are compacted away, order stays
+  for (uint32_t i = 1; i < 100; i += 2) {
+    m.remove(i);
+    r.remove(i);
+  }
+  m.remove(0);
+  r.remove(0);
+  for (uint32_t i = 1000; i < 1050; i++) {
+    m.add(i, i);
+    r.add(i, i);
+  }
+  // a re-added key goes to the end
+  m.remove(50);
+  r.remove(50);
+  m.add(50, 5050);
+  r.add(50, 5050);
+  check(same(m, r), "foreach keeps insertion order across removes and compaction");
+
+  map<uint32_t, uint32_t> copy(m);
+  map<uint32_t, uint32_t> moved(std::move(copy));
+  check(same(moved, r) && copy.size() == 0, "copies and moves keep the order");
+}
+
+struct churn {
+  map<uint32_t, uint32_t> *m;
+  visit seen;
+};
+
+static void remove_while_iterating(uint32_t key, uint32_t value, void *user_data) {
+  auto c = (churn *) user_data;
+  collect(key, value, &c->seen);
+  // drop this entry and the next one, and add one past the end
+  c->m->remove(key);
+  c->m->remove(key + 1);
+  if (key < 100) {
+    c->m->add(key + 1000, key);
+  }
+}
+
+static void iterating() {
+  map<uint32_t, uint32_t> m;
+  for (uint32_t i = 0; i < 100; i++) {
+    m.add(i, i);
+  }
+
+  churn c;
+  c.m = &m;
+  c.seen.len = 0;
+  m.foreach(remove_while_iterating, &c);
+
+  // every other key runs and removes its successor, whose own run is
+  // skipped; the keys added meanwhile are visited too
+  bool ok = c.seen.len == 100;
+  for (uint32_t i = 0; i < 50 && ok; i++) {
+    ok = c.seen.keys[i] == i * 2 && c.seen.keys[50 + i] == 1000 + i * 2 && c.seen.values[50 + i] == i * 2;
+  }
+  check(ok && m.size() == 0, "removing and adding entries while iterating");
+
+  for (uint32_t i = 0; i < 300; i++) {
+    m.add(i, i);
+  }
+  ok = m.size() == 300;
+  for (uint32_t i = 0; i < 300 && ok; i++) {
+    ok = m.get(i) != nullptr && *m.get(i) == i;
+  }
+  check(ok, "the map is reusable once the iteration is over");
+}
+
+static void string_keys() {
+  map<string, uint32_t> m;
+  bool ok = true;
+  for (uint32_t i = 0; i < 500; i++) {
+    string key;
+    key << "key " << (unsigned long long) i;
+    ok = ok && m.add(key, i) == i;
+  }
+  for (uint32_t i = 0; i < 500; i += 2) {
+    string key;
+    key << "key " << (unsigned long long) i;
+    ok = ok && m.remove(key) != -1;
+  }
+  for (uint32_t i = 0; i < 500; i++) {
+    string key;
+    key << "key " << (unsigned long long) i;
+    uint32_t *value = m.get(key);
+    ok = ok && (i % 2 == 0 ? value == nullptr : value != nullptr && *value == i);
+  }
+  check(ok && m.size() == 250 && m.get(string("key")) == nullptr, "string keys");
+}
+
+int main() {
+  random_ops();
+  backward_shift();
+  growth();
+  insertion_order();
+  iterating();
+  string_keys();
+  return failures == 0 ? 0 : 1;
+}
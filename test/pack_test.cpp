@@ -0,0 +1,61 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "core.hpp"
+#include "loop.hpp"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += ok ? 0 : 1;
+}
+
+static uint32_t posts = 0;
+
+static void post(security_worker_t *worker, const char *data, size_t len, void *user_data) {
+  posts += 1;
+}
+
+static uint32_t errors = 0;
+
+static void sink(security_worker_t *worker, security_worker_log_level_t level, double time_ms, const char *text,
+                 size_t len, void *user_data) {
+  errors += level == SECURITY_WORKER_LOG_ERROR ? 1 : 0;
+}
+
+// packs `len` bytes of `source` and checks the worker answers a message
+static void runs(const char *name, const char *source, size_t len) {
+  size_t en_len = 0;
+  char *payload = security_worker_pack(source, len, &en_len);
+  security_worker_t *worker = security_worker_create(payload, strlen(payload), en_len, (char *) "[]", post, nullptr);
+  free(payload);
+  if (worker == nullptr) {
+    check(false, name);
+    return;
+  }
+  security_worker_log_config_t config = {};
+  config.sink = sink;
+  security_worker_log_config(worker, &config);
+
+  posts = 0;
+  errors = 0;
+  security_worker_onmessage_json(worker, "0");
+  security_worker_exit(worker);
+  check(posts == 1 && errors == 0, name);
+}
+
+int main() {
+  ext::loop::init();
+
+  const char *compiled = "onmessage = function (m) { postMessage(m); };";
+  runs("a compiled script runs from its snapshot", compiled, strlen(compiled));
+
+  // the first four bytes are the engine's snapshot magic; the bytes past the
+  // NUL do not parse, so the script is packed as source and runs up to the NUL
+  const char source[] = "JRRY = 1; onmessage = function (m) { postMessage(m + JRRY); };\0)";
+  runs("a source payload that starts like a snapshot runs as source", source, sizeof(source) - 1);
+
+  ext::loop::shutdown();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,380 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "core.hpp"
+#include "clone.hpp"
+#include "loop.hpp"
+
+extern "C" {
+#include "emscripten.h"
+}
+
+#define WAIT_MS 5000.0
+#define STUB_MAX_SEEN 64
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += ok ? 0 : 1;
+}
+
+/*
+ * HTTP stub on the test's own loop, one request per connection. Each path
+ * answers with a fixed response, and every request it sees is logged.
+ */
+struct stub_request {
+  char method[8];
+  char path[64];
+  char if_none_match[64];
+};
+
+struct stub_conn {
+  int fd;
+  ext::loop::watcher *io;
+  char in[8192];
+  size_t in_len;
+};
+
+static int stub_fd = -1;
+static ext::loop::watcher *stub_io = nullptr;
+static char stub_base[64];
+static stub_request seen[STUB_MAX_SEEN];
+static int seen_len = 0;
+// connections open at once, and the most seen
+static int open_now = 0;
+static int open_max = 0;
+
+static int stub_count(const char *method, const char *path) {
+  int n = 0;
+  for (int i = 0; i < seen_len; i++) {
+    n += strcmp(seen[i].method, method) == 0 && strcmp(seen[i].path, path) == 0 ? 1 : 0;
+  }
+  return n;
+}
+
+static bool stub_header(const char *head, const char *name, char *out, size_t out_len) {
+  size_t name_len = strlen(name);
+  for (const char *line = strstr(head, "\r\n"); line != nullptr && line[2] != '\r'; line = strstr(line + 2, "\r\n")) {
+    if (strncasecmp(line + 2, name, name_len) == 0 && line[2 + name_len] == ':') {
+      const char *value = line + 3 + name_len;
+      value += strspn(value, " ");
+      size_t len = strcspn(value, "\r\n");
+      len = len < out_len - 1 ? len : out_len - 1;
+      memcpy(out, value, len);
+      out[len] = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+static void stub_respond(stub_conn *c, const stub_request &r) {
+  int status = 200;
+  const char *headers = "";
+  const char *body = "";
+  if (strcmp(r.path, "/stream") == 0) {
+    body = "0123456789";
+  } else if (strcmp(r.path, "/broken") == 0) {
+    status = 500;
+    body = "broken";
+  } else if (strcmp(r.path, "/shared") == 0) {
+    body = "shared";
+  } else if (strcmp(r.path, "/fresh") == 0) {
+    headers = "Cache-Control: max-age=60\r\n";
+    body = "fresh";
+  } else if (strcmp(r.path, "/stale") == 0) {
+    // kept, but asked for again every time
+    headers = "Cache-Control: no-cache\r\nETag: \"v1\"\r\n";
+    status = strcmp(r.if_none_match, "\"v1\"") == 0 ? 304 : 200;
+    body = "stale body";
+  } else if (strcmp(r.path, "/doc") == 0) {
+    headers = strcmp(r.method, "GET") == 0 ? "Cache-Control: max-age=60\r\n" : "";
+    body = strcmp(r.method, "GET") == 0 ? "doc" : "posted";
+  }
+
+  char head[512];
+  int head_len = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\nConnection: close\r\n%s\r\n",
+                          status, status == 200 ? "OK" : status == 304 ? "Not Modified" : "Error",
+                          status == 304 ? (size_t) 0 : strlen(body), headers);
+  // the answers are small enough for the socket buffer
+  ssize_t ignored = write(c->fd, head, (size_t) head_len);
+  if (status != 304) {
+    ignored = write(c->fd, body, strlen(body));
+  }
+  (void) ignored;
+}
+
+static void stub_conn_handler(int fd, uint32_t events, void *user_data) {
+  auto c = (stub_conn *) user_data;
+  ssize_t n = read(fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len);
+  if (n > 0) {
+    c->in_len += (size_t) n;
+    c->in[c->in_len] = '\0';
+    const char *head = c->in;
+    const char *end = strstr(head, "\r\n\r\n");
+    char length[16] = "0";
+    stub_header(head, "Content-Length", length, sizeof(length));
+    if ((end == nullptr || c->in_len < (size_t) (end + 4 - head) + strtoul(length, nullptr, 10)) &&
+        c->in_len < sizeof(c->in) - 1) {
+      return;
+    }
+
+    stub_request r = {};
+    sscanf(head, "%7s %63s", r.method, r.path);
+    stub_header(head, "If-None-Match", r.if_none_match, sizeof(r.if_none_match));
+    if (seen_len < STUB_MAX_SEEN) {
+      seen[seen_len++] = r;
+    }
+    stub_respond(c, r);
+  }
+
+  ext::loop::unwatch(c->io);
+  close(fd);
+  delete c;
+  open_now -= 1;
+}
+
+static void stub_accept_handler(int fd, uint32_t events, void *user_data) {
+  int conn = accept(fd, nullptr, nullptr);
+  if (conn < 0) {
+    return;
+  }
+  auto c = new stub_conn{conn, nullptr, {0}, 0};
+  open_now += 1;
+  open_max = open_now > open_max ? open_now : open_max;
+  c->io = ext::loop::watch(conn, EPOLLIN, stub_conn_handler, c);
+}
+
+static bool stub_start() {
+  stub_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  if (stub_fd < 0 || bind(stub_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(stub_fd, 16) != 0 ||
+      getsockname(stub_fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+    return false;
+  }
+
+  snprintf(stub_base, sizeof(stub_base), "'http://127.0.0.1:%u'", ntohs(addr.sin_port));
+  stub_io = ext::loop::watch(stub_fd, EPOLLIN, stub_accept_handler, nullptr);
+  return stub_io != nullptr;
+}
+
+static void stub_stop() {
+  ext::loop::unwatch(stub_io);
+  close(stub_fd);
+}
+
+/*
+ * The scripts get the stub's address as `$` and send their requests from
+ * onmessage, once the config is set; they report with postMessage('ok ...')
+ * or postMessage('FAIL ...') and end with postMessage('done').
+ */
+static bool finished = false;
+
+static void post(security_worker_t *worker, const char *data, size_t len, void *user_data) {
+  for (size_t pos = 0; pos + sizeof(uint32_t) <= len;) {
+    uint32_t frame;
+    memcpy(&frame, data + pos, sizeof(frame));
+    pos += sizeof(frame);
+
+    // version, string tag and a one byte length, the reports are short
+    auto message = (const uint8_t *) data + pos;
+    if (frame >= 3 && message[0] == CLONE_VERSION && message[1] == ext::CLONE_STRING && message[2] < 0x80 &&
+        (size_t) message[2] + 3 <= frame) {
+      auto text = (const char *) message + 3;
+      size_t text_len = message[2];
+      if (text_len == 4 && memcmp(text, "done", 4) == 0) {
+        finished = true;
+      } else {
+        printf("%.*s\n", (int) text_len, text);
+        failures += text_len >= 4 && memcmp(text, "FAIL", 4) == 0 ? 1 : 0;
+      }
+    }
+    pos += frame;
+  }
+}
+
+// `config` applies before the script's requests are sent, nullptr keeps the defaults
+static security_worker_t *start(const char *name, const char *source,
+                                const security_worker_request_config_t *config = nullptr) {
+  size_t en_len = 0;
+  char *payload = security_worker_pack(source, strlen(source), &en_len);
+  seen_len = 0;
+  open_max = 0;
+  finished = false;
+  security_worker_t *worker = security_worker_create(payload, strlen(payload), en_len, stub_base, post, nullptr);
+  free(payload);
+  if (worker == nullptr) {
+    check(false, name);
+    return nullptr;
+  }
+  if (config != nullptr) {
+    security_worker_request_config(worker, config);
+  }
+  security_worker_onmessage_json(worker, "0");
+
+  double deadline = emscripten_get_now() + WAIT_MS;
+  while (!finished && emscripten_get_now() < deadline) {
+    ext::loop::run_once(10);
+  }
+  check(finished, name);
+  return worker;
+}
+
+// a stream that ends while its own callback aborts it is freed once
+static void abort_after_end() {
+  security_worker_t *worker = start("abort from the callbacks of an ended stream", R"(
+    onmessage = function () {
+    var ended = 0;
+    function end(h) { h.abort(); h.pause(); h.resume(); h.abort(); if (++ended == 2) postMessage('done'); }
+    var a = request({uri: $ + '/stream', onchunk: function () {}, success: function () { end(a); }});
+    var b = request({uri: $ + '/broken', onchunk: function () {}, error: function () { end(b); }});
+    };
+  )");
+  if (worker == nullptr) {
+    return;
+  }
+
+  security_worker_request_stats_t stats;
+  security_worker_request_stats(worker, &stats, nullptr, nullptr);
+  check(stats.fetches == 2 && stats.active == 0 && stats.failed == 1, "stream stats after abort");
+  security_worker_exit(worker);
+}
+
+static void coalesce() {
+  security_worker_t *worker = start("identical GETs in flight", R"(
+    onmessage = function () {
+      var n = 0;
+      function got(r) {
+        postMessage((r.text === 'shared' ? 'ok   ' : 'FAIL ') + 'coalesced body');
+        if (++n == 2) postMessage('done');
+      }
+      request({uri: $ + '/shared', success: got});
+      request({uri: $ + '/shared', success: got});
+    };
+  )");
+  if (worker == nullptr) {
+    return;
+  }
+
+  security_worker_request_stats_t stats;
+  security_worker_request_stats(worker, &stats, nullptr, nullptr);
+  check(stub_count("GET", "/shared") == 1 && stats.fetches == 1 && stats.coalesced == 1, "two GETs, one fetch");
+  security_worker_exit(worker);
+}
+
+static void fresh_hit() {
+  security_worker_t *worker = start("fresh cache hit", R"(
+    onmessage = function () {
+      request({uri: $ + '/fresh', success: function () {
+        request({uri: $ + '/fresh', success: function (r) {
+          postMessage((r.text === 'fresh' && r.status === 200 ? 'ok   ' : 'FAIL ') + 'cached body');
+          postMessage('done');
+        }});
+      }});
+    };
+  )");
+  if (worker == nullptr) {
+    return;
+  }
+
+  security_worker_request_stats_t stats;
+  security_worker_request_stats(worker, &stats, nullptr, nullptr);
+  check(stub_count("GET", "/fresh") == 1 && stats.fetches == 1 && stats.cache_hits == 1, "a fresh hit does not fetch");
+  security_worker_exit(worker);
+}
+
+static void revalidate() {
+  security_worker_t *worker = start("stale entry revalidated", R"(
+    onmessage = function () {
+      request({uri: $ + '/stale', success: function () {
+        request({uri: $ + '/stale', success: function (r) {
+          postMessage((r.text === 'stale body' && r.status === 200 ? 'ok   ' : 'FAIL ') + 'body kept on 304');
+          postMessage('done');
+        }});
+      }});
+    };
+  )");
+  if (worker == nullptr) {
+    return;
+  }
+
+  security_worker_request_stats_t stats;
+  security_worker_request_stats(worker, &stats, nullptr, nullptr);
+  check(stub_count("GET", "/stale") == 2 && seen[0].if_none_match[0] == '\0' &&
+        strcmp(seen[1].if_none_match, "\"v1\"") == 0, "a stale entry sends If-None-Match");
+  check(stats.fetches == 2 && stats.revalidated == 1 && stats.failed == 0, "a 304 counts as revalidated");
+  security_worker_exit(worker);
+}
+
+static void invalidate() {
+  security_worker_t *worker = start("POST drops the cached entry", R"(
+    onmessage = function () {
+      request({uri: $ + '/doc', success: function () {
+        request({uri: $ + '/doc', method: 'POST', body: 'x', success: function () {
+          request({uri: $ + '/doc', success: function (r) {
+            postMessage((r.text === 'doc' ? 'ok   ' : 'FAIL ') + 'refetched body');
+            postMessage('done');
+          }});
+        }});
+      }});
+    };
+  )");
+  if (worker == nullptr) {
+    return;
+  }
+
+  security_worker_request_stats_t stats;
+  security_worker_request_stats(worker, &stats, nullptr, nullptr);
+  check(stub_count("GET", "/doc") == 2 && stub_count("POST", "/doc") == 1 && stats.cache_hits == 0,
+        "the GET after a POST fetches again");
+  security_worker_exit(worker);
+}
+
+static void max_active() {
+  // one fetch at a time, the cache as usual
+  security_worker_request_config_t config{1, 64, 1 << 20};
+  security_worker_t *worker = start("requests wait for max_active", R"(
+    onmessage = function () {
+      var n = 0;
+      function got() { if (++n == 3) postMessage('done'); }
+      request({uri: $ + '/a', success: got});
+      request({uri: $ + '/b', success: got});
+      request({uri: $ + '/c', success: got});
+    };
+  )", &config);
+  if (worker == nullptr) {
+    return;
+  }
+
+  security_worker_request_stats_t stats;
+  security_worker_request_stats(worker, &stats, nullptr, nullptr);
+  check(seen_len == 3 && open_max == 1 && stats.fetches == 3 && stats.waiting == 0, "one fetch in flight at a time");
+  security_worker_exit(worker);
+}
+
+int main() {
+  ext::loop::init();
+  if (!stub_start()) {
+    check(false, "stub server");
+    return 1;
+  }
+
+  abort_after_end();
+  coalesce();
+  fresh_hit();
+  revalidate();
+  invalidate();
+  max_active();
+
+  stub_stop();
+  ext::loop::shutdown();
+  return failures == 0 ? 0 : 1;
+}
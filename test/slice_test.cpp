@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "core.hpp"
+#include "loop.hpp"
+
+extern "C" {
+#include "emscripten.h"
+}
+
+#define LIMIT_US 20000
+// a stopped handler returns well before its loop would have ended
+#define LOOP_MS 500.0
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  failures += ok ? 0 : 1;
+}
+
+static void post(security_worker_t *worker, const char *data, size_t len, void *user_data) {
+}
+
+// runs `loop` in onmessage and checks it is stopped at the limit
+static void stops(const char *name, const char *loop) {
+  char source[512];
+  snprintf(source, sizeof(source), "var n = %.0f; onmessage = function () { var t = Date.now(); %s };", LOOP_MS, loop);
+
+  size_t en_len = 0;
+  char *payload = security_worker_pack(source, strlen(source), &en_len);
+  security_worker_t *worker = security_worker_create(payload, strlen(payload), en_len, (char *) "[]", post, nullptr);
+  free(payload);
+  if (worker == nullptr) {
+    check(false, name);
+    return;
+  }
+
+  security_worker_slice_config_t config{0, LIMIT_US};
+  security_worker_slice_config(worker, &config);
+
+  double start = emscripten_get_now();
+  security_worker_onmessage_json(worker, "0");
+  double elapsed = emscripten_get_now() - start;
+
+  security_worker_slice_stats_t stats;
+  security_worker_slice_stats(worker, &stats);
+  security_worker_exit(worker);
+  // the end of the turn is still queued, let it run so the loop is empty
+  ext::loop::run();
+
+  char what[128];
+  snprintf(what, sizeof(what), "%s: stopped after %.1fms, stats.stopped %llu", name, elapsed,
+           (unsigned long long) stats.stopped);
+  check(elapsed < LOOP_MS / 2 && stats.stopped == 1, what);
+}
+
+int main() {
+  ext::loop::init();
+
+  stops("while", "while (Date.now() - t < n) {}");
+  stops("do while", "do {} while (Date.now() - t < n);");
+  stops("for", "for (var i = 0; Date.now() - t < n; i++) {}");
+  stops("for counter", "for (var i = 0; i < 100000000; i++) {}");
+  stops("while true", "while (true) { if (Date.now() - t >= n) break; }");
+
+  ext::loop::shutdown();
+  return failures == 0 ? 0 : 1;
+}